@@ -0,0 +1,351 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MemoryBlock.h"
+#include "MemoryBlockFormat.h"
+
+namespace ORUtils
+{
+
+/**
+ * \brief This class saves memory blocks to disk on a background thread.
+ *
+ * Saving a block only takes a snapshot of it into a staging buffer, which is then written out in the same format as
+ * MemoryBlockPersister::SaveMemoryBlock by an I/O thread, so the caller can carry on modifying the block straight away.
+ * Staging buffers are reused between saves. The total size of the snapshots waiting to be written is limited: once
+ * the limit is reached, further saves wait for earlier ones to finish.
+ *
+ * Each file is written under a temporary name and renamed when complete, so an interrupted save never leaves a
+ * partially written file behind.
+ */
+class AsyncMemoryBlockPersister
+{
+  //#################### NESTED TYPES ####################
+private:
+  /**
+   * \brief A snapshot waiting to be written.
+   */
+  struct Job
+  {
+    /** The number of elements in the block. */
+    uint64_t elementCount;
+
+    /** The size of an element in bytes. */
+    uint32_t elementSize;
+
+    /** The name of the file to write. */
+    std::string filename;
+
+    /** The save options. */
+    MemoryBlockSaveOptions options;
+
+    /** The promise that reports completion to the caller. */
+    std::promise<void> promise;
+
+    /** The snapshot of the block's data. */
+    ORUtils::MemoryBlock<unsigned char> *staging;
+
+    /** The element type tag. */
+    uint32_t typeTag;
+  };
+
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** Signalled when a job is queued or the persister is shutting down. */
+  std::condition_variable m_jobQueued;
+
+  /** Signalled when a job finishes and its staging buffer is released. */
+  std::condition_variable m_jobFinished;
+
+  /** Staging buffers that are not currently in use. */
+  std::vector<ORUtils::MemoryBlock<unsigned char>*> m_freeBuffers;
+
+  /** The total capacity of the free staging buffers in bytes. */
+  size_t m_freeBytes;
+
+  /** The total size of the snapshots that have not been written yet, in bytes. */
+  size_t m_inFlightBytes;
+
+  /** The jobs waiting for the I/O thread. */
+  std::deque<Job*> m_jobs;
+
+  /** The maximum value of m_inFlightBytes. */
+  size_t m_maxInFlightBytes;
+
+  /** The mutex protecting the queue, the buffers and the counters. */
+  mutable std::mutex m_mutex;
+
+  /** The number of jobs that have been queued but not yet finished. */
+  size_t m_pendingJobs;
+
+  /** Whether the I/O thread should exit once the queue is empty. */
+  bool m_stopping;
+
+  /** The I/O thread. */
+  std::thread m_thread;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Starts the I/O thread.
+   *
+   * \param maxInFlightBytes  The maximum total size of the snapshots waiting to be written. A single block larger
+   *                          than this can still be saved, but only once nothing else is in flight.
+   */
+  explicit AsyncMemoryBlockPersister(size_t maxInFlightBytes = (size_t)1 << 30)
+  : m_freeBytes(0), m_inFlightBytes(0), m_maxInFlightBytes(maxInFlightBytes), m_pendingJobs(0), m_stopping(false)
+  {
+    m_thread = std::thread(&AsyncMemoryBlockPersister::RunIOThread, this);
+  }
+
+  //#################### DESTRUCTOR ####################
+public:
+  /**
+   * \brief Finishes writing all of the queued blocks and stops the I/O thread.
+   */
+  ~AsyncMemoryBlockPersister()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_jobQueued.notify_all();
+    m_thread.join();
+
+    for(size_t i = 0, size = m_freeBuffers.size(); i < size; ++i) delete m_freeBuffers[i];
+  }
+
+  //#################### COPY CONSTRUCTOR & ASSIGNMENT OPERATOR ####################
+public:
+  // Suppress the default copy constructor and assignment operator
+  AsyncMemoryBlockPersister(const AsyncMemoryBlockPersister&) = delete;
+  AsyncMemoryBlockPersister& operator=(const AsyncMemoryBlockPersister&) = delete;
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Gets the total size of the snapshots that have not been written yet, in bytes.
+   */
+  size_t GetInFlightBytes() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_inFlightBytes;
+  }
+
+  /**
+   * \brief Gets the number of saves that have not finished yet.
+   */
+  size_t GetPendingCount() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pendingJobs;
+  }
+
+  /**
+   * \brief Snapshots a memory block and queues it to be saved to a file on disk.
+   *
+   * The call returns as soon as the block's data has been copied into a staging buffer, unless the in-flight limit
+   * has been reached, in which case it first waits for earlier saves to finish.
+   *
+   * \param filename          The name of the file.
+   * \param block             The memory block to save.
+   * \param memoryDeviceType  The type of memory device from which to save the data.
+   * \param options           Whether to store a checksum, how to compress the data and how to align it in the file.
+   * \return                  A future that becomes ready when the file has been written, and rethrows any error
+   *                          that occurred while writing it.
+   */
+  template <typename T>
+  std::future<void> SaveMemoryBlockAsync(const std::string& filename, const ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType,
+                                         const MemoryBlockSaveOptions& options = MemoryBlockSaveOptions())
+  {
+    size_t bytes = block.dataSize * sizeof(T);
+    ORUtils::MemoryBlock<unsigned char> *staging = AcquireStagingBuffer(bytes);
+
+    try
+    {
+      unsigned char *snapshot = staging->GetData(MEMORYDEVICE_CPU);
+      if(memoryDeviceType == MEMORYDEVICE_CUDA)
+      {
+        MemoryBackend *backend = block.GetDeviceBackend();
+        if(backend == NULL) throw std::runtime_error("Cannot save a memory block that has no device data from the device");
+        backend->Copy(snapshot, block.GetData(MEMORYDEVICE_CUDA), bytes, TRANSFER_DEVICE_TO_HOST);
+      }
+      else ParallelMemcpy(snapshot, block.GetData(MEMORYDEVICE_CPU), bytes);
+    }
+    catch(...)
+    {
+      ReleaseStagingBuffer(staging, bytes);
+      throw;
+    }
+
+    Job *job = new Job;
+    job->elementCount = block.dataSize;
+    job->elementSize = sizeof(T);
+    job->filename = filename;
+    job->options = options;
+    job->staging = staging;
+    job->typeTag = MemoryBlockTypeTag<T>::Value();
+    std::future<void> result = job->promise.get_future();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_jobs.push_back(job);
+      ++m_pendingJobs;
+    }
+    m_jobQueued.notify_one();
+
+    return result;
+  }
+
+  /**
+   * \brief Waits until all of the queued blocks have been written.
+   */
+  void WaitForAll()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_pendingJobs > 0) m_jobFinished.wait(lock);
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Gets a staging buffer that can hold the specified number of bytes, waiting for the in-flight limit if necessary.
+   */
+  ORUtils::MemoryBlock<unsigned char> *AcquireStagingBuffer(size_t bytes)
+  {
+    ORUtils::MemoryBlock<unsigned char> *buffer = NULL;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(m_inFlightBytes > 0 && m_inFlightBytes + bytes > m_maxInFlightBytes) m_jobFinished.wait(lock);
+      m_inFlightBytes += bytes;
+
+      // Reuse the smallest free buffer that is large enough.
+      size_t best = m_freeBuffers.size();
+      for(size_t i = 0, size = m_freeBuffers.size(); i < size; ++i)
+      {
+        size_t capacity = m_freeBuffers[i]->GetCapacity();
+        if(capacity >= bytes && (best == size || capacity < m_freeBuffers[best]->GetCapacity())) best = i;
+      }
+
+      if(best < m_freeBuffers.size())
+      {
+        buffer = m_freeBuffers[best];
+        m_freeBuffers.erase(m_freeBuffers.begin() + best);
+        m_freeBytes -= buffer->GetCapacity();
+      }
+    }
+
+    if(buffer != NULL) buffer->Resize(bytes);
+    else buffer = new ORUtils::MemoryBlock<unsigned char>(bytes, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised().Tagged("AsyncMemoryBlockPersister"));
+    return buffer;
+  }
+
+  /**
+   * \brief Returns a staging buffer to the free list, or frees it if the free list is already as large as the in-flight limit.
+   */
+  void ReleaseStagingBuffer(ORUtils::MemoryBlock<unsigned char> *buffer, size_t bytes)
+  {
+    bool keep;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_inFlightBytes -= bytes;
+      keep = m_freeBytes + buffer->GetCapacity() <= m_maxInFlightBytes;
+      if(keep)
+      {
+        m_freeBuffers.push_back(buffer);
+        m_freeBytes += buffer->GetCapacity();
+      }
+    }
+
+    if(!keep) delete buffer;
+    m_jobFinished.notify_all();
+  }
+
+  /**
+   * \brief Writes queued snapshots until the persister is destroyed and the queue is empty.
+   */
+  void RunIOThread()
+  {
+    for(;;)
+    {
+      Job *job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(m_jobs.empty() && !m_stopping) m_jobQueued.wait(lock);
+        if(m_jobs.empty()) return;
+        job = m_jobs.front();
+        m_jobs.pop_front();
+      }
+
+      try
+      {
+        WriteJob(*job);
+        job->promise.set_value();
+      }
+      catch(...)
+      {
+        job->promise.set_exception(std::current_exception());
+      }
+
+      ReleaseStagingBuffer(job->staging, (size_t)(job->elementCount * job->elementSize));
+      delete job;
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_pendingJobs;
+      }
+      m_jobFinished.notify_all();
+    }
+  }
+
+  /**
+   * \brief Writes a snapshot to a temporary file and renames it to its final name.
+   *
+   * \throws std::runtime_error If the write or the rename is unsuccessful.
+   */
+  static void WriteJob(const Job& job)
+  {
+    std::string tempFilename = job.filename + ".tmp";
+
+    std::ofstream fs(tempFilename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + tempFilename + " for writing");
+
+    try
+    {
+      WriteMemoryBlock(fs, job.staging->GetData(MEMORYDEVICE_CPU), job.elementCount, job.elementSize, job.typeTag, job.options);
+      fs.close();
+      if(!fs) throw std::runtime_error("Could not write " + tempFilename);
+    }
+    catch(...)
+    {
+      fs.close();
+      remove(tempFilename.c_str());
+      throw;
+    }
+
+#ifdef _WIN32
+    // rename does not replace existing files on Windows.
+    remove(job.filename.c_str());
+#endif
+    if(rename(tempFilename.c_str(), job.filename.c_str()) != 0)
+    {
+      remove(tempFilename.c_str());
+      throw std::runtime_error("Could not rename " + tempFilename + " to " + job.filename);
+    }
+  }
+};
+
+}
@@ -0,0 +1,52 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../PlatformIndependence.h"
+#include "../MathUtils.h"
+#include "../Vector.h"
+
+namespace ORUtils
+{
+	namespace Benchmark
+	{
+		/** Run @p op @p repeats times and return the fastest run in milliseconds. */
+		template <typename Op>
+		inline double TimeBest(int repeats, const Op& op)
+		{
+			double best = 0.0;
+			for (int i = 0; i < repeats; ++i)
+			{
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				op();
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (i == 0 || ms < best) best = ms;
+			}
+			return best;
+		}
+
+		/** Get command line argument @p index as a positive integer, or @p fallback if it is missing. */
+		inline int IntArgument(int argc, char **argv, int index, int fallback)
+		{
+			if (index >= argc) return fallback;
+			int value = atoi(argv[index]);
+			if (value <= 0)
+			{
+				fprintf(stderr, "Argument %d must be a positive integer\n", index);
+				exit(1);
+			}
+			return value;
+		}
+
+		/** Throughput in MB/s of processing @p bytes in @p ms milliseconds. */
+		inline double MegabytesPerSecond(double bytes, double ms)
+		{
+			return ms > 0.0 ? bytes / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0;
+		}
+	}
+}
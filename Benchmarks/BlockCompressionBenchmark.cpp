@@ -0,0 +1,112 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+// Measures the compression ratio and the compression and decompression
+// throughput of each codec on a few kinds of data typical of memory
+// blocks. Usage: BlockCompressionBenchmark [megabytes] [repeats]
+
+#include <math.h>
+
+#include <vector>
+
+#include "Benchmark.h"
+#include "../BlockCompression.h"
+
+using namespace ORUtils;
+
+namespace
+{
+	/** A named buffer of test data made of elements of a given size. */
+	struct TestData
+	{
+		const char *name;
+		size_t elementSize;
+		std::vector<char> bytes;
+	};
+
+	/** Depth-map-like floats: smooth surfaces with occasional steps and holes. */
+	TestData MakeDepth(size_t bytes)
+	{
+		TestData data = { "depth", sizeof(float), std::vector<char>(bytes) };
+		float *values = reinterpret_cast<float*>(&data.bytes[0]);
+		size_t count = bytes / sizeof(float), width = 640;
+		for (size_t i = 0; i < count; ++i)
+		{
+			float x = (float)(i % width), y = (float)(i / width % 480);
+			values[i] = (i / 97) % 13 == 0 ? 0.0f : 1.5f + 0.001f * x + 0.0005f * y + ((int)(x / 80) % 2) * 0.25f;
+		}
+		return data;
+	}
+
+	/** Voxel-like records that are mostly zero, with occupied runs. */
+	TestData MakeSparse(size_t bytes)
+	{
+		TestData data = { "sparse", 8, std::vector<char>(bytes, 0) };
+		for (size_t i = 0; i + 8 <= bytes; i += 8)
+		{
+			if ((i / 8) % 64 < 6)
+			{
+				short sdf = (short)((i / 8) % 64 * 1000);
+				unsigned char weight = 100;
+				memcpy(&data.bytes[i], &sdf, sizeof(sdf));
+				data.bytes[i + 2] = (char)weight;
+			}
+		}
+		return data;
+	}
+
+	/** Incompressible bytes, the worst case for every codec. */
+	TestData MakeRandom(size_t bytes)
+	{
+		TestData data = { "random", 1, std::vector<char>(bytes) };
+		uint32_t state = 12345;
+		for (size_t i = 0; i < bytes; ++i)
+		{
+			state = state * 1664525u + 1013904223u;
+			data.bytes[i] = (char)(state >> 24);
+		}
+		return data;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t bytes = (size_t)Benchmark::IntArgument(argc, argv, 1, 64) << 20;
+	int repeats = Benchmark::IntArgument(argc, argv, 2, 3);
+
+	std::vector<TestData> tests;
+	tests.push_back(MakeDepth(bytes));
+	tests.push_back(MakeSparse(bytes));
+	tests.push_back(MakeRandom(bytes));
+
+	const CompressionCodec codecs[] = { COMPRESSION_NONE, COMPRESSION_RLE, COMPRESSION_LZ };
+	const char *codecNames[] = { "none", "rle", "lz" };
+
+	printf("%zu MB of each kind of data, best of %d runs\n", bytes >> 20, repeats);
+	printf("%-8s %-6s %8s %16s %16s\n", "data", "codec", "ratio", "compress", "decompress");
+
+	for (size_t t = 0; t < tests.size(); ++t)
+	{
+		const TestData& test = tests[t];
+		std::vector<char> output(bytes);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			CompressionOptions options(codecs[c]);
+			std::vector<char> compressed;
+
+			double compressMs = Benchmark::TimeBest(repeats, [&]() { CompressBlock(&test.bytes[0], bytes, test.elementSize, options, compressed); });
+			double decompressMs = Benchmark::TimeBest(repeats, [&]() { DecompressBlock(&compressed[0], compressed.size(), &output[0], bytes, options.numThreads); });
+
+			if (output != test.bytes)
+			{
+				fprintf(stderr, "The %s codec did not restore the %s data\n", codecNames[c], test.name);
+				return 1;
+			}
+
+			printf("%-8s %-6s %8.2f %11.1f MB/s %11.1f MB/s\n", test.name, codecNames[c], (double)bytes / compressed.size(),
+				Benchmark::MegabytesPerSecond((double)bytes, compressMs), Benchmark::MegabytesPerSecond((double)bytes, decompressMs));
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+// Records a sequence of synthetic depth frames, uncompressed and
+// compressed, and measures how fast each way of reading it replays the
+// frames. The file is read back straight after it is written, so it is
+// normally in the operating system's cache and the figures show the
+// decoding cost rather than the disk speed.
+// Usage: ImageSequenceBenchmark [frames] [repeats] [file]
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "Benchmark.h"
+#include "../ImageSequence.h"
+
+using namespace ORUtils;
+
+namespace
+{
+	/** Fill @p image with a depth map of a slowly moving scene. */
+	void RenderFrame(Image<float>& image, int frame)
+	{
+		float *depth = image.GetData(MEMORYDEVICE_CPU);
+		for (int y = 0; y < image.noDims.y; ++y)
+			for (int x = 0; x < image.noDims.x; ++x)
+			{
+				float wave = 0.1f * sinf(0.02f * (x + 3 * frame)) * cosf(0.03f * y);
+				depth[y * image.noDims.x + x] = (x + frame) % 160 < 8 ? 0.0f : 1.5f + wave + 0.0005f * y;
+			}
+	}
+
+	void WriteSequence(const std::string& filename, int frames, const MemoryBlockSaveOptions& options)
+	{
+		Image<float> image(Vector2<int>(640, 480), true, false);
+		ImageSequenceWriter writer(filename, options);
+		for (int i = 0; i < frames; ++i)
+		{
+			RenderFrame(image, i);
+			writer.AppendFrame(image, MEMORYDEVICE_CPU, (uint64_t)i * 33333);
+		}
+		writer.Close();
+	}
+
+	/** Read every frame of @p filename with ReadFrame, returning the time in milliseconds. */
+	double ReplayFrames(const std::string& filename, int repeats, bool mapped, size_t prefetch)
+	{
+		ImageSequenceReader reader(filename, mapped);
+		reader.SetPrefetchCount(prefetch);
+		Image<float> image(reader.GetFrameDims(0), true, false);
+		return Benchmark::TimeBest(repeats, [&]()
+		{
+			for (size_t i = 0; i < reader.GetFrameCount(); ++i) reader.ReadFrame(i, image, MEMORYDEVICE_CPU);
+		});
+	}
+
+	/** View every frame of @p filename in place, touching each row so that the data is really read. */
+	double ViewFrames(const std::string& filename, int repeats)
+	{
+		ImageSequenceReader reader(filename);
+		reader.SetPrefetchCount(4);
+		volatile float sink = 0.0f;
+		return Benchmark::TimeBest(repeats, [&]()
+		{
+			for (size_t i = 0; i < reader.GetFrameCount(); ++i)
+			{
+				ImageView<const float> view = reader.GetFrameView<float>(i);
+				float sum = 0.0f;
+				for (int y = 0; y < view.noDims.y; ++y)
+				{
+					const float *row = view.GetRow(y);
+					for (int x = 0; x < view.noDims.x; x += 16) sum += row[x];
+				}
+				sink = sink + sum;
+			}
+		});
+	}
+
+	void PrintResult(const char *name, double ms, int frames)
+	{
+		double bytes = (double)frames * 640 * 480 * sizeof(float);
+		printf("%-28s %9.1f frames/s %9.1f MB/s\n", name, ms > 0.0 ? frames * 1000.0 / ms : 0.0, Benchmark::MegabytesPerSecond(bytes, ms));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int frames = Benchmark::IntArgument(argc, argv, 1, 300);
+	int repeats = Benchmark::IntArgument(argc, argv, 2, 3);
+	std::string filename = argc > 3 ? argv[3] : "ImageSequenceBenchmark.orsq";
+	std::string compressedFilename = filename + ".lz";
+
+	MemoryBlockSaveOptions options, compressedOptions;
+	compressedOptions.compression = CompressionOptions(COMPRESSION_LZ);
+
+	try
+	{
+		WriteSequence(filename, frames, options);
+		WriteSequence(compressedFilename, frames, compressedOptions);
+
+		printf("%d frames of 640x480 float depth, best of %d runs\n", frames, repeats);
+		PrintResult("ReadFrame", ReplayFrames(filename, repeats, false, 0), frames);
+		PrintResult("ReadFrame, mapped", ReplayFrames(filename, repeats, true, 0), frames);
+		PrintResult("GetFrameView, mapped", ViewFrames(filename, repeats), frames);
+		PrintResult("ReadFrame, lz", ReplayFrames(compressedFilename, repeats, false, 0), frames);
+		PrintResult("ReadFrame, lz, prefetch 4", ReplayFrames(compressedFilename, repeats, false, 4), frames);
+	}
+	catch (std::exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		remove(filename.c_str());
+		remove(compressedFilename.c_str());
+		return 1;
+	}
+
+	remove(filename.c_str());
+	remove(compressedFilename.c_str());
+	return 0;
+}
@@ -0,0 +1,62 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+// Compares the throughput of ParallelMemset and ParallelMemcpy with single
+// memset and memcpy calls over a range of sizes, both with the default
+// configuration and with every size split across threads.
+// Usage: ParallelMemoryBenchmark [max megabytes] [repeats]
+
+#include <vector>
+
+#include "Benchmark.h"
+#include "../ParallelMemory.h"
+
+using namespace ORUtils;
+
+namespace
+{
+	/** Throughput in GB/s of moving @p bytes in @p ms milliseconds. */
+	double GigabytesPerSecond(double bytes, double ms)
+	{
+		return Benchmark::MegabytesPerSecond(bytes, ms) / 1024.0;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t maxBytes = (size_t)Benchmark::IntArgument(argc, argv, 1, 512) << 20;
+	int repeats = Benchmark::IntArgument(argc, argv, 2, 5);
+
+	ParallelMemoryConfig defaults, split;
+	split.parallelThreshold = 0;
+
+	// Touch both buffers first so that page faults are not timed.
+	std::vector<unsigned char> source(maxBytes, 1), target(maxBytes, 0);
+
+	printf("%u threads, best of %d runs, GB/s\n", ParallelMemoryDetail::NumThreads(defaults), repeats);
+	printf("%-9s %9s %9s %9s   %9s %9s %9s\n", "size", "memset", "default", "split", "memcpy", "default", "split");
+
+	for (size_t bytes = (size_t)1 << 20; bytes <= maxBytes; bytes *= 4)
+	{
+		unsigned char *dst = &target[0];
+		const unsigned char *src = &source[0];
+
+		double setMs = Benchmark::TimeBest(repeats, [&]() { memset(dst, 2, bytes); });
+		double setDefaultMs = Benchmark::TimeBest(repeats, [&]() { ParallelMemset(dst, 3, bytes, defaults); });
+		double setSplitMs = Benchmark::TimeBest(repeats, [&]() { ParallelMemset(dst, 4, bytes, split); });
+		double copyMs = Benchmark::TimeBest(repeats, [&]() { memcpy(dst, src, bytes); });
+		double copyDefaultMs = Benchmark::TimeBest(repeats, [&]() { ParallelMemcpy(dst, src, bytes, defaults); });
+		double copySplitMs = Benchmark::TimeBest(repeats, [&]() { ParallelMemcpy(dst, src, bytes, split); });
+
+		if (memcmp(dst, src, bytes) != 0)
+		{
+			fprintf(stderr, "ParallelMemcpy did not copy the data\n");
+			return 1;
+		}
+
+		printf("%6zu MB %9.2f %9.2f %9.2f   %9.2f %9.2f %9.2f\n", bytes >> 20,
+			GigabytesPerSecond((double)bytes, setMs), GigabytesPerSecond((double)bytes, setDefaultMs), GigabytesPerSecond((double)bytes, setSplitMs),
+			GigabytesPerSecond((double)bytes, copyMs), GigabytesPerSecond((double)bytes, copyDefaultMs), GigabytesPerSecond((double)bytes, copySplitMs));
+	}
+
+	return 0;
+}
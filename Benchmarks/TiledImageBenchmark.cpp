@@ -0,0 +1,105 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+// Times 3x3 and 5x5 box filters over the same image stored row by row, in
+// 8x8 tiles and in Z-order, the tiled images through their tile-local
+// neighbourhoods, to show how the layout affects neighbourhood
+// access. Usage: TiledImageBenchmark [size] [repeats]
+
+#include "Benchmark.h"
+#include "../TiledImage.h"
+
+using namespace ORUtils;
+
+namespace
+{
+	/** Filter every pixel in row-major order. */
+	void FilterImage(const Image<float>& source, Image<float>& target, int radius)
+	{
+		const float *src = source.GetData(MEMORYDEVICE_CPU);
+		float *dst = target.GetData(MEMORYDEVICE_CPU);
+		Vector2<int> noDims = source.noDims;
+		float scale = 1.0f / ((2 * radius + 1) * (2 * radius + 1));
+
+		for (int y = 0; y < noDims.y; ++y)
+			for (int x = 0; x < noDims.x; ++x)
+			{
+				float sum = 0.0f;
+				for (int dy = -radius; dy <= radius; ++dy)
+				{
+					const float *row = src + (size_t)CLAMP(y + dy, 0, noDims.y - 1) * noDims.x;
+					for (int dx = -radius; dx <= radius; ++dx) sum += row[CLAMP(x + dx, 0, noDims.x - 1)];
+				}
+				dst[(size_t)y * noDims.x + x] = sum * scale;
+			}
+	}
+
+	/** Filter every pixel one tile at a time through the tile-local
+	neighbourhoods, so that the layout is resolved once per tile rather
+	than once per tap.
+	*/
+	void FilterImage(const TiledImage<float>& source, TiledImage<float>& target, int radius)
+	{
+		float *dst = target.GetData(MEMORYDEVICE_CPU);
+		float scale = 1.0f / ((2 * radius + 1) * (2 * radius + 1));
+
+		source.ForEachNeighbourhood(radius, [&](const TiledNeighbourhood<float>& neighbourhood, int, int)
+		{
+			float sum = 0.0f;
+			for (int dy = -radius; dy <= radius; ++dy)
+				for (int dx = -radius; dx <= radius; ++dx) sum += neighbourhood(dx, dy);
+			dst[neighbourhood.address] = sum * scale;
+		});
+	}
+
+	/** Largest difference between two row-major images of the same size. */
+	float MaxDifference(const Image<float>& a, const Image<float>& b)
+	{
+		const float *pa = a.GetData(MEMORYDEVICE_CPU), *pb = b.GetData(MEMORYDEVICE_CPU);
+		float result = 0.0f;
+		for (size_t i = 0; i < a.dataSize; ++i) result = MAX(result, fabsf(pa[i] - pb[i]));
+		return result;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int size = Benchmark::IntArgument(argc, argv, 1, 2048);
+	int repeats = Benchmark::IntArgument(argc, argv, 2, 5);
+	Vector2<int> noDims(size, size);
+
+	Image<float> source(noDims, true, false), target(noDims, true, false), check(noDims, true, false);
+	float *data = source.GetData(MEMORYDEVICE_CPU);
+	for (size_t i = 0; i < source.dataSize; ++i) data[i] = (float)((i * 2654435761u) % 1024);
+
+	TiledImage<float> tiledSource(noDims, TILEDLAYOUT_TILES, true, false), tiledTarget(noDims, TILEDLAYOUT_TILES, true, false);
+	TiledImage<float> mortonSource(noDims, TILEDLAYOUT_MORTON, true, false), mortonTarget(noDims, TILEDLAYOUT_MORTON, true, false);
+	tiledSource.CopyFrom(source);
+	mortonSource.CopyFrom(source);
+
+	printf("%dx%d float image, best of %d runs\n", size, size, repeats);
+	printf("%-8s %12s %12s %12s\n", "filter", "row-major", "tiles", "morton");
+
+	for (int radius = 1; radius <= 2; ++radius)
+	{
+		double rowMs = Benchmark::TimeBest(repeats, [&]() { FilterImage(source, target, radius); });
+		double tiledMs = Benchmark::TimeBest(repeats, [&]() { FilterImage(tiledSource, tiledTarget, radius); });
+		double mortonMs = Benchmark::TimeBest(repeats, [&]() { FilterImage(mortonSource, mortonTarget, radius); });
+
+		// The layouts only change the order of the memory accesses, not the sums.
+		tiledTarget.CopyTo(check);
+		float tiledError = MaxDifference(target, check);
+		mortonTarget.CopyTo(check);
+		float mortonError = MaxDifference(target, check);
+		if (tiledError != 0.0f || mortonError != 0.0f)
+		{
+			fprintf(stderr, "The layouts gave different results\n");
+			return 1;
+		}
+
+		char name[16];
+		snprintf(name, sizeof(name), "%dx%d", 2 * radius + 1, 2 * radius + 1);
+		printf("%-8s %9.2f ms %9.2f ms %9.2f ms\n", name, rowMs, tiledMs, mortonMs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,457 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace ORUtils
+{
+	/** Codecs for compressing memory blocks. */
+	enum CompressionCodec { COMPRESSION_NONE, COMPRESSION_RLE, COMPRESSION_LZ };
+
+	/** \brief
+	How CompressBlock compresses data.
+	*/
+	struct CompressionOptions
+	{
+		CompressionCodec codec;
+
+		/** Whether to group the n-th bytes of all elements together before
+		compressing. This turns the similar high bytes of smoothly varying
+		numbers into long runs and usually improves the ratio considerably.
+		*/
+		bool shuffle;
+
+		/** Data is split into chunks of about this many bytes, which are
+		compressed and decompressed independently and in parallel.
+		*/
+		size_t chunkBytes;
+
+		/** Number of worker threads, 0 for one per hardware thread. */
+		unsigned int numThreads;
+
+		CompressionOptions(CompressionCodec codec = COMPRESSION_NONE, bool shuffle = true)
+		{
+			this->codec = codec;
+			this->shuffle = shuffle;
+			this->chunkBytes = (size_t)1 << 20;
+			this->numThreads = 0;
+		}
+	};
+
+	namespace BlockCompressionDetail
+	{
+		/** Header of a compressed stream, followed by one 64-bit size per chunk and the chunks. */
+		struct StreamHeader
+		{
+			uint32_t codec;
+			/** Element size the chunks were shuffled with, 1 if they were not. */
+			uint32_t shuffleElementSize;
+			uint64_t chunkBytes;
+			uint64_t rawBytes;
+			uint64_t chunkCount;
+		};
+
+		/** Set in a chunk's size if the chunk is stored without compression. */
+		const uint64_t CHUNK_STORED = (uint64_t)1 << 63;
+
+		inline void Shuffle(const unsigned char *src, unsigned char *dst, size_t bytes, size_t elementSize)
+		{
+			size_t count = bytes / elementSize;
+			for (size_t b = 0; b < elementSize; ++b)
+			{
+				unsigned char *out = dst + b * count;
+				for (size_t i = 0; i < count; ++i) out[i] = src[i * elementSize + b];
+			}
+			memcpy(dst + count * elementSize, src + count * elementSize, bytes - count * elementSize);
+		}
+
+		inline void Unshuffle(const unsigned char *src, unsigned char *dst, size_t bytes, size_t elementSize)
+		{
+			size_t count = bytes / elementSize;
+			for (size_t b = 0; b < elementSize; ++b)
+			{
+				const unsigned char *in = src + b * count;
+				for (size_t i = 0; i < count; ++i) dst[i * elementSize + b] = in[i];
+			}
+			memcpy(dst + count * elementSize, src + count * elementSize, bytes - count * elementSize);
+		}
+
+		/** Run-length encoding: a control byte c < 128 is followed by c + 1
+		literal bytes, c >= 128 by one byte repeated c - 125 times.
+		Returns 0 if the output would not fit in @p capacity bytes.
+		*/
+		inline size_t CompressRLE(const unsigned char *src, size_t bytes, unsigned char *dst, size_t capacity)
+		{
+			size_t out = 0, literalStart = 0, i = 0;
+			while (i <= bytes)
+			{
+				size_t run = 1;
+				if (i < bytes) while (i + run < bytes && run < 130 && src[i + run] == src[i]) ++run;
+
+				// Flush pending literals before a run, at the end, or when they fill a control byte.
+				if (i == bytes || run >= 3 || i - literalStart == 128)
+				{
+					while (literalStart < i)
+					{
+						size_t n = i - literalStart < 128 ? i - literalStart : 128;
+						if (out + 1 + n > capacity) return 0;
+						dst[out++] = (unsigned char)(n - 1);
+						memcpy(dst + out, src + literalStart, n);
+						out += n; literalStart += n;
+					}
+				}
+
+				if (i == bytes) break;
+
+				if (run >= 3)
+				{
+					if (out + 2 > capacity) return 0;
+					dst[out++] = (unsigned char)(run + 125);
+					dst[out++] = src[i];
+					i += run;
+					literalStart = i;
+				}
+				else ++i;
+			}
+			return out;
+		}
+
+		/** Decode RLE data, returning false if it is corrupt or does not decode to exactly @p bytes. */
+		inline bool DecompressRLE(const unsigned char *src, size_t srcBytes, unsigned char *dst, size_t bytes)
+		{
+			size_t in = 0, out = 0;
+			while (in < srcBytes)
+			{
+				unsigned char c = src[in++];
+				if (c < 128)
+				{
+					size_t n = (size_t)c + 1;
+					if (in + n > srcBytes || out + n > bytes) return false;
+					memcpy(dst + out, src + in, n);
+					in += n; out += n;
+				}
+				else
+				{
+					size_t n = (size_t)c - 125;
+					if (in >= srcBytes || out + n > bytes) return false;
+					memset(dst + out, src[in++], n);
+					out += n;
+				}
+			}
+			return out == bytes;
+		}
+
+		inline uint32_t Read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+		/** Append a length continuation: runs of 255 followed by the remainder. */
+		inline bool WriteLength(unsigned char *dst, size_t& out, size_t capacity, size_t length)
+		{
+			for (; length >= 255; length -= 255)
+			{
+				if (out >= capacity) return false;
+				dst[out++] = 255;
+			}
+			if (out >= capacity) return false;
+			dst[out++] = (unsigned char)length;
+			return true;
+		}
+
+		inline bool ReadLength(const unsigned char *src, size_t& in, size_t srcBytes, size_t& length)
+		{
+			unsigned char b;
+			do
+			{
+				if (in >= srcBytes) return false;
+				b = src[in++];
+				length += b;
+			} while (b == 255);
+			return true;
+		}
+
+		/** LZ77 in the style of LZ4: each sequence is a token whose high
+		nibble is the literal count and low nibble the match length minus 4,
+		with longer lengths continued in extra bytes, then the literals and a
+		16-bit match offset. The last sequence has literals only. Returns 0
+		if the output would not fit in @p capacity bytes.
+		*/
+		inline size_t CompressLZ(const unsigned char *src, size_t bytes, unsigned char *dst, size_t capacity)
+		{
+			const int hashBits = 14;
+			const size_t minMatch = 4, lastLiterals = 5, maxOffset = 65535;
+			std::vector<uint32_t> table((size_t)1 << hashBits, 0);
+
+			size_t out = 0, anchor = 0, ip = 0, misses = 0;
+			size_t limit = bytes > minMatch + lastLiterals ? bytes - lastLiterals - minMatch : 0;
+
+			while (ip < limit)
+			{
+				uint32_t sequence = Read32(src + ip);
+				uint32_t hash = (sequence * 2654435761U) >> (32 - hashBits);
+				size_t ref = table[hash];
+				table[hash] = (uint32_t)(ip + 1);
+
+				if (ref == 0 || ip - (ref - 1) > maxOffset || Read32(src + ref - 1) != sequence)
+				{
+					// Skip ahead faster through data that does not compress.
+					ip += 1 + (misses++ >> 6);
+					continue;
+				}
+				--ref;
+				misses = 0;
+
+				size_t matchLength = minMatch;
+				while (ip + matchLength < bytes - lastLiterals && src[ref + matchLength] == src[ip + matchLength]) ++matchLength;
+
+				size_t literalLength = ip - anchor;
+				if (out + 1 + literalLength + 2 > capacity) return 0;
+				unsigned char *token = dst + out++;
+				*token = (unsigned char)((literalLength < 15 ? literalLength : 15) << 4);
+				if (literalLength >= 15 && !WriteLength(dst, out, capacity, literalLength - 15)) return 0;
+				if (out + literalLength + 2 > capacity) return 0;
+				memcpy(dst + out, src + anchor, literalLength);
+				out += literalLength;
+
+				size_t offset = ip - ref;
+				dst[out++] = (unsigned char)(offset & 0xff);
+				dst[out++] = (unsigned char)(offset >> 8);
+
+				size_t extra = matchLength - minMatch;
+				*token |= (unsigned char)(extra < 15 ? extra : 15);
+				if (extra >= 15 && !WriteLength(dst, out, capacity, extra - 15)) return 0;
+
+				ip += matchLength;
+				anchor = ip;
+			}
+
+			size_t literalLength = bytes - anchor;
+			if (out + 1 > capacity) return 0;
+			dst[out++] = (unsigned char)((literalLength < 15 ? literalLength : 15) << 4);
+			if (literalLength >= 15 && !WriteLength(dst, out, capacity, literalLength - 15)) return 0;
+			if (out + literalLength > capacity) return 0;
+			memcpy(dst + out, src + anchor, literalLength);
+			return out + literalLength;
+		}
+
+		/** Decode LZ data, returning false if it is corrupt or does not decode to exactly @p bytes. */
+		inline bool DecompressLZ(const unsigned char *src, size_t srcBytes, unsigned char *dst, size_t bytes)
+		{
+			size_t in = 0, out = 0;
+			while (in < srcBytes)
+			{
+				unsigned char token = src[in++];
+
+				size_t literalLength = token >> 4;
+				if (literalLength == 15 && !ReadLength(src, in, srcBytes, literalLength)) return false;
+				if (literalLength > srcBytes - in || literalLength > bytes - out) return false;
+				memcpy(dst + out, src + in, literalLength);
+				in += literalLength; out += literalLength;
+
+				// The last sequence has no match.
+				if (in == srcBytes) break;
+
+				if (srcBytes - in < 2) return false;
+				size_t offset = (size_t)src[in] | ((size_t)src[in + 1] << 8);
+				in += 2;
+				if (offset == 0 || offset > out) return false;
+
+				size_t matchLength = token & 15;
+				if (matchLength == 15 && !ReadLength(src, in, srcBytes, matchLength)) return false;
+				matchLength += 4;
+				if (matchLength > bytes - out) return false;
+
+				// Matches may overlap their own output, so copy forwards byte by byte in that case.
+				unsigned char *d = dst + out;
+				const unsigned char *s = d - offset;
+				if (offset >= matchLength) memcpy(d, s, matchLength);
+				else for (size_t i = 0; i < matchLength; ++i) d[i] = s[i];
+				out += matchLength;
+			}
+			return out == bytes;
+		}
+
+		/** Run @p op(i) for i in [0, count) on up to @p numThreads threads of
+		the shared thread pool, throwing if any call returns false.
+		*/
+		template <typename Op>
+		inline void ParallelForEachChunk(size_t count, unsigned int numThreads, const Op& op)
+		{
+			if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+			if (numThreads == 0) numThreads = 1;
+
+			std::atomic<bool> failed(false);
+			ThreadPool::Instance().Run(count, numThreads, [&](size_t i)
+			{
+				if (!op(i)) failed = true;
+			});
+
+			if (failed) throw std::runtime_error("Compressed data is corrupt");
+		}
+	}
+
+	/** \brief
+	Compress @p bytes at @p src, made up of elements of @p elementSize
+	bytes, into @p dst, which is resized to fit. The output is
+	self-describing and is restored bit-exactly by DecompressBlock. Chunks
+	that do not get smaller are stored as they are, so the output is never
+	much larger than the input.
+	*/
+	inline void CompressBlock(const void *src, size_t bytes, size_t elementSize, const CompressionOptions& options, std::vector<char>& dst)
+	{
+		using namespace BlockCompressionDetail;
+
+		StreamHeader header;
+		memset(&header, 0, sizeof(header));
+		header.codec = options.codec;
+		header.shuffleElementSize = options.shuffle && elementSize > 1 ? (uint32_t)elementSize : 1;
+
+		// Keep whole elements in each chunk so that shuffling lines up.
+		size_t chunkBytes = options.chunkBytes / header.shuffleElementSize * header.shuffleElementSize;
+		if (chunkBytes == 0) chunkBytes = header.shuffleElementSize;
+		header.chunkBytes = chunkBytes;
+		header.rawBytes = bytes;
+		header.chunkCount = (bytes + chunkBytes - 1) / chunkBytes;
+
+		size_t chunkCount = (size_t)header.chunkCount;
+		std::vector<std::vector<unsigned char> > chunks(chunkCount);
+		std::vector<uint64_t> sizes(chunkCount);
+
+		ParallelForEachChunk(chunkCount, options.numThreads, [&](size_t i) -> bool
+		{
+			const unsigned char *raw = (const unsigned char*)src + i * chunkBytes;
+			size_t n = bytes - i * chunkBytes < chunkBytes ? bytes - i * chunkBytes : chunkBytes;
+
+			std::vector<unsigned char> shuffled;
+			const unsigned char *input = raw;
+			if (header.shuffleElementSize > 1 && options.codec != COMPRESSION_NONE)
+			{
+				shuffled.resize(n);
+				Shuffle(raw, &shuffled[0], n, header.shuffleElementSize);
+				input = &shuffled[0];
+			}
+
+			std::vector<unsigned char>& chunk = chunks[i];
+			chunk.resize(n);
+			size_t compressed = 0;
+			switch (options.codec)
+			{
+			case COMPRESSION_RLE: compressed = CompressRLE(input, n, &chunk[0], n - 1); break;
+			case COMPRESSION_LZ: compressed = CompressLZ(input, n, &chunk[0], n - 1); break;
+			default: break;
+			}
+
+			if (compressed == 0)
+			{
+				memcpy(&chunk[0], raw, n);
+				sizes[i] = n | CHUNK_STORED;
+			}
+			else
+			{
+				chunk.resize(compressed);
+				sizes[i] = compressed;
+			}
+			return true;
+		});
+
+		size_t total = sizeof(header) + chunkCount * sizeof(uint64_t);
+		for (size_t i = 0; i < chunkCount; ++i) total += chunks[i].size();
+
+		dst.resize(total);
+		char *out = &dst[0];
+		memcpy(out, &header, sizeof(header)); out += sizeof(header);
+		if (chunkCount > 0) memcpy(out, &sizes[0], chunkCount * sizeof(uint64_t));
+		out += chunkCount * sizeof(uint64_t);
+		for (size_t i = 0; i < chunkCount; ++i)
+		{
+			if (!chunks[i].empty()) memcpy(out, &chunks[i][0], chunks[i].size());
+			out += chunks[i].size();
+		}
+	}
+
+	/** The number of bytes the data compressed by CompressBlock at @p src decompresses to. */
+	inline size_t GetDecompressedBytes(const void *src, size_t srcBytes)
+	{
+		BlockCompressionDetail::StreamHeader header;
+		if (srcBytes < sizeof(header)) throw std::runtime_error("Compressed data is corrupt");
+		memcpy(&header, src, sizeof(header));
+		return (size_t)header.rawBytes;
+	}
+
+	/** \brief
+	Decompress @p srcBytes at @p src, produced by CompressBlock, into
+	exactly @p bytes at @p dst. Chunks are decompressed in parallel using
+	up to @p numThreads threads, 0 for one per hardware thread. Throws
+	std::runtime_error if the data is corrupt.
+	*/
+	inline void DecompressBlock(const void *src, size_t srcBytes, void *dst, size_t bytes, unsigned int numThreads = 0)
+	{
+		using namespace BlockCompressionDetail;
+
+		StreamHeader header;
+		if (srcBytes < sizeof(header)) throw std::runtime_error("Compressed data is corrupt");
+		memcpy(&header, src, sizeof(header));
+		if (header.rawBytes != bytes || header.shuffleElementSize == 0 || header.chunkBytes == 0 ||
+			header.chunkCount != (bytes + header.chunkBytes - 1) / header.chunkBytes ||
+			header.chunkCount > (srcBytes - sizeof(header)) / sizeof(uint64_t))
+		{
+			throw std::runtime_error("Compressed data is corrupt");
+		}
+
+		size_t chunkCount = (size_t)header.chunkCount, chunkBytes = (size_t)header.chunkBytes;
+		const unsigned char *table = (const unsigned char*)src + sizeof(header);
+
+		std::vector<uint64_t> sizes(chunkCount), offsets(chunkCount);
+		if (chunkCount > 0) memcpy(&sizes[0], table, chunkCount * sizeof(uint64_t));
+
+		uint64_t offset = sizeof(header) + chunkCount * sizeof(uint64_t);
+		for (size_t i = 0; i < chunkCount; ++i)
+		{
+			offsets[i] = offset;
+			uint64_t size = sizes[i] & ~CHUNK_STORED;
+			if (size > srcBytes - offset) throw std::runtime_error("Compressed data is corrupt");
+			offset += size;
+		}
+
+		ParallelForEachChunk(chunkCount, numThreads, [&](size_t i) -> bool
+		{
+			const unsigned char *in = (const unsigned char*)src + offsets[i];
+			unsigned char *out = (unsigned char*)dst + i * chunkBytes;
+			size_t n = bytes - i * chunkBytes < chunkBytes ? bytes - i * chunkBytes : chunkBytes;
+			size_t size = (size_t)(sizes[i] & ~CHUNK_STORED);
+
+			if (sizes[i] & CHUNK_STORED)
+			{
+				if (size != n) return false;
+				memcpy(out, in, n);
+				return true;
+			}
+
+			std::vector<unsigned char> shuffled;
+			unsigned char *target = out;
+			if (header.shuffleElementSize > 1)
+			{
+				shuffled.resize(n);
+				target = &shuffled[0];
+			}
+
+			bool ok = false;
+			switch (header.codec)
+			{
+			case COMPRESSION_RLE: ok = DecompressRLE(in, size, target, n); break;
+			case COMPRESSION_LZ: ok = DecompressLZ(in, size, target, n); break;
+			default: break;
+			}
+
+			if (ok && header.shuffleElementSize > 1) Unshuffle(target, out, n, header.shuffleElementSize);
+			return ok;
+		});
+	}
+}
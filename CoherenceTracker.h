@@ -0,0 +1,161 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#ifndef MEMORY_DEVICE_TYPE
+#define MEMORY_DEVICE_TYPE
+enum MemoryDeviceType { MEMORYDEVICE_CPU, MEMORYDEVICE_CUDA };
+#endif
+
+namespace ORUtils
+{
+	/** \brief
+	Process-wide counters of the data moved between host and device copies
+	of memory blocks, and of the data that coherence tracking avoided moving.
+	*/
+	class MemoryTransferCounters
+	{
+	public:
+		std::atomic<size_t> hostToDeviceBytes, deviceToHostBytes, deviceToDeviceBytes;
+		std::atomic<size_t> avoidedBytes;
+		std::atomic<size_t> transfers, skippedTransfers;
+
+		static MemoryTransferCounters& Instance()
+		{
+			static MemoryTransferCounters *instance = new MemoryTransferCounters();
+			return *instance;
+		}
+
+		void Reset()
+		{
+			hostToDeviceBytes = 0; deviceToHostBytes = 0; deviceToDeviceBytes = 0;
+			avoidedBytes = 0;
+			transfers = 0; skippedTransfers = 0;
+		}
+
+		size_t MovedBytes() const { return hostToDeviceBytes + deviceToHostBytes + deviceToDeviceBytes; }
+
+	private:
+		MemoryTransferCounters() { Reset(); }
+	};
+
+	/** \brief
+	Remembers which copy of a memory block, host or device, was written
+	last, and optionally which pages of it, so that synchronisation can be
+	skipped or limited to the modified ranges.
+	*/
+	class CoherenceTracker
+	{
+	public:
+		enum State { STATE_COHERENT, STATE_HOST_MODIFIED, STATE_DEVICE_MODIFIED };
+
+		/** A byte range [first, second) that has to be transferred. */
+		typedef std::pair<size_t, size_t> Range;
+
+	private:
+		bool enabled;
+		State state;
+		size_t pageBytes;
+		bool wholeBlockDirty;
+		std::vector<unsigned char> dirtyPages;
+
+		static State ModifiedState(MemoryDeviceType memoryType)
+		{
+			return memoryType == MEMORYDEVICE_CPU ? STATE_HOST_MODIFIED : STATE_DEVICE_MODIFIED;
+		}
+
+	public:
+		CoherenceTracker() : enabled(false), state(STATE_COHERENT), pageBytes(0), wholeBlockDirty(false) {}
+
+		/** Turn tracking on or off. With @p pageBytes > 0, modifications are
+		additionally recorded per page of that many bytes, so that partial
+		modifications lead to partial transfers. Enabling tracking assumes
+		both copies are currently in sync.
+		*/
+		void SetEnabled(bool enabled, size_t pageBytes = 0)
+		{
+			this->enabled = enabled;
+			this->pageBytes = pageBytes;
+			MarkCoherent();
+		}
+
+		bool IsEnabled() const { return enabled; }
+		State GetState() const { return state; }
+
+		/** Record that the whole copy on @p memoryType was written. */
+		void MarkModified(MemoryDeviceType memoryType)
+		{
+			state = ModifiedState(memoryType);
+			wholeBlockDirty = true;
+			dirtyPages.clear();
+		}
+
+		/** Record that bytes [@p begin, @p end) of the copy on @p memoryType
+		were written. If the other copy had unsynchronised changes, they are
+		superseded.
+		*/
+		void MarkModified(MemoryDeviceType memoryType, size_t begin, size_t end, size_t totalBytes)
+		{
+			if (pageBytes == 0 || state != ModifiedState(memoryType))
+			{
+				if (pageBytes == 0 || state != STATE_COHERENT) { MarkModified(memoryType); return; }
+				state = ModifiedState(memoryType);
+			}
+			if (wholeBlockDirty || begin >= end) return;
+
+			dirtyPages.resize((totalBytes + pageBytes - 1) / pageBytes, 0);
+			size_t lastPage = (end - 1) / pageBytes;
+			for (size_t page = begin / pageBytes; page <= lastPage && page < dirtyPages.size(); ++page) dirtyPages[page] = 1;
+		}
+
+		/** Record that both copies hold the same data. */
+		void MarkCoherent()
+		{
+			state = STATE_COHERENT;
+			wholeBlockDirty = false;
+			dirtyPages.clear();
+		}
+
+		/** Get the byte ranges that have to be copied from @p source to bring
+		the other copy up to date. Returns false if no copy is necessary.
+		*/
+		bool GetTransferRanges(MemoryDeviceType source, size_t totalBytes, std::vector<Range>& ranges) const
+		{
+			ranges.clear();
+			if (state != ModifiedState(source)) return false;
+
+			if (wholeBlockDirty || dirtyPages.empty())
+			{
+				ranges.push_back(Range(0, totalBytes));
+				return true;
+			}
+
+			for (size_t page = 0; page < dirtyPages.size(); ++page)
+			{
+				if (!dirtyPages[page]) continue;
+
+				size_t begin = page * pageBytes, end = begin + pageBytes;
+				if (begin >= totalBytes) break;
+				if (end > totalBytes) end = totalBytes;
+
+				if (!ranges.empty() && ranges.back().second == begin) ranges.back().second = end;
+				else ranges.push_back(Range(begin, end));
+			}
+			return true;
+		}
+
+		void Swap(CoherenceTracker& other)
+		{
+			std::swap(enabled, other.enabled);
+			std::swap(state, other.state);
+			std::swap(pageBytes, other.pageBytes);
+			std::swap(wholeBlockDirty, other.wholeBlockDirty);
+			dirtyPages.swap(other.dirtyPages);
+		}
+	};
+}
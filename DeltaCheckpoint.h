@@ -0,0 +1,589 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "MemoryBlock.h"
+#include "MemoryBlockFormat.h"
+
+namespace ORUtils
+{
+
+/**
+ * \brief The header at the start of a delta checkpoint file.
+ *
+ * It is followed by the name of the parent checkpoint (empty for a base checkpoint), the 64-bit indices of the chunks
+ * stored in the file, and the payload, which holds the contents of those chunks in order and may be compressed.
+ */
+struct DeltaCheckpointHeader
+{
+  /** "ORMD". */
+  char magic[4];
+
+  /** The format version. */
+  uint16_t version;
+
+  /** The size of this header in bytes. */
+  uint16_t headerSize;
+
+  /** The number of elements in the block. */
+  uint64_t elementCount;
+
+  /** The size of an element in bytes. */
+  uint32_t elementSize;
+
+  /** The element type, as given by MemoryBlockTypeTag. */
+  uint32_t typeTag;
+
+  /** The size of a chunk in bytes. The last chunk of the block may be shorter. */
+  uint64_t chunkBytes;
+
+  /** The number of chunks stored in this file. */
+  uint64_t storedChunks;
+
+  /** The number of checkpoints between this one and its base, 0 for a base checkpoint. */
+  uint32_t depth;
+
+  /** The length of the parent's file name. */
+  uint32_t parentNameLength;
+
+  /** A combination of the MEMORYBLOCK_FLAG_* values describing the payload. */
+  uint32_t flags;
+
+  /** Reserved for future use, zero. */
+  uint32_t reserved;
+
+  /** The number of bytes in the payload. */
+  uint64_t payloadBytes;
+
+  /** FastHash64 of the payload, if MEMORYBLOCK_FLAG_CHECKSUM is set. */
+  uint64_t checksum;
+};
+
+/**
+ * \brief Options controlling how delta checkpoints are written.
+ */
+struct DeltaCheckpointOptions
+{
+  /** The size of the chunks that are compared between checkpoints, in bytes. */
+  size_t chunkBytes;
+
+  /** The maximum number of deltas on top of a base checkpoint before a new base is written, or 0 for no limit. Loading a
+      checkpoint reads every file back to its base, so an unlimited chain makes loads ever slower. */
+  size_t maxDepth;
+
+  /** Whether to store a checksum of each file's payload. */
+  bool checksum;
+
+  /** How to compress each file's payload. */
+  CompressionOptions compression;
+
+  DeltaCheckpointOptions()
+  : chunkBytes(64 * 1024), maxDepth(16), checksum(true)
+  {}
+};
+
+/**
+ * \brief Statistics describing a checkpoint written by DeltaCheckpointWriter.
+ */
+struct DeltaCheckpointStatistics
+{
+  /** Whether the checkpoint is a base checkpoint containing the whole block. */
+  bool isBase;
+
+  /** The number of chunks in the block. */
+  size_t totalChunks;
+
+  /** The number of chunks written to the checkpoint. */
+  size_t storedChunks;
+
+  /** The size of the checkpoint file in bytes. */
+  uint64_t fileBytes;
+};
+
+/**
+ * \brief This class writes a sequence of checkpoints of a memory block, storing only the chunks that changed.
+ *
+ * The first checkpoint is a base checkpoint that contains the whole block. Each subsequent one is a delta that records
+ * the name of the previous checkpoint and contains only the chunks whose hash changed since then. Any checkpoint can
+ * be loaded with DeltaCheckpointReader, which follows the chain back to the base, so the files must stay where they
+ * were written.
+ *
+ * A new base is written whenever the block's size or type changes, the maximum depth is reached, the checkpoint
+ * overwrites a file in the current chain, or Reset is called. Overwriting a file does invalidate any earlier
+ * checkpoints that were deltas on top of it, so with alternating files only the newest one can be loaded.
+ */
+class DeltaCheckpointWriter
+{
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** The depth of the previous checkpoint. */
+  uint32_t m_depth;
+
+  /** The number of elements in the block at the previous checkpoint. */
+  uint64_t m_elementCount;
+
+  /** The size of an element at the previous checkpoint. */
+  uint32_t m_elementSize;
+
+  /** The hashes of the chunks at the previous checkpoint. */
+  std::vector<uint64_t> m_hashes;
+
+  /** The options. */
+  DeltaCheckpointOptions m_options;
+
+  /** The names of the checkpoints in the chain of the previous checkpoint, which the next one must not overwrite. */
+  std::set<std::string> m_chain;
+
+  /** The name of the previous checkpoint, or empty if the next checkpoint must be a base. */
+  std::string m_previousFilename;
+
+  /** The element type tag at the previous checkpoint. */
+  uint32_t m_typeTag;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Constructs a writer whose first checkpoint will be a base checkpoint.
+   *
+   * \param options The chunk size, maximum chain depth, checksum and compression options.
+   */
+  explicit DeltaCheckpointWriter(const DeltaCheckpointOptions& options = DeltaCheckpointOptions())
+  : m_depth(0), m_elementCount(0), m_elementSize(0), m_options(options), m_typeTag(0)
+  {
+    if(m_options.chunkBytes == 0) m_options.chunkBytes = 1;
+  }
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Makes the next checkpoint a base checkpoint.
+   */
+  void Reset()
+  {
+    m_chain.clear();
+    m_previousFilename.clear();
+    m_hashes.clear();
+  }
+
+  /**
+   * \brief Writes a checkpoint of a memory block.
+   *
+   * \param filename            The name of the checkpoint file. If it is in the current chain, a base is written.
+   * \param block               The memory block.
+   * \param memoryDeviceType    The type of memory device from which to save the data.
+   * \return                    Statistics describing the checkpoint.
+   * \throws std::runtime_error If the write is unsuccessful. The next checkpoint will then be a base checkpoint.
+   */
+  template <typename T>
+  DeltaCheckpointStatistics SaveCheckpoint(const std::string& filename, const ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType)
+  {
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we are saving the memory block from the GPU, first make a CPU copy of it.
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      cpuBlock.SetFrom(&block, ORUtils::MemoryBlock<T>::CUDA_TO_CPU);
+      return SaveCheckpoint(filename, cpuBlock.GetData(MEMORYDEVICE_CPU), cpuBlock.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value());
+    }
+    else
+    {
+      return SaveCheckpoint(filename, block.GetData(MEMORYDEVICE_CPU), block.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value());
+    }
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Writes a checkpoint of a block given as raw elements.
+   */
+  DeltaCheckpointStatistics SaveCheckpoint(const std::string& filename, const void *data, uint64_t elementCount, uint32_t elementSize, uint32_t typeTag)
+  {
+    const char *bytes = reinterpret_cast<const char *>(data);
+    size_t totalBytes = (size_t)(elementCount * elementSize);
+    size_t chunkBytes = m_options.chunkBytes;
+    size_t chunkCount = (totalBytes + chunkBytes - 1) / chunkBytes;
+
+    std::vector<uint64_t> hashes(chunkCount);
+    for(size_t i = 0; i < chunkCount; ++i)
+    {
+      size_t offset = i * chunkBytes;
+      hashes[i] = FastHash64(bytes + offset, std::min(chunkBytes, totalBytes - offset));
+    }
+
+    // A checkpoint that overwrites one of its own ancestors would destroy its chain, so it has to be a base.
+    bool isBase = m_previousFilename.empty() || m_chain.find(filename) != m_chain.end() ||
+                  elementCount != m_elementCount || elementSize != m_elementSize || typeTag != m_typeTag ||
+                  (m_options.maxDepth > 0 && m_depth >= m_options.maxDepth);
+
+    // Gather the chunks that have to be stored.
+    std::vector<uint64_t> stored;
+    std::vector<char> payload;
+    for(size_t i = 0; i < chunkCount; ++i)
+    {
+      if(!isBase && hashes[i] == m_hashes[i]) continue;
+
+      size_t offset = i * chunkBytes;
+      stored.push_back(i);
+      payload.insert(payload.end(), bytes + offset, bytes + offset + std::min(chunkBytes, totalBytes - offset));
+    }
+
+    DeltaCheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ORMD", 4);
+    header.version = 1;
+    header.headerSize = sizeof(DeltaCheckpointHeader);
+    header.elementCount = elementCount;
+    header.elementSize = elementSize;
+    header.typeTag = typeTag;
+    header.chunkBytes = chunkBytes;
+    header.storedChunks = stored.size();
+    header.depth = isBase ? 0 : m_depth + 1;
+
+    std::string parentName = isBase ? std::string() : m_previousFilename;
+    header.parentNameLength = (uint32_t)parentName.size();
+
+    std::vector<char> compressed;
+    const char *payloadData = payload.empty() ? NULL : &payload[0];
+    header.payloadBytes = payload.size();
+    if(m_options.compression.codec != COMPRESSION_NONE)
+    {
+      CompressBlock(payloadData, payload.size(), elementSize, m_options.compression, compressed);
+      payloadData = &compressed[0];
+      header.payloadBytes = compressed.size();
+      header.flags |= MEMORYBLOCK_FLAG_COMPRESSED;
+    }
+
+    if(m_options.checksum)
+    {
+      header.flags |= MEMORYBLOCK_FLAG_CHECKSUM;
+      header.checksum = FastHash64(payloadData, (size_t)header.payloadBytes);
+    }
+
+    // Until the file has been written successfully, the next checkpoint has to be a base.
+    std::set<std::string> chain;
+    if(!isBase) chain.swap(m_chain);
+    Reset();
+
+    std::ofstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for writing");
+
+    fs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    fs.write(parentName.data(), parentName.size());
+    if(!stored.empty()) fs.write(reinterpret_cast<const char *>(&stored[0]), stored.size() * sizeof(uint64_t));
+    if(header.payloadBytes > 0) fs.write(payloadData, header.payloadBytes);
+    fs.close();
+    if(!fs) throw std::runtime_error("Could not write checkpoint " + filename);
+
+    m_depth = header.depth;
+    m_elementCount = elementCount;
+    m_elementSize = elementSize;
+    m_hashes.swap(hashes);
+    chain.insert(filename);
+    m_chain.swap(chain);
+    m_previousFilename = filename;
+    m_typeTag = typeTag;
+
+    DeltaCheckpointStatistics statistics;
+    statistics.isBase = isBase;
+    statistics.totalChunks = chunkCount;
+    statistics.storedChunks = stored.size();
+    statistics.fileBytes = sizeof(header) + parentName.size() + stored.size() * sizeof(uint64_t) + header.payloadBytes;
+    return statistics;
+  }
+};
+
+/**
+ * \brief This class reconstructs memory blocks from checkpoints written by DeltaCheckpointWriter.
+ */
+class DeltaCheckpointReader
+{
+  //#################### NESTED TYPES ####################
+private:
+  /**
+   * \brief The contents of a checkpoint file.
+   */
+  struct Checkpoint
+  {
+    /** The checkpoint's header. */
+    DeltaCheckpointHeader header;
+
+    /** The name of the parent checkpoint. */
+    std::string parentName;
+
+    /** The indices of the stored chunks. */
+    std::vector<uint64_t> chunkIndices;
+
+    /** The stored chunks, decompressed. */
+    std::vector<char> chunks;
+  };
+
+  //#################### PUBLIC STATIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Gets the names of the checkpoint files needed to reconstruct a checkpoint.
+   *
+   * \param filename            The name of the checkpoint file.
+   * \return                    The names of the files, starting with the specified one and ending with its base.
+   * \throws std::runtime_error If a file in the chain cannot be read or the chain is corrupt.
+   */
+  static std::vector<std::string> GetChain(const std::string& filename)
+  {
+    std::vector<std::string> chain(1, filename);
+    Checkpoint checkpoint;
+    ReadCheckpoint(filename, checkpoint, false);
+
+    std::set<std::string> visited;
+    visited.insert(filename);
+    while(!checkpoint.parentName.empty())
+    {
+      std::string name = checkpoint.parentName;
+      ReadParent(filename, visited, name, checkpoint, false);
+      chain.push_back(name);
+    }
+    return chain;
+  }
+
+  /**
+   * \brief Reconstructs a checkpoint into a memory block newly-allocated on the CPU with the appropriate size.
+   *
+   * \param filename            The name of the checkpoint file.
+   * \param dummy               An optional dummy parameter that can be used for type inference.
+   * \return                    The reconstructed memory block.
+   * \throws std::runtime_error If a file in the chain cannot be read, is corrupt or contains elements of a different type.
+   */
+  template <typename T>
+  static ORUtils::MemoryBlock<T> *LoadMemoryBlock(const std::string& filename, ORUtils::MemoryBlock<T> *dummy = NULL)
+  {
+    Checkpoint newest;
+    ReadCheckpoint(filename, newest, true);
+    CheckElementType<T>(newest.header, filename);
+
+    ORUtils::MemoryBlock<T> *block = new ORUtils::MemoryBlock<T>((size_t)newest.header.elementCount, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+    try
+    {
+      Reconstruct(filename, newest, block->GetData(MEMORYDEVICE_CPU));
+    }
+    catch(...)
+    {
+      delete block;
+      throw;
+    }
+    return block;
+  }
+
+  /**
+   * \brief Reconstructs a checkpoint into an existing memory block of the same size.
+   *
+   * \param filename            The name of the checkpoint file.
+   * \param block               The memory block into which to load the data.
+   * \param memoryDeviceType    The type of memory device on which to load the data.
+   * \throws std::runtime_error If a file in the chain cannot be read, is corrupt or does not match the block.
+   */
+  template <typename T>
+  static void LoadMemoryBlock(const std::string& filename, ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType)
+  {
+    Checkpoint newest;
+    ReadCheckpoint(filename, newest, true);
+    CheckElementType<T>(newest.header, filename);
+    if(block.dataSize != newest.header.elementCount)
+    {
+      throw std::runtime_error("Could not read data into a memory block of the wrong size");
+    }
+
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we're loading into a block on the GPU, first reconstruct the data in a temporary block on the CPU.
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      Reconstruct(filename, newest, cpuBlock.GetData(MEMORYDEVICE_CPU));
+      block.SetFrom(&cpuBlock, ORUtils::MemoryBlock<T>::CPU_TO_CUDA);
+    }
+    else
+    {
+      Reconstruct(filename, newest, block.GetData(MEMORYDEVICE_CPU));
+    }
+  }
+
+  //#################### PRIVATE STATIC MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Checks that a checkpoint contains elements of type T.
+   */
+  template <typename T>
+  static void CheckElementType(const DeltaCheckpointHeader& header, const std::string& filename)
+  {
+    MemoryBlockFileInfo info;
+    memset(&info, 0, sizeof(info));
+    info.version = header.version;
+    info.elementCount = header.elementCount;
+    info.elementSize = header.elementSize;
+    info.typeTag = header.typeTag;
+    info.payloadBytes = header.elementCount * header.elementSize;
+    CheckMemoryBlockElementType<T>(info, filename);
+  }
+
+  /**
+   * \brief Reads a checkpoint file.
+   *
+   * \param filename            The name of the file.
+   * \param checkpoint          The checkpoint into which to read the file.
+   * \param readChunks          Whether to read the chunks, or only the header and the parent's name.
+   * \throws std::runtime_error If the file cannot be read or is corrupt.
+   */
+  static void ReadCheckpoint(const std::string& filename, Checkpoint& checkpoint, bool readChunks)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+
+    DeltaCheckpointHeader& header = checkpoint.header;
+    if(!fs.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, "ORMD", 4) != 0)
+    {
+      throw std::runtime_error(filename + " is not a delta checkpoint");
+    }
+    if(header.version != 1) throw std::runtime_error(filename + " has an unsupported checkpoint version");
+
+    uint64_t chunkCount = header.chunkBytes == 0 ? 0 : (header.elementCount * header.elementSize + header.chunkBytes - 1) / header.chunkBytes;
+    if(header.chunkBytes == 0 || header.storedChunks > chunkCount || (header.depth == 0 && header.storedChunks != chunkCount))
+    {
+      throw std::runtime_error(filename + " is corrupt");
+    }
+
+    checkpoint.parentName.resize(header.parentNameLength);
+    if(header.parentNameLength > 0 && !fs.read(&checkpoint.parentName[0], header.parentNameLength))
+    {
+      throw std::runtime_error("Could not read checkpoint " + filename);
+    }
+    if(!readChunks) return;
+
+    checkpoint.chunkIndices.resize((size_t)header.storedChunks);
+    if(header.storedChunks > 0 && !fs.read(reinterpret_cast<char*>(&checkpoint.chunkIndices[0]), header.storedChunks * sizeof(uint64_t)))
+    {
+      throw std::runtime_error("Could not read checkpoint " + filename);
+    }
+
+    // Work out how many bytes the stored chunks occupy; only the last chunk of the block can be short.
+    uint64_t totalBytes = header.elementCount * header.elementSize, chunksBytes = 0;
+    for(size_t i = 0; i < checkpoint.chunkIndices.size(); ++i)
+    {
+      uint64_t index = checkpoint.chunkIndices[i];
+      if(index >= chunkCount) throw std::runtime_error(filename + " is corrupt");
+      chunksBytes += std::min(header.chunkBytes, totalBytes - index * header.chunkBytes);
+    }
+
+    std::vector<char> payload((size_t)header.payloadBytes);
+    if(!payload.empty() && !fs.read(&payload[0], payload.size())) throw std::runtime_error("Could not read checkpoint " + filename);
+
+    MemoryBlockFileInfo info;
+    memset(&info, 0, sizeof(info));
+    info.flags = header.flags;
+    info.payloadBytes = header.payloadBytes;
+    info.checksum = header.checksum;
+
+    if(info.IsCompressed())
+    {
+      checkpoint.chunks.resize((size_t)chunksBytes);
+      UnpackMemoryBlockPayload(payload.empty() ? NULL : &payload[0], info, checkpoint.chunks.empty() ? NULL : &checkpoint.chunks[0], checkpoint.chunks.size(), filename);
+    }
+    else
+    {
+      if(payload.size() != chunksBytes) throw std::runtime_error(filename + " is corrupt");
+      UnpackMemoryBlockPayload(payload.empty() ? NULL : &payload[0], info, payload.empty() ? NULL : &payload[0], payload.size(), filename);
+      checkpoint.chunks.swap(payload);
+    }
+  }
+
+  /**
+   * \brief Replaces a checkpoint in a chain with its parent.
+   *
+   * Each parent must be one level shallower than its child and must not already have been visited, so that a corrupt
+   * or self-referencing chain is rejected rather than followed forever.
+   *
+   * \param filename            The name of the checkpoint at the start of the chain.
+   * \param visited             The names of the checkpoints already visited.
+   * \param parentName          The name of the parent checkpoint.
+   * \param checkpoint          The child checkpoint, which is replaced with its parent.
+   * \param readChunks          Whether to read the parent's chunks, or only its header and its parent's name.
+   * \throws std::runtime_error If the parent cannot be read or does not follow on from its child.
+   */
+  static void ReadParent(const std::string& filename, std::set<std::string>& visited, const std::string& parentName, Checkpoint& checkpoint, bool readChunks)
+  {
+    uint32_t childDepth = checkpoint.header.depth;
+    if(childDepth == 0 || !visited.insert(parentName).second)
+    {
+      throw std::runtime_error("The checkpoint chain of " + filename + " is corrupt");
+    }
+
+    ReadCheckpoint(parentName, checkpoint, readChunks);
+    if(checkpoint.header.depth != childDepth - 1)
+    {
+      throw std::runtime_error("The checkpoint chain of " + filename + " is corrupt");
+    }
+  }
+
+  /**
+   * \brief Reconstructs a checkpoint, applying its chunks and those of its ancestors that it does not override.
+   *
+   * The chain is walked from the newest checkpoint back to the base, so each chunk is copied only once.
+   *
+   * \param filename            The name of the newest checkpoint.
+   * \param newest              The newest checkpoint, which has already been read.
+   * \param data                The buffer into which to reconstruct the block.
+   */
+  static void Reconstruct(const std::string& filename, Checkpoint& newest, void *data)
+  {
+    const DeltaCheckpointHeader& target = newest.header;
+    uint64_t totalBytes = target.elementCount * target.elementSize;
+    uint64_t chunkCount = (totalBytes + target.chunkBytes - 1) / target.chunkBytes;
+
+    std::vector<bool> filled((size_t)chunkCount, false);
+    uint64_t remaining = chunkCount;
+
+    Checkpoint current;
+    current.header = newest.header;
+    current.parentName.swap(newest.parentName);
+    current.chunkIndices.swap(newest.chunkIndices);
+    current.chunks.swap(newest.chunks);
+    std::string currentName = filename;
+    std::set<std::string> visited;
+    visited.insert(filename);
+
+    for(;;)
+    {
+      const DeltaCheckpointHeader& header = current.header;
+      if(header.elementCount != target.elementCount || header.elementSize != target.elementSize || header.chunkBytes != target.chunkBytes)
+      {
+        throw std::runtime_error(currentName + " does not belong to the same sequence as " + filename);
+      }
+
+      uint64_t offset = 0;
+      for(size_t i = 0; i < current.chunkIndices.size(); ++i)
+      {
+        uint64_t index = current.chunkIndices[i];
+        uint64_t begin = index * header.chunkBytes;
+        uint64_t bytes = std::min(header.chunkBytes, totalBytes - begin);
+        if(!filled[(size_t)index])
+        {
+          memcpy(reinterpret_cast<char*>(data) + begin, &current.chunks[(size_t)offset], (size_t)bytes);
+          filled[(size_t)index] = true;
+          --remaining;
+        }
+        offset += bytes;
+      }
+
+      if(remaining == 0) return;
+      if(header.depth == 0 || current.parentName.empty())
+      {
+        throw std::runtime_error("The checkpoint chain of " + filename + " is incomplete");
+      }
+
+      currentName = current.parentName;
+      ReadParent(filename, visited, currentName, current, true);
+    }
+  }
+};
+
+}
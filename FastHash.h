@@ -0,0 +1,95 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+namespace ORUtils
+{
+	namespace FastHashDetail
+	{
+		const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+		const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+		const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+		const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+		const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+		inline uint64_t RotateLeft(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+		inline uint64_t Read64(const unsigned char *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+		inline uint32_t Read32(const unsigned char *p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+		inline uint64_t Round(uint64_t acc, uint64_t input)
+		{
+			acc += input * PRIME2;
+			acc = RotateLeft(acc, 31);
+			return acc * PRIME1;
+		}
+
+		inline uint64_t MergeRound(uint64_t acc, uint64_t val)
+		{
+			acc ^= Round(0, val);
+			return acc * PRIME1 + PRIME4;
+		}
+	}
+
+	/** \brief
+	64-bit non-cryptographic hash of @p bytes at @p data (the XXH64
+	algorithm). It runs at several GB/s, so it can be used to checksum or
+	fingerprint large blocks. Values are only comparable between machines
+	of the same endianness.
+	*/
+	inline uint64_t FastHash64(const void *data, size_t bytes, uint64_t seed = 0)
+	{
+		using namespace FastHashDetail;
+
+		const unsigned char *p = (const unsigned char*)data;
+		const unsigned char *end = p + bytes;
+		uint64_t h;
+
+		if (bytes >= 32)
+		{
+			uint64_t v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+
+			const unsigned char *limit = end - 32;
+			do
+			{
+				v1 = Round(v1, Read64(p)); v2 = Round(v2, Read64(p + 8));
+				v3 = Round(v3, Read64(p + 16)); v4 = Round(v4, Read64(p + 24));
+				p += 32;
+			} while (p <= limit);
+
+			h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+			h = MergeRound(h, v1); h = MergeRound(h, v2);
+			h = MergeRound(h, v3); h = MergeRound(h, v4);
+		}
+		else h = seed + PRIME5;
+
+		h += (uint64_t)bytes;
+
+		for (; p + 8 <= end; p += 8)
+		{
+			h ^= Round(0, Read64(p));
+			h = RotateLeft(h, 27) * PRIME1 + PRIME4;
+		}
+
+		if (p + 4 <= end)
+		{
+			h ^= (uint64_t)Read32(p) * PRIME1;
+			h = RotateLeft(h, 23) * PRIME2 + PRIME3;
+			p += 4;
+		}
+
+		for (; p < end; ++p)
+		{
+			h ^= (*p) * PRIME5;
+			h = RotateLeft(h, 11) * PRIME1;
+		}
+
+		h ^= h >> 33; h *= PRIME2;
+		h ^= h >> 29; h *= PRIME3;
+		h ^= h >> 32;
+		return h;
+	}
+}
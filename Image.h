@@ -22,27 +22,31 @@ namespace ORUtils
 		/** Initialize an empty image of the given size, either
 		on CPU only or on both CPU and GPU.
 		*/
-		Image(Vector2<int> noDims, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true)
-			: MemoryBlock<T>(noDims.x * noDims.y, allocate_CPU, allocate_CUDA, metalCompatible)
+		Image(Vector2<int> noDims, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>(noDims.x * noDims.y, allocate_CPU, allocate_CUDA, metalCompatible, policy)
 		{
 			this->noDims = noDims;
 		}
 
-		Image(bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true)
-			: MemoryBlock<T>(0, allocate_CPU, allocate_CUDA, metalCompatible)
+		Image(bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>(0, allocate_CPU, allocate_CUDA, metalCompatible, policy)
 		{
 			this->noDims = Vector2<int>(0, 0);
 		}
 
-		Image(Vector2<int> noDims, MemoryDeviceType memoryType)
-			: MemoryBlock<T>(noDims.x * noDims.y, memoryType)
+		Image(Vector2<int> noDims, MemoryDeviceType memoryType, const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>(noDims.x * noDims.y, memoryType, policy)
 		{
 			this->noDims = noDims;
 		}
 
 		/** Resize an image, loosing all old image data.
-		Essentially any previously allocated data is
-		released, new memory is allocated.
+		If the new size fits in the current capacity the
+		memory is reused, otherwise it is reallocated. The
+		data is undefined afterwards, unless the allocation
+		policy is INITIALISE_ZEROED.
 		*/
 		void ChangeDims(Vector2<int> newDims)
 		{
@@ -50,18 +54,49 @@ namespace ORUtils
 			{
 				this->noDims = newDims;
 
-				bool allocate_CPU = this->isAllocated_CPU;
-				bool allocate_CUDA = this->isAllocated_CUDA;
-				bool metalCompatible = this->isMetalCompatible;
+				this->Resize((size_t)newDims.x * newDims.y);
+				this->InitialiseResizedData();
+			}
+		}
+
+		/** Preallocate memory for images up to @p maxDims in size,
+		so that later calls to ChangeDims do not reallocate.
+		*/
+		void Reserve(Vector2<int> maxDims)
+		{
+			MemoryBlock<T>::Reserve((size_t)maxDims.x * maxDims.y);
+		}
+
+		/** Take over the data and dimensions of @p other, leaving it empty. */
+		Image(Image&& other) noexcept
+			: MemoryBlock<T>(std::move(other))
+		{
+			this->noDims = other.noDims;
+			other.noDims = Vector2<int>(0, 0);
+		}
 
-				this->Free();
-				this->Allocate(newDims.x * newDims.y, allocate_CPU, allocate_CUDA, metalCompatible);
+		/** Release the current data and take over the data and dimensions of @p other. */
+		Image& operator=(Image&& other) noexcept
+		{
+			if (this != &other)
+			{
+				MemoryBlock<T>::operator=(std::move(other));
+				this->noDims = other.noDims;
+				other.noDims = Vector2<int>(0, 0);
 			}
+			return *this;
+		}
+
+		/** Exchange the contents and dimensions of two images without copying data. */
+		void Swap(Image& other) noexcept
+		{
+			MemoryBlock<T>::Swap(other);
+			std::swap(this->noDims, other.noDims);
 		}
 
 		// Suppress the default copy constructor and assignment operator
-		Image(const Image&);
-		Image& operator=(const Image&);
+		Image(const Image&) = delete;
+		Image& operator=(const Image&) = delete;
 	};
 }
 
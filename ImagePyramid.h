@@ -0,0 +1,349 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <vector>
+
+#include "ImageView.h"
+#include "ParallelMemory.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** How each pyramid level is computed from the one below it. */
+	enum ImagePyramidFilter
+	{
+		/** Average of each 2x2 block. */
+		PYRAMIDFILTER_AVERAGE,
+		/** Average of the valid pixels in each 2x2 block, or an invalid pixel
+		if there are none. Depths are valid if positive, points if their w
+		component is positive. Other pixel types are always valid.
+		*/
+		PYRAMIDFILTER_AVERAGE_VALID,
+		/** Top-left pixel of each 2x2 block. */
+		PYRAMIDFILTER_SUBSAMPLE
+	};
+
+	namespace ImagePyramidDetail
+	{
+		/** Row kernels that compute @p n output pixels from two input rows
+		@p r0 and @p r1 of at least 2 * @p n pixels. The generic versions
+		work for any pixel type with addition and division by a scalar.
+		*/
+		template <typename T>
+		struct Kernels
+		{
+			static void Average(const T *r0, const T *r1, T *out, int n)
+			{
+				for (int i = 0; i < n; ++i) out[i] = ((r0[2 * i] + r1[2 * i]) + (r0[2 * i + 1] + r1[2 * i + 1])) / 4;
+			}
+
+			static void AverageValid(const T *r0, const T *r1, T *out, int n)
+			{
+				Average(r0, r1, out, n);
+			}
+		};
+
+		template <>
+		struct Kernels<float>
+		{
+			static void Average(const float *r0, const float *r1, float *out, int n)
+			{
+				int i = 0;
+#ifdef ORUTILS_HAS_SSE2
+				const __m128 quarter = _mm_set1_ps(0.25f);
+				for (; i + 4 <= n; i += 4)
+				{
+					__m128 s0 = _mm_add_ps(_mm_loadu_ps(r0 + 2 * i), _mm_loadu_ps(r1 + 2 * i));
+					__m128 s1 = _mm_add_ps(_mm_loadu_ps(r0 + 2 * i + 4), _mm_loadu_ps(r1 + 2 * i + 4));
+					__m128 even = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+					__m128 odd = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+					_mm_storeu_ps(out + i, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+				}
+#endif
+				for (; i < n; ++i) out[i] = ((r0[2 * i] + r1[2 * i]) + (r0[2 * i + 1] + r1[2 * i + 1])) * 0.25f;
+			}
+
+			static void AverageValid(const float *r0, const float *r1, float *out, int n)
+			{
+				int i = 0;
+#ifdef ORUTILS_HAS_SSE2
+				const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), invalid = _mm_set1_ps(-1.0f);
+				for (; i + 4 <= n; i += 4)
+				{
+					__m128 a0 = _mm_loadu_ps(r0 + 2 * i), a1 = _mm_loadu_ps(r0 + 2 * i + 4);
+					__m128 b0 = _mm_loadu_ps(r1 + 2 * i), b1 = _mm_loadu_ps(r1 + 2 * i + 4);
+					__m128 ma0 = _mm_cmpgt_ps(a0, zero), ma1 = _mm_cmpgt_ps(a1, zero);
+					__m128 mb0 = _mm_cmpgt_ps(b0, zero), mb1 = _mm_cmpgt_ps(b1, zero);
+
+					__m128 s0 = _mm_add_ps(_mm_and_ps(a0, ma0), _mm_and_ps(b0, mb0));
+					__m128 s1 = _mm_add_ps(_mm_and_ps(a1, ma1), _mm_and_ps(b1, mb1));
+					__m128 c0 = _mm_add_ps(_mm_and_ps(one, ma0), _mm_and_ps(one, mb0));
+					__m128 c1 = _mm_add_ps(_mm_and_ps(one, ma1), _mm_and_ps(one, mb1));
+
+					__m128 sum = _mm_add_ps(_mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1)));
+					__m128 count = _mm_add_ps(_mm_shuffle_ps(c0, c1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(c0, c1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+					__m128 any = _mm_cmpgt_ps(count, zero);
+					__m128 mean = _mm_div_ps(sum, _mm_max_ps(count, one));
+					_mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(any, mean), _mm_andnot_ps(any, invalid)));
+				}
+#endif
+				for (; i < n; ++i)
+				{
+					float a0 = r0[2 * i], a1 = r0[2 * i + 1], b0 = r1[2 * i], b1 = r1[2 * i + 1];
+					float sum = ((a0 > 0.0f ? a0 : 0.0f) + (b0 > 0.0f ? b0 : 0.0f)) + ((a1 > 0.0f ? a1 : 0.0f) + (b1 > 0.0f ? b1 : 0.0f));
+					float count = (float)((a0 > 0.0f) + (b0 > 0.0f) + (a1 > 0.0f) + (b1 > 0.0f));
+					out[i] = count > 0.0f ? sum / count : -1.0f;
+				}
+			}
+		};
+
+		template <>
+		struct Kernels<Vector4<float> >
+		{
+			static void Average(const Vector4<float> *r0, const Vector4<float> *r1, Vector4<float> *out, int n)
+			{
+#ifdef ORUTILS_HAS_SSE2
+				const __m128 quarter = _mm_set1_ps(0.25f);
+				for (int i = 0; i < n; ++i)
+				{
+					__m128 s0 = _mm_add_ps(_mm_loadu_ps(r0[2 * i].v), _mm_loadu_ps(r1[2 * i].v));
+					__m128 s1 = _mm_add_ps(_mm_loadu_ps(r0[2 * i + 1].v), _mm_loadu_ps(r1[2 * i + 1].v));
+					_mm_storeu_ps(out[i].v, _mm_mul_ps(_mm_add_ps(s0, s1), quarter));
+				}
+#else
+				for (int i = 0; i < n; ++i) out[i] = ((r0[2 * i] + r1[2 * i]) + (r0[2 * i + 1] + r1[2 * i + 1])) * 0.25f;
+#endif
+			}
+
+			static void AverageValid(const Vector4<float> *r0, const Vector4<float> *r1, Vector4<float> *out, int n)
+			{
+#ifdef ORUTILS_HAS_SSE2
+				const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), invalid = _mm_set_ps(-1.0f, 0.0f, 0.0f, 0.0f);
+				for (int i = 0; i < n; ++i)
+				{
+					__m128 a0 = _mm_loadu_ps(r0[2 * i].v), a1 = _mm_loadu_ps(r0[2 * i + 1].v);
+					__m128 b0 = _mm_loadu_ps(r1[2 * i].v), b1 = _mm_loadu_ps(r1[2 * i + 1].v);
+
+					// Broadcast the validity of each point, given by its w component, to all four lanes.
+					__m128 ma0 = _mm_cmpgt_ps(_mm_shuffle_ps(a0, a0, _MM_SHUFFLE(3, 3, 3, 3)), zero);
+					__m128 ma1 = _mm_cmpgt_ps(_mm_shuffle_ps(a1, a1, _MM_SHUFFLE(3, 3, 3, 3)), zero);
+					__m128 mb0 = _mm_cmpgt_ps(_mm_shuffle_ps(b0, b0, _MM_SHUFFLE(3, 3, 3, 3)), zero);
+					__m128 mb1 = _mm_cmpgt_ps(_mm_shuffle_ps(b1, b1, _MM_SHUFFLE(3, 3, 3, 3)), zero);
+
+					__m128 sum = _mm_add_ps(_mm_add_ps(_mm_and_ps(a0, ma0), _mm_and_ps(b0, mb0)), _mm_add_ps(_mm_and_ps(a1, ma1), _mm_and_ps(b1, mb1)));
+					__m128 count = _mm_add_ps(_mm_add_ps(_mm_and_ps(one, ma0), _mm_and_ps(one, mb0)), _mm_add_ps(_mm_and_ps(one, ma1), _mm_and_ps(one, mb1)));
+
+					__m128 any = _mm_cmpgt_ps(count, zero);
+					__m128 mean = _mm_div_ps(sum, _mm_max_ps(count, one));
+					_mm_storeu_ps(out[i].v, _mm_or_ps(_mm_and_ps(any, mean), _mm_andnot_ps(any, invalid)));
+				}
+#else
+				for (int i = 0; i < n; ++i)
+				{
+					const Vector4<float> zero(0.0f);
+					const Vector4<float>& a0 = r0[2 * i], & a1 = r0[2 * i + 1], & b0 = r1[2 * i], & b1 = r1[2 * i + 1];
+					Vector4<float> sum = ((a0.w > 0.0f ? a0 : zero) + (b0.w > 0.0f ? b0 : zero)) + ((a1.w > 0.0f ? a1 : zero) + (b1.w > 0.0f ? b1 : zero));
+					float count = (float)((a0.w > 0.0f) + (b0.w > 0.0f) + (a1.w > 0.0f) + (b1.w > 0.0f));
+					out[i] = count > 0.0f ? sum / count : Vector4<float>(0.0f, 0.0f, 0.0f, -1.0f);
+				}
+#endif
+			}
+		};
+
+		template <>
+		struct Kernels<Vector4<unsigned char> >
+		{
+			/** Rounded average of each channel, (a + b + c + d + 2) / 4. */
+			static void Average(const Vector4<unsigned char> *r0, const Vector4<unsigned char> *r1, Vector4<unsigned char> *out, int n)
+			{
+				int i = 0;
+#ifdef ORUTILS_HAS_SSE2
+				const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+				for (; i + 4 <= n; i += 4)
+				{
+					__m128i r[2];
+					for (int half = 0; half < 2; ++half)
+					{
+						// Four input pixels from each row give two output pixels, summed in 16 bits.
+						__m128i a = _mm_loadu_si128((const __m128i*)(r0 + 2 * i + 4 * half));
+						__m128i b = _mm_loadu_si128((const __m128i*)(r1 + 2 * i + 4 * half));
+						__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+						__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+						lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+						hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+						r[half] = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+					}
+					_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(r[0], r[1]));
+				}
+#endif
+				for (; i < n; ++i)
+				{
+					for (int c = 0; c < 4; ++c)
+					{
+						int sum = r0[2 * i].v[c] + r1[2 * i].v[c] + r0[2 * i + 1].v[c] + r1[2 * i + 1].v[c];
+						out[i].v[c] = (unsigned char)((sum + 2) >> 2);
+					}
+				}
+			}
+
+			static void AverageValid(const Vector4<unsigned char> *r0, const Vector4<unsigned char> *r1, Vector4<unsigned char> *out, int n)
+			{
+				Average(r0, r1, out, n);
+			}
+		};
+
+	}
+
+	/** \brief
+	Image pyramid whose levels are stored one after another in a single
+	CPU memory block.
+
+	Level 0 holds the input at full resolution and each further level is
+	half the size of the one below it, rounded down. The storage is only
+	reallocated when the input grows beyond what was allocated before, so a
+	pyramid can be rebuilt every frame without allocating. The whole
+	pyramid can be transferred to the GPU in one copy via GetStorage().
+	Levels are built with SSE2 kernels for float, Vector4<float> and
+	Vector4<unsigned char> pixels, and large levels are split across threads.
+	*/
+	template <typename T>
+	class ImagePyramid
+	{
+	private:
+		MemoryBlock<T> storage;
+		std::vector<Vector2<int> > levelDims;
+		std::vector<size_t> levelOffsets;
+		int maxLevelCount;
+		unsigned int numThreads;
+
+		/** Round an element offset up so that each level starts on a 64-byte boundary. */
+		static size_t AlignOffset(size_t offset)
+		{
+			const size_t alignment = sizeof(T) < 64 && 64 % sizeof(T) == 0 ? 64 / sizeof(T) : 1;
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		void BuildLevel(int level, ImagePyramidFilter filter)
+		{
+			ImageView<const T> source = GetLevel(level - 1);
+			ImageView<T> target = GetLevel(level);
+			int width = target.noDims.x;
+
+			// Give each thread enough pixels to be worth starting it for.
+			size_t rows = (size_t)target.noDims.y;
+			size_t minRows = width > 0 && width < (1 << 16) ? (1 << 16) / width : 1;
+			ParallelMemoryConfig config;
+			config.numThreads = numThreads;
+			unsigned int threads = ParallelMemoryDetail::NumThreads(config);
+			if (threads > rows / minRows) threads = (unsigned int)(rows / minRows);
+
+			auto buildRows = [&](size_t begin, size_t length)
+			{
+				for (int y = (int)begin; y < (int)(begin + length); ++y)
+				{
+					const T *r0 = source.GetRow(2 * y), *r1 = source.GetRow(2 * y + 1);
+					T *out = target.GetRow(y);
+
+					switch (filter)
+					{
+					case PYRAMIDFILTER_AVERAGE: ImagePyramidDetail::Kernels<T>::Average(r0, r1, out, width); break;
+					case PYRAMIDFILTER_AVERAGE_VALID: ImagePyramidDetail::Kernels<T>::AverageValid(r0, r1, out, width); break;
+					default: for (int x = 0; x < width; ++x) out[x] = r0[2 * x]; break;
+					}
+				}
+			};
+
+			if (threads <= 1) buildRows(0, rows);
+			else ParallelMemoryDetail::RunSliced(rows, threads, buildRows, 1);
+		}
+
+	public:
+		/** Create an empty pyramid with up to @p maxLevelCount levels,
+		including the full-resolution one, built on up to @p numThreads
+		threads (0 for one per hardware thread).
+		*/
+		explicit ImagePyramid(int maxLevelCount, unsigned int numThreads = 0)
+			: storage(0, true, false, false, MemoryAllocationPolicy(64, MemoryAllocationPolicy::PAGES_DEFAULT, MemoryAllocationPolicy::POOLING_DEFAULT,
+				MemoryAllocationPolicy::INITIALISE_NONE).Tagged("ImagePyramid")),
+			  maxLevelCount(maxLevelCount > 0 ? maxLevelCount : 1), numThreads(numThreads)
+		{}
+
+		/** Number of levels, which is fewer than the maximum if the image is too small to halve that often. */
+		inline int GetLevelCount() const { return (int)levelDims.size(); }
+
+		inline Vector2<int> GetLevelDims(int level) const { return levelDims[level]; }
+
+		/** The block holding all the levels, e.g. to copy them to the GPU at once. */
+		inline MemoryBlock<T>& GetStorage() { return storage; }
+		inline const MemoryBlock<T>& GetStorage() const { return storage; }
+
+		/** Offset of the first pixel of @p level in the storage. */
+		inline size_t GetLevelOffset(int level) const { return levelOffsets[level]; }
+
+		/** View of @p level on the CPU. */
+		ImageView<T> GetLevel(int level)
+		{
+			return ImageView<T>(storage.GetData(MEMORYDEVICE_CPU) + levelOffsets[level], levelDims[level], levelDims[level].x, MEMORYDEVICE_CPU);
+		}
+
+		ImageView<const T> GetLevel(int level) const
+		{
+			return ImageView<const T>(storage.GetData(MEMORYDEVICE_CPU) + levelOffsets[level], levelDims[level], levelDims[level].x, MEMORYDEVICE_CPU);
+		}
+
+		/** Lay the levels out for a full-resolution image of size @p dims,
+		reallocating only if the storage is too small. The pixel data is left
+		undefined unless the dimensions are unchanged.
+		*/
+		void ChangeDims(Vector2<int> dims)
+		{
+			if (dims.x < 0 || dims.y < 0) DIEWITHEXCEPTION("Image pyramid dimensions must not be negative");
+			if (!levelDims.empty() && levelDims[0] == dims) return;
+
+			levelDims.clear();
+			levelOffsets.clear();
+
+			size_t total = 0;
+			for (Vector2<int> d = dims; (int)levelDims.size() < maxLevelCount; d /= 2)
+			{
+				levelDims.push_back(d);
+				levelOffsets.push_back(total);
+				total = AlignOffset(total + (size_t)d.x * d.y);
+				if (d.x < 2 || d.y < 2) break;
+			}
+
+			if (total > storage.GetCapacity()) storage.Allocate(total, true, false, false);
+			else storage.Resize(total);
+		}
+
+		/** Rebuild levels 1 and up from level 0, which the caller may have written in place. */
+		void BuildLevels(ImagePyramidFilter filter)
+		{
+			for (int level = 1; level < GetLevelCount(); ++level) BuildLevel(level, filter);
+		}
+
+		/** Copy @p input, which must be on the CPU, into level 0 and rebuild the other levels. */
+		void Update(const ImageView<const T>& input, ImagePyramidFilter filter)
+		{
+			if (input.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Image pyramids can only be built from images on the CPU");
+
+			ChangeDims(input.noDims);
+			CopyImageView(GetLevel(0), input);
+			BuildLevels(filter);
+		}
+
+		void Update(const Image<T>& input, ImagePyramidFilter filter)
+		{
+			Update(ImageView<const T>(input, MEMORYDEVICE_CPU), filter);
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		ImagePyramid(const ImagePyramid&) = delete;
+		ImagePyramid& operator=(const ImagePyramid&) = delete;
+	};
+}
+
+#endif
@@ -0,0 +1,480 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ImageView.h"
+#include "ParallelMemory.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** How an ImageSampler interpolates between pixels. */
+	enum SamplerFilter
+	{
+		/** Linear interpolation of the 2x2 pixels around the sample point. */
+		SAMPLERFILTER_BILINEAR,
+		/** Catmull-Rom interpolation of the 4x4 pixels around the sample point. */
+		SAMPLERFILTER_BICUBIC
+	};
+
+	/** What an ImageSampler reads for pixels outside the image. */
+	enum SamplerBoundary
+	{
+		/** The nearest pixel on the border of the image. */
+		SAMPLERBOUNDARY_CLAMP,
+		/** Zero. */
+		SAMPLERBOUNDARY_ZERO,
+		/** The image repeats. */
+		SAMPLERBOUNDARY_WRAP,
+		/** The image repeats, reflected at each border. */
+		SAMPLERBOUNDARY_MIRROR
+	};
+
+	/** Converts between stored pixels and the type interpolation is done
+	in. Images of unsigned char vectors are sampled as float vectors and
+	rounded back when written, other pixel types are interpolated directly.
+	*/
+	template <typename T>
+	struct SamplerPixelTraits
+	{
+		typedef T Result;
+
+		static inline Result Load(const T& pixel) { return pixel; }
+		static inline T Store(const Result& value) { return value; }
+		static inline Result Zero() { return Result(0.0f); }
+	};
+
+	template <>
+	struct SamplerPixelTraits<Vector4<unsigned char> >
+	{
+		typedef Vector4<float> Result;
+
+		static inline Result Load(const Vector4<unsigned char>& pixel) { return pixel.toFloat(); }
+
+		static inline Vector4<unsigned char> Store(const Result& value)
+		{
+			Vector4<unsigned char> pixel;
+			for (int c = 0; c < 4; ++c) pixel.v[c] = (unsigned char)(CLAMP(value.v[c], 0.0f, 255.0f) + 0.5f);
+			return pixel;
+		}
+
+		static inline Result Zero() { return Result(0.0f); }
+	};
+
+	template <typename T> class ImageSampler;
+
+	namespace ImageSamplerDetail
+	{
+		/** Catmull-Rom weights of the four pixels around a point at
+		fractional offset @p t from the second of them.
+		*/
+		inline void CubicWeights(float t, float w[4])
+		{
+			w[0] = ((-0.5f * t + 1.0f) * t - 0.5f) * t;
+			w[1] = (1.5f * t - 2.5f) * t * t + 1.0f;
+			w[2] = ((-1.5f * t + 2.0f) * t + 0.5f) * t;
+			w[3] = (0.5f * t - 0.5f) * t * t;
+		}
+
+		/** Batch sampling kernels. The generic versions call the scalar
+		sampler for every point; the specialisations below vectorise the
+		points whose footprint lies inside the image and fall back to the
+		scalar sampler near the borders, so both give the same results.
+		*/
+		template <typename T>
+		struct BatchKernels
+		{
+			typedef typename SamplerPixelTraits<T>::Result Result;
+
+			static void Bilinear(const ImageSampler<T>& sampler, const Vector2<float> *points, Result *out, size_t count)
+			{
+				for (size_t i = 0; i < count; ++i) out[i] = sampler.SampleBilinear(points[i]);
+			}
+
+			static void Bicubic(const ImageSampler<T>& sampler, const Vector2<float> *points, Result *out, size_t count)
+			{
+				for (size_t i = 0; i < count; ++i) out[i] = sampler.SampleBicubic(points[i]);
+			}
+		};
+	}
+
+	/** \brief
+	Interpolated lookups into an image on the CPU.
+
+	Pixel centres are at integer coordinates, so (0, 0) is the centre of
+	the top-left pixel. The single-point Sample functions are the scalar
+	reference; the batch versions take an array of points and use SSE2
+	for float, Vector4<float> and Vector4<unsigned char> images. Like
+	ImageView, a sampler does not keep the image alive.
+	*/
+	template <typename T>
+	class ImageSampler
+	{
+	public:
+		typedef typename SamplerPixelTraits<T>::Result Result;
+
+	private:
+		ImageView<const T> image;
+		SamplerBoundary boundary;
+
+		/** Bring a coordinate into the range that the boundary policy
+		treats distinctly, so that it can be converted to int safely.
+		*/
+		inline float ReduceCoordinate(float x, int size) const
+		{
+			if (boundary == SAMPLERBOUNDARY_CLAMP || boundary == SAMPLERBOUNDARY_ZERO)
+			{
+				// Every tap of a point further out than this is outside the image.
+				return fmaxf(fminf(x, (float)size + 1.0f), -2.0f);
+			}
+
+			float period = boundary == SAMPLERBOUNDARY_WRAP ? (float)size : 2.0f * size;
+			float r = x - period * floorf(x / period);
+			return r >= 0.0f && r < period ? r : 0.0f;
+		}
+
+		/** Map a pixel index to one inside the image, or return false if it reads as zero. */
+		inline bool ResolveIndex(int& i, int size) const
+		{
+			if (i >= 0 && i < size) return true;
+
+			switch (boundary)
+			{
+			case SAMPLERBOUNDARY_CLAMP: i = i < 0 ? 0 : size - 1; return true;
+			case SAMPLERBOUNDARY_ZERO: return false;
+			case SAMPLERBOUNDARY_WRAP: i = (i % size + size) % size; return true;
+			default:
+				i = (i % (2 * size) + 2 * size) % (2 * size);
+				if (i >= size) i = 2 * size - 1 - i;
+				return true;
+			}
+		}
+
+		inline Result Fetch(int x, int y) const
+		{
+			if (!ResolveIndex(x, image.noDims.x) || !ResolveIndex(y, image.noDims.y)) return SamplerPixelTraits<T>::Zero();
+			return SamplerPixelTraits<T>::Load(image(x, y));
+		}
+
+	public:
+		/** Sample @p image, which must be on the CPU. */
+		explicit ImageSampler(const ImageView<const T>& image, SamplerBoundary boundary = SAMPLERBOUNDARY_CLAMP)
+			: image(image), boundary(boundary)
+		{
+			if (image.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Images can only be sampled on the CPU");
+		}
+
+		explicit ImageSampler(const Image<T>& image, SamplerBoundary boundary = SAMPLERBOUNDARY_CLAMP)
+			: image(image, MEMORYDEVICE_CPU), boundary(boundary)
+		{}
+
+		inline const ImageView<const T>& GetImage() const { return image; }
+		inline SamplerBoundary GetBoundary() const { return boundary; }
+
+		Result SampleBilinear(Vector2<float> point) const
+		{
+			if (image.noDims.x <= 0 || image.noDims.y <= 0) return SamplerPixelTraits<T>::Zero();
+
+			float x = ReduceCoordinate(point.x, image.noDims.x), y = ReduceCoordinate(point.y, image.noDims.y);
+			float xf = floorf(x), yf = floorf(y);
+			int x0 = (int)xf, y0 = (int)yf;
+			float fx = x - xf, fy = y - yf;
+
+			Result top = Fetch(x0, y0) * (1.0f - fx) + Fetch(x0 + 1, y0) * fx;
+			Result bottom = Fetch(x0, y0 + 1) * (1.0f - fx) + Fetch(x0 + 1, y0 + 1) * fx;
+			return top * (1.0f - fy) + bottom * fy;
+		}
+
+		Result SampleBicubic(Vector2<float> point) const
+		{
+			if (image.noDims.x <= 0 || image.noDims.y <= 0) return SamplerPixelTraits<T>::Zero();
+
+			float x = ReduceCoordinate(point.x, image.noDims.x), y = ReduceCoordinate(point.y, image.noDims.y);
+			float xf = floorf(x), yf = floorf(y);
+			int x0 = (int)xf, y0 = (int)yf;
+
+			float wx[4], wy[4];
+			ImageSamplerDetail::CubicWeights(x - xf, wx);
+			ImageSamplerDetail::CubicWeights(y - yf, wy);
+
+			Result result = SamplerPixelTraits<T>::Zero();
+			for (int j = 0; j < 4; ++j)
+			{
+				int yj = y0 - 1 + j;
+				Result row = Fetch(x0 - 1, yj) * wx[0] + Fetch(x0, yj) * wx[1] + Fetch(x0 + 1, yj) * wx[2] + Fetch(x0 + 2, yj) * wx[3];
+				result = j == 0 ? row * wy[0] : result + row * wy[j];
+			}
+			return result;
+		}
+
+		Result Sample(Vector2<float> point, SamplerFilter filter) const
+		{
+			return filter == SAMPLERFILTER_BICUBIC ? SampleBicubic(point) : SampleBilinear(point);
+		}
+
+		/** Sample the image at @p count points, writing the results to @p out. */
+		void Sample(const Vector2<float> *points, Result *out, size_t count, SamplerFilter filter) const
+		{
+			if (filter == SAMPLERFILTER_BICUBIC) ImageSamplerDetail::BatchKernels<T>::Bicubic(*this, points, out, count);
+			else ImageSamplerDetail::BatchKernels<T>::Bilinear(*this, points, out, count);
+		}
+
+		void Sample(const std::vector<Vector2<float> >& points, std::vector<Result>& out, SamplerFilter filter) const
+		{
+			out.resize(points.size());
+			if (!points.empty()) Sample(&points[0], &out[0], points.size(), filter);
+		}
+	};
+
+#ifdef ORUTILS_HAS_SSE2
+	namespace ImageSamplerDetail
+	{
+		template <>
+		struct BatchKernels<float>
+		{
+			/** Split four consecutive points into their x and y coordinates. */
+			static inline void LoadPoints(const Vector2<float> *points, __m128& x, __m128& y)
+			{
+				__m128 a = _mm_loadu_ps(points[0].v), b = _mm_loadu_ps(points[2].v);
+				x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+				y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+			}
+
+			/** Whether @p lo <= x < @p hi in every lane, which also rejects NaNs. */
+			static inline bool AllInside(__m128 x, float lo, float hi)
+			{
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(lo)), _mm_cmplt_ps(x, _mm_set1_ps(hi)));
+				return _mm_movemask_ps(inside) == 15;
+			}
+
+			static void Bilinear(const ImageSampler<float>& sampler, const Vector2<float> *points, float *out, size_t count)
+			{
+				const ImageView<const float>& image = sampler.GetImage();
+				const __m128 one = _mm_set1_ps(1.0f);
+				size_t i = 0;
+
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 x, y;
+					LoadPoints(points + i, x, y);
+					if (!AllInside(x, 0.0f, (float)(image.noDims.x - 1)) || !AllInside(y, 0.0f, (float)(image.noDims.y - 1)))
+					{
+						for (size_t k = i; k < i + 4; ++k) out[k] = sampler.SampleBilinear(points[k]);
+						continue;
+					}
+
+					// The coordinates are non-negative, so truncation rounds down.
+					__m128i xi = _mm_cvttps_epi32(x), yi = _mm_cvttps_epi32(y);
+					__m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(xi)), fy = _mm_sub_ps(y, _mm_cvtepi32_ps(yi));
+
+					int xs[4], ys[4];
+					_mm_storeu_si128((__m128i*)xs, xi);
+					_mm_storeu_si128((__m128i*)ys, yi);
+
+					float p[4][4];
+					for (int k = 0; k < 4; ++k)
+					{
+						const float *r0 = image.GetRow(ys[k]) + xs[k], *r1 = r0 + image.pitch;
+						p[0][k] = r0[0]; p[1][k] = r0[1]; p[2][k] = r1[0]; p[3][k] = r1[1];
+					}
+
+					__m128 gx = _mm_sub_ps(one, fx), gy = _mm_sub_ps(one, fy);
+					__m128 top = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p[0]), gx), _mm_mul_ps(_mm_loadu_ps(p[1]), fx));
+					__m128 bottom = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p[2]), gx), _mm_mul_ps(_mm_loadu_ps(p[3]), fx));
+					_mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(top, gy), _mm_mul_ps(bottom, fy)));
+				}
+
+				for (; i < count; ++i) out[i] = sampler.SampleBilinear(points[i]);
+			}
+
+			/** CubicWeights for four coordinates at once, evaluated in the
+			same order so that the results are bit-identical.
+			*/
+			static inline void CubicWeights4(__m128 t, __m128 w[4])
+			{
+				const __m128 half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f), onehalf = _mm_set1_ps(1.5f);
+				const __m128 two = _mm_set1_ps(2.0f), twohalf = _mm_set1_ps(2.5f);
+
+				w[0] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(half, t)), t), half), t);
+				w[1] = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(onehalf, t), twohalf), t), t), one);
+				w[2] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(two, _mm_mul_ps(onehalf, t)), t), half), t);
+				w[3] = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_mul_ps(half, t), half), t), t);
+			}
+
+			static void Bicubic(const ImageSampler<float>& sampler, const Vector2<float> *points, float *out, size_t count)
+			{
+				const ImageView<const float>& image = sampler.GetImage();
+				size_t i = 0;
+
+				for (; i + 4 <= count; i += 4)
+				{
+					__m128 x, y;
+					LoadPoints(points + i, x, y);
+					if (!AllInside(x, 1.0f, (float)(image.noDims.x - 2)) || !AllInside(y, 1.0f, (float)(image.noDims.y - 2)))
+					{
+						for (size_t k = i; k < i + 4; ++k) out[k] = sampler.SampleBicubic(points[k]);
+						continue;
+					}
+
+					__m128i xi = _mm_cvttps_epi32(x), yi = _mm_cvttps_epi32(y);
+					__m128 wx[4], wy[4];
+					CubicWeights4(_mm_sub_ps(x, _mm_cvtepi32_ps(xi)), wx);
+					CubicWeights4(_mm_sub_ps(y, _mm_cvtepi32_ps(yi)), wy);
+
+					int xs[4], ys[4];
+					_mm_storeu_si128((__m128i*)xs, xi);
+					_mm_storeu_si128((__m128i*)ys, yi);
+
+					__m128 result = _mm_setzero_ps();
+					for (int j = 0; j < 4; ++j)
+					{
+						float p[4][4];
+						for (int k = 0; k < 4; ++k)
+						{
+							const float *row = image.GetRow(ys[k] - 1 + j) + xs[k] - 1;
+							p[0][k] = row[0]; p[1][k] = row[1]; p[2][k] = row[2]; p[3][k] = row[3];
+						}
+
+						__m128 r = _mm_mul_ps(_mm_loadu_ps(p[0]), wx[0]);
+						r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(p[1]), wx[1]));
+						r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(p[2]), wx[2]));
+						r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(p[3]), wx[3]));
+						result = j == 0 ? _mm_mul_ps(r, wy[0]) : _mm_add_ps(result, _mm_mul_ps(r, wy[j]));
+					}
+					_mm_storeu_ps(out + i, result);
+				}
+
+				for (; i < count; ++i) out[i] = sampler.SampleBicubic(points[i]);
+			}
+		};
+
+		/** Kernels for four-channel pixels, which interpolate one point at a time with all channels in one register. */
+		template <typename T>
+		struct Vector4BatchKernels
+		{
+			static inline __m128 LoadPixel(const Vector4<float>& pixel) { return _mm_loadu_ps(pixel.v); }
+
+			static inline __m128 LoadPixel(const Vector4<unsigned char>& pixel)
+			{
+				int bits;
+				memcpy(&bits, pixel.v, sizeof(bits));
+				const __m128i zero = _mm_setzero_si128();
+				return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero));
+			}
+
+			static void Bilinear(const ImageSampler<T>& sampler, const Vector2<float> *points, Vector4<float> *out, size_t count)
+			{
+				const ImageView<const T>& image = sampler.GetImage();
+				float xmax = (float)(image.noDims.x - 1), ymax = (float)(image.noDims.y - 1);
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					const Vector2<float>& point = points[i];
+					if (!(point.x >= 0.0f && point.x < xmax && point.y >= 0.0f && point.y < ymax))
+					{
+						out[i] = sampler.SampleBilinear(point);
+						continue;
+					}
+
+					int x0 = (int)point.x, y0 = (int)point.y;
+					float fx = point.x - (float)x0, fy = point.y - (float)y0;
+					const T *r0 = image.GetRow(y0) + x0, *r1 = r0 + image.pitch;
+
+					__m128 wx0 = _mm_set1_ps(1.0f - fx), wx1 = _mm_set1_ps(fx);
+					__m128 top = _mm_add_ps(_mm_mul_ps(LoadPixel(r0[0]), wx0), _mm_mul_ps(LoadPixel(r0[1]), wx1));
+					__m128 bottom = _mm_add_ps(_mm_mul_ps(LoadPixel(r1[0]), wx0), _mm_mul_ps(LoadPixel(r1[1]), wx1));
+					_mm_storeu_ps(out[i].v, _mm_add_ps(_mm_mul_ps(top, _mm_set1_ps(1.0f - fy)), _mm_mul_ps(bottom, _mm_set1_ps(fy))));
+				}
+			}
+
+			static void Bicubic(const ImageSampler<T>& sampler, const Vector2<float> *points, Vector4<float> *out, size_t count)
+			{
+				const ImageView<const T>& image = sampler.GetImage();
+				float xmax = (float)(image.noDims.x - 2), ymax = (float)(image.noDims.y - 2);
+
+				for (size_t i = 0; i < count; ++i)
+				{
+					const Vector2<float>& point = points[i];
+					if (!(point.x >= 1.0f && point.x < xmax && point.y >= 1.0f && point.y < ymax))
+					{
+						out[i] = sampler.SampleBicubic(point);
+						continue;
+					}
+
+					int x0 = (int)point.x, y0 = (int)point.y;
+					float wx[4], wy[4];
+					CubicWeights(point.x - (float)x0, wx);
+					CubicWeights(point.y - (float)y0, wy);
+
+					__m128 result = _mm_setzero_ps();
+					for (int j = 0; j < 4; ++j)
+					{
+						const T *row = image.GetRow(y0 - 1 + j) + x0 - 1;
+						__m128 r = _mm_mul_ps(LoadPixel(row[0]), _mm_set1_ps(wx[0]));
+						r = _mm_add_ps(r, _mm_mul_ps(LoadPixel(row[1]), _mm_set1_ps(wx[1])));
+						r = _mm_add_ps(r, _mm_mul_ps(LoadPixel(row[2]), _mm_set1_ps(wx[2])));
+						r = _mm_add_ps(r, _mm_mul_ps(LoadPixel(row[3]), _mm_set1_ps(wx[3])));
+						result = j == 0 ? _mm_mul_ps(r, _mm_set1_ps(wy[0])) : _mm_add_ps(result, _mm_mul_ps(r, _mm_set1_ps(wy[j])));
+					}
+					_mm_storeu_ps(out[i].v, result);
+				}
+			}
+		};
+
+		template <>
+		struct BatchKernels<Vector4<float> > : Vector4BatchKernels<Vector4<float> > {};
+
+		template <>
+		struct BatchKernels<Vector4<unsigned char> > : Vector4BatchKernels<Vector4<unsigned char> > {};
+	}
+#endif
+
+	/** Resample @p source to the size of @p target, both on the CPU, using
+	the batch kernels of ImageSampler. Pixel centres are aligned, so each
+	target pixel covers the same fraction of the image as in the source.
+	*/
+	template <typename T>
+	inline void ResizeImage(const ImageView<T>& target, const ImageView<const T>& source, SamplerFilter filter,
+		SamplerBoundary boundary = SAMPLERBOUNDARY_CLAMP)
+	{
+		if (target.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Images can only be resized on the CPU");
+
+		ImageSampler<T> sampler(source, boundary);
+		int width = target.noDims.x;
+		if (width <= 0) return;
+
+		float scaleX = (float)source.noDims.x / (float)target.noDims.x;
+		float scaleY = (float)source.noDims.y / (float)target.noDims.y;
+
+		std::vector<Vector2<float> > points(width);
+		std::vector<typename ImageSampler<T>::Result> values(width);
+		for (int x = 0; x < width; ++x) points[x].x = ((float)x + 0.5f) * scaleX - 0.5f;
+
+		for (int y = 0; y < target.noDims.y; ++y)
+		{
+			float sy = ((float)y + 0.5f) * scaleY - 0.5f;
+			for (int x = 0; x < width; ++x) points[x].y = sy;
+
+			sampler.Sample(&points[0], &values[0], width, filter);
+
+			T *row = target.GetRow(y);
+			for (int x = 0; x < width; ++x) row[x] = SamplerPixelTraits<T>::Store(values[x]);
+		}
+	}
+
+	/** Resample @p source to the size of @p target, which must both be allocated on the CPU. */
+	template <typename T>
+	inline void ResizeImage(Image<T>& target, const Image<T>& source, SamplerFilter filter,
+		SamplerBoundary boundary = SAMPLERBOUNDARY_CLAMP)
+	{
+		ResizeImage(ImageView<T>(target, MEMORYDEVICE_CPU), ImageView<const T>(source, MEMORYDEVICE_CPU), filter, boundary);
+	}
+}
+
+#endif
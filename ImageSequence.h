@@ -0,0 +1,645 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <limits.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Image.h"
+#include "ImageView.h"
+#include "MappedFile.h"
+#include "MemoryBlockFormat.h"
+#include "ParallelMemory.h"
+#include "PositionedFile.h"
+
+namespace ORUtils
+{
+
+/**
+ * \brief The 64-byte header at the start of an image sequence file.
+ *
+ * A sequence is this header, followed by the frames and then the index. Each frame is an image in the format written
+ * by MemoryBlockPersister::SaveImage, starting at a page-aligned position so that it can be memory mapped. The index
+ * holds one fixed-size ImageSequenceIndexEntry per frame, so any frame can be found in constant time.
+ */
+struct ImageSequenceHeader
+{
+  /** "ORIS". */
+  char magic[4];
+
+  /** The format version. */
+  uint16_t version;
+
+  /** The size of this header in bytes. */
+  uint16_t headerSize;
+
+  /** The number of frames in the sequence. */
+  uint64_t frameCount;
+
+  /** The offset of the index from the start of the file. */
+  uint64_t indexOffset;
+
+  /** FastHash64 of the index. */
+  uint64_t indexChecksum;
+
+  /** Reserved for future use, zero. */
+  uint8_t reserved[32];
+};
+
+/**
+ * \brief An entry in the index of an image sequence.
+ */
+struct ImageSequenceIndexEntry
+{
+  /** The offset of the frame from the start of the file. */
+  uint64_t offset;
+
+  /** The timestamp supplied when the frame was appended. */
+  uint64_t timestamp;
+
+  /** The frame's header. Its payload offset is relative to the start of the frame. */
+  MemoryBlockFileHeader header;
+};
+
+/**
+ * \brief Reads the index of a complete image sequence.
+ *
+ * \param file                The sequence file.
+ * \param index               The vector into which to read the index.
+ * \throws std::runtime_error If the file is not a complete image sequence.
+ */
+inline void ReadImageSequenceIndex(const PositionedFile& file, std::vector<ImageSequenceIndexEntry>& index)
+{
+  const std::string& filename = file.GetFilename();
+  uint64_t length = file.GetSize();
+
+  ImageSequenceHeader header;
+  if(length < sizeof(header)) throw std::runtime_error(filename + " is not an image sequence");
+  file.Read(&header, sizeof(header), 0);
+  if(memcmp(header.magic, "ORIS", 4) != 0) throw std::runtime_error(filename + " is not an image sequence");
+  if(header.version != 1) throw std::runtime_error(filename + " has an unsupported image sequence version");
+  if(header.indexOffset > length || header.frameCount > (length - header.indexOffset) / sizeof(ImageSequenceIndexEntry))
+  {
+    throw std::runtime_error(filename + " is truncated");
+  }
+
+  index.resize((size_t)header.frameCount);
+  size_t indexBytes = index.size() * sizeof(ImageSequenceIndexEntry);
+  if(indexBytes > 0) file.Read(&index[0], indexBytes, header.indexOffset);
+  if(FastHash64(index.empty() ? NULL : &index[0], indexBytes) != header.indexChecksum)
+  {
+    throw std::runtime_error("The index of " + filename + " is corrupt");
+  }
+
+  for(size_t i = 0, size = index.size(); i < size; ++i)
+  {
+    const ImageSequenceIndexEntry& entry = index[i];
+    if(entry.offset > header.indexOffset || entry.header.payloadOffset > header.indexOffset - entry.offset ||
+       entry.header.payloadBytes > header.indexOffset - entry.offset - entry.header.payloadOffset)
+    {
+      throw std::runtime_error("The index of " + filename + " is corrupt");
+    }
+
+    // Frames are sized from their dimensions but decoded from their element count, so the two must agree.
+    const MemoryBlockFileHeader& frame = entry.header;
+    if((frame.flags & MEMORYBLOCK_FLAG_IMAGE) == 0 || (uint64_t)frame.imageWidth * frame.imageHeight != frame.elementCount ||
+       frame.imageWidth > INT_MAX || frame.imageHeight > INT_MAX)
+    {
+      throw std::runtime_error("The index of " + filename + " is corrupt");
+    }
+  }
+}
+
+/**
+ * \brief This class appends images to an image sequence file, such as a recorded depth or colour stream.
+ *
+ * Frames are written as they are appended. The index is written by Close, which the destructor calls if necessary.
+ * When appending to an existing sequence, new frames are written after the old index, so the file stays readable as
+ * the old sequence until the new index has been written.
+ */
+class ImageSequenceWriter
+{
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** Whether the index has been written. */
+  bool m_closed;
+
+  /** The offset at which the next frame can start. */
+  uint64_t m_end;
+
+  /** The sequence file. */
+  PositionedFile m_file;
+
+  /** The index entries of the frames written so far. */
+  std::vector<ImageSequenceIndexEntry> m_index;
+
+  /** The save options for the frames. */
+  MemoryBlockSaveOptions m_options;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Creates a sequence, or opens an existing one to append frames to it.
+   *
+   * \param filename            The name of the sequence file.
+   * \param options             Whether to store checksums of the frames and how to compress them. Compressed frames
+   *                            cannot be played back from a mapping.
+   * \param append              Whether to append to an existing sequence rather than replacing it.
+   * \throws std::runtime_error If the file cannot be created, or cannot be appended to because it is not a complete sequence.
+   */
+  explicit ImageSequenceWriter(const std::string& filename, const MemoryBlockSaveOptions& options = MemoryBlockSaveOptions(), bool append = false)
+  : m_closed(false), m_end(sizeof(ImageSequenceHeader)), m_file(filename, append ? PositionedFile::OPEN_READ_WRITE : PositionedFile::OPEN_CREATE),
+    m_options(options)
+  {
+    if(append)
+    {
+      ReadImageSequenceIndex(m_file, m_index);
+      m_end = m_file.GetSize();
+    }
+  }
+
+  //#################### DESTRUCTOR ####################
+public:
+  ~ImageSequenceWriter()
+  {
+    try { Close(); }
+    catch(...) {}
+  }
+
+  //#################### COPY CONSTRUCTOR & ASSIGNMENT OPERATOR ####################
+public:
+  // Suppress the default copy constructor and assignment operator
+  ImageSequenceWriter(const ImageSequenceWriter&) = delete;
+  ImageSequenceWriter& operator=(const ImageSequenceWriter&) = delete;
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Writes an image to the end of the sequence.
+   *
+   * \param image               The image to write.
+   * \param memoryDeviceType    The type of memory device from which to write the data.
+   * \param timestamp           A timestamp to store with the frame, in units of the caller's choosing.
+   * \throws std::runtime_error If the sequence is closed or the write is unsuccessful.
+   */
+  template <typename T>
+  void AppendFrame(const ORUtils::Image<T>& image, MemoryDeviceType memoryDeviceType, uint64_t timestamp = 0)
+  {
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we are saving the image from the GPU, first make a CPU copy of it.
+      ORUtils::MemoryBlock<T> cpuBlock(image.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      cpuBlock.SetFrom(&image, ORUtils::MemoryBlock<T>::CUDA_TO_CPU);
+      AppendFrame(cpuBlock.GetData(MEMORYDEVICE_CPU), image.noDims, sizeof(T), MemoryBlockTypeTag<T>::Value(), timestamp);
+    }
+    else
+    {
+      AppendFrame(image.GetData(MEMORYDEVICE_CPU), image.noDims, sizeof(T), MemoryBlockTypeTag<T>::Value(), timestamp);
+    }
+  }
+
+  /**
+   * \brief Writes the index and finishes the sequence. Further calls have no effect.
+   *
+   * \throws std::runtime_error If the write is unsuccessful.
+   */
+  void Close()
+  {
+    if(m_closed) return;
+    m_closed = true;
+
+    ImageSequenceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ORIS", 4);
+    header.version = 1;
+    header.headerSize = sizeof(ImageSequenceHeader);
+    header.frameCount = m_index.size();
+    header.indexOffset = m_end;
+
+    size_t indexBytes = m_index.size() * sizeof(ImageSequenceIndexEntry);
+    header.indexChecksum = FastHash64(m_index.empty() ? NULL : &m_index[0], indexBytes);
+
+    // Write the index before the header that refers to it.
+    if(indexBytes > 0) m_file.Write(&m_index[0], indexBytes, header.indexOffset);
+    m_file.Write(&header, sizeof(header), 0);
+  }
+
+  /**
+   * \brief Gets the number of frames in the sequence, including any that were already there when it was opened.
+   */
+  size_t GetFrameCount() const
+  {
+    return m_index.size();
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Writes an image, given as raw pixels, to the end of the sequence.
+   */
+  void AppendFrame(const void *data, const Vector2<int>& noDims, uint32_t elementSize, uint32_t typeTag, uint64_t timestamp)
+  {
+    if(m_closed) throw std::runtime_error("Cannot append a frame to a closed image sequence");
+
+    std::vector<char> buffer;
+    ImageSequenceIndexEntry entry;
+    uint64_t elementCount = (uint64_t)noDims.x * noDims.y;
+    const void *payload = PrepareMemoryBlockPayload(data, elementCount, elementSize, typeTag, m_options, buffer, entry.header);
+    SetMemoryBlockImageDims(entry.header, noDims.x, noDims.y);
+
+    // Start each frame on a page boundary, so that its payload can be mapped and read efficiently.
+    const uint64_t frameAlignment = 4096;
+    entry.offset = (m_end + frameAlignment - 1) / frameAlignment * frameAlignment;
+    entry.timestamp = timestamp;
+
+    m_file.Write(&entry.header, sizeof(entry.header), entry.offset);
+    if(entry.header.payloadBytes > 0) m_file.Write(payload, (size_t)entry.header.payloadBytes, entry.offset + entry.header.payloadOffset);
+
+    m_end = entry.offset + entry.header.payloadOffset + entry.header.payloadBytes;
+    m_index.push_back(entry);
+  }
+};
+
+/**
+ * \brief This class plays back the frames of an image sequence file.
+ *
+ * Any frame can be read in constant time. By default the file is memory mapped, so uncompressed frames can also be
+ * viewed in place without copying. Reading a frame can trigger a reader thread that decodes the following frames
+ * ahead of time, which hides the cost of disk reads, checksums and decompression during sequential playback.
+ */
+class ImageSequenceReader
+{
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** Frames decoded ahead of time by the reader thread, keyed by frame number. Frames that failed to decode map to NULL. */
+  std::map<size_t,std::vector<char>*> m_cache;
+
+  /** Signalled when the reader thread finishes decoding a frame. */
+  std::condition_variable m_frameDecoded;
+
+  /** The sequence file. */
+  PositionedFile m_file;
+
+  /** Buffers for decoded frames that are not currently in use. */
+  std::vector<std::vector<char>*> m_freeBuffers;
+
+  /** The index of the sequence. */
+  std::vector<ImageSequenceIndexEntry> m_index;
+
+  /** The mapping of the sequence file, or NULL if the file is not mapped. */
+  MappedFile *m_mapping;
+
+  /** The mutex protecting the cache and the prefetch window. */
+  mutable std::mutex m_mutex;
+
+  /** The number of frames after the last one read that the reader thread decodes ahead of time. */
+  size_t m_prefetchCount;
+
+  /** The first frame of the prefetch window. */
+  size_t m_prefetchStart;
+
+  /** Signalled when the prefetch window changes or the reader is being destroyed. */
+  std::condition_variable m_prefetchChanged;
+
+  /** The frame the reader thread is currently decoding, or the frame count if none. */
+  size_t m_decoding;
+
+  /** Whether the reader thread should exit. */
+  bool m_stopping;
+
+  /** The reader thread, which is started when prefetching is first enabled. */
+  std::thread m_thread;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Opens a sequence and reads its index.
+   *
+   * \param filename            The name of the sequence file.
+   * \param mapped              Whether to memory map the file, which is required by GetFrameView.
+   * \throws std::runtime_error If the file is not a complete image sequence or cannot be mapped.
+   */
+  explicit ImageSequenceReader(const std::string& filename, bool mapped = true)
+  : m_file(filename, PositionedFile::OPEN_READ), m_mapping(NULL), m_prefetchCount(0), m_prefetchStart(0), m_decoding(0), m_stopping(false)
+  {
+    ReadImageSequenceIndex(m_file, m_index);
+    m_decoding = m_index.size();
+    if(mapped) m_mapping = new MappedFile(filename);
+  }
+
+  //#################### DESTRUCTOR ####################
+public:
+  ~ImageSequenceReader()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_prefetchChanged.notify_all();
+    if(m_thread.joinable()) m_thread.join();
+
+    for(std::map<size_t,std::vector<char>*>::iterator it = m_cache.begin(), iend = m_cache.end(); it != iend; ++it) delete it->second;
+    for(size_t i = 0, size = m_freeBuffers.size(); i < size; ++i) delete m_freeBuffers[i];
+    delete m_mapping;
+  }
+
+  //#################### COPY CONSTRUCTOR & ASSIGNMENT OPERATOR ####################
+public:
+  // Suppress the default copy constructor and assignment operator
+  ImageSequenceReader(const ImageSequenceReader&) = delete;
+  ImageSequenceReader& operator=(const ImageSequenceReader&) = delete;
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Gets the number of frames in the sequence.
+   */
+  size_t GetFrameCount() const
+  {
+    return m_index.size();
+  }
+
+  /**
+   * \brief Gets the dimensions of a frame.
+   *
+   * \throws std::runtime_error If there is no such frame.
+   */
+  Vector2<int> GetFrameDims(size_t frame) const
+  {
+    const MemoryBlockFileHeader& header = GetEntry(frame).header;
+    return Vector2<int>((int)header.imageWidth, (int)header.imageHeight);
+  }
+
+  /**
+   * \brief Gets the description of a frame.
+   *
+   * \param frame               The frame number.
+   * \return                    The description of the frame, with its payload offset relative to the start of the file.
+   * \throws std::runtime_error If there is no such frame.
+   */
+  MemoryBlockFileInfo GetFrameInfo(size_t frame) const
+  {
+    const ImageSequenceIndexEntry& entry = GetEntry(frame);
+    MemoryBlockFileInfo info = MakeMemoryBlockFileInfo(entry.header);
+    info.headerOffset = entry.offset;
+    info.payloadOffset += entry.offset;
+    return info;
+  }
+
+  /**
+   * \brief Gets the timestamp that was stored with a frame.
+   *
+   * \throws std::runtime_error If there is no such frame.
+   */
+  uint64_t GetTimestamp(size_t frame) const
+  {
+    return GetEntry(frame).timestamp;
+  }
+
+  /**
+   * \brief Gets a read-only view of an uncompressed frame in the mapped file, without copying it.
+   *
+   * The view remains valid for the lifetime of the reader. Its checksum is not verified. The following frames,
+   * up to the prefetch count, are requested from the operating system ahead of time.
+   *
+   * \param frame               The frame number.
+   * \return                    The view.
+   * \throws std::runtime_error If there is no such frame, it has the wrong type or is compressed, or the file is not mapped.
+   */
+  template <typename T>
+  ImageView<const T> GetFrameView(size_t frame) const
+  {
+    MemoryBlockFileInfo info = GetFrameInfo(frame);
+    CheckMemoryBlockElementType<T>(info, FrameName(frame));
+    if(m_mapping == NULL) throw std::runtime_error("Cannot view a frame of an image sequence that is not mapped");
+    if(info.IsCompressed()) throw std::runtime_error(FrameName(frame) + " is compressed and cannot be viewed in place");
+
+    size_t count;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      count = m_prefetchCount;
+    }
+    for(size_t i = frame + 1; i <= frame + count && i < m_index.size(); ++i)
+    {
+      MemoryBlockFileInfo next = GetFrameInfo(i);
+      m_mapping->Prefetch((size_t)next.payloadOffset, (size_t)next.payloadBytes);
+    }
+
+    const T *data = reinterpret_cast<const T *>(reinterpret_cast<const char *>(m_mapping->GetData()) + info.payloadOffset);
+    return ImageView<const T>(data, GetFrameDims(frame), (int)info.imageWidth, MEMORYDEVICE_CPU);
+  }
+
+  /**
+   * \brief Reads a frame into an image, changing the image's dimensions to match the frame if necessary.
+   *
+   * If prefetching is enabled, the reader thread then starts decoding the frames that follow this one.
+   *
+   * \param frame               The frame number.
+   * \param image               The image into which to read the frame.
+   * \param memoryDeviceType    The type of memory device on which to load the data.
+   * \throws std::runtime_error If there is no such frame, it has the wrong type, or it fails its checksum.
+   */
+  template <typename T>
+  void ReadFrame(size_t frame, ORUtils::Image<T>& image, MemoryDeviceType memoryDeviceType)
+  {
+    MemoryBlockFileInfo info = GetFrameInfo(frame);
+    CheckMemoryBlockElementType<T>(info, FrameName(frame));
+
+    image.ChangeDims(GetFrameDims(frame));
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we're loading into an image on the GPU, first read the frame into a temporary block on the CPU.
+      ORUtils::MemoryBlock<T> cpuBlock(image.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      ReadFrameData(frame, info, cpuBlock.GetData(MEMORYDEVICE_CPU), cpuBlock.dataSize * sizeof(T));
+      image.SetFrom(&cpuBlock, ORUtils::MemoryBlock<T>::CPU_TO_CUDA);
+    }
+    else
+    {
+      ReadFrameData(frame, info, image.GetData(MEMORYDEVICE_CPU), image.dataSize * sizeof(T));
+    }
+  }
+
+  /**
+   * \brief Sets how many frames after the last one read the reader thread decodes ahead of time.
+   *
+   * \param count The number of frames, or 0 to disable prefetching.
+   */
+  void SetPrefetchCount(size_t count)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_prefetchCount = count;
+      if(count > 0 && !m_thread.joinable()) m_thread = std::thread(&ImageSequenceReader::RunReaderThread, this);
+    }
+    m_prefetchChanged.notify_all();
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Reads the payload of a frame and unpacks it, from the mapping if there is one.
+   *
+   * \throws std::runtime_error If the read is unsuccessful, or the frame fails its checksum or cannot be decompressed.
+   */
+  void DecodeFrame(size_t frame, const MemoryBlockFileInfo& info, void *data, size_t bytes) const
+  {
+    if(m_mapping != NULL)
+    {
+      const char *payload = reinterpret_cast<const char *>(m_mapping->GetData()) + info.payloadOffset;
+      if(info.HasChecksum() && FastHash64(payload, (size_t)info.payloadBytes) != info.checksum)
+      {
+        throw std::runtime_error(FrameName(frame) + " does not match its checksum");
+      }
+
+      if(info.IsCompressed()) DecompressBlock(payload, (size_t)info.payloadBytes, data, bytes);
+      else ParallelMemcpy(data, payload, bytes);
+      return;
+    }
+
+    std::vector<char> buffer;
+    void *payload = data;
+    if(info.IsCompressed())
+    {
+      buffer.resize((size_t)info.payloadBytes);
+      payload = &buffer[0];
+    }
+
+    if(info.payloadBytes > 0) m_file.Read(payload, (size_t)info.payloadBytes, info.payloadOffset);
+    UnpackMemoryBlockPayload(payload, info, data, bytes, FrameName(frame));
+  }
+
+  /**
+   * \brief Gets a frame description for error messages.
+   */
+  std::string FrameName(size_t frame) const
+  {
+    char buffer[32];
+    sprintf(buffer, "%lu", (unsigned long)frame);
+    return "Frame " + std::string(buffer) + " of " + m_file.GetFilename();
+  }
+
+  /**
+   * \brief Gets the index entry of a frame.
+   *
+   * \throws std::runtime_error If there is no such frame.
+   */
+  const ImageSequenceIndexEntry& GetEntry(size_t frame) const
+  {
+    if(frame >= m_index.size()) throw std::runtime_error("The image sequence " + m_file.GetFilename() + " does not have that many frames");
+    return m_index[frame];
+  }
+
+  /**
+   * \brief Reads a frame into a buffer, taking it from the prefetch cache if the reader thread has decoded it.
+   */
+  void ReadFrameData(size_t frame, const MemoryBlockFileInfo& info, void *data, size_t bytes)
+  {
+    std::vector<char> *cached = NULL;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_prefetchStart = frame + 1;
+
+      // If the reader thread is decoding this frame, it is quicker to wait for it than to start again.
+      while(m_decoding == frame) m_frameDecoded.wait(lock);
+
+      std::map<size_t,std::vector<char>*>::iterator it = m_cache.find(frame);
+      if(it != m_cache.end())
+      {
+        cached = it->second;
+        m_cache.erase(it);
+      }
+    }
+    m_prefetchChanged.notify_all();
+
+    if(cached != NULL && cached->size() == bytes)
+    {
+      ParallelMemcpy(data, &(*cached)[0], bytes);
+    }
+    else
+    {
+      DecodeFrame(frame, info, data, bytes);
+    }
+
+    if(cached != NULL)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_freeBuffers.push_back(cached);
+    }
+  }
+
+  /**
+   * \brief Decodes the frames in the prefetch window until the reader is destroyed.
+   */
+  void RunReaderThread()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for(;;)
+    {
+      // Drop the decoded frames that have fallen outside the window.
+      size_t end = std::min(m_prefetchStart + m_prefetchCount, m_index.size());
+      for(std::map<size_t,std::vector<char>*>::iterator it = m_cache.begin(); it != m_cache.end();)
+      {
+        if(it->first < m_prefetchStart || it->first >= end)
+        {
+          if(it->second != NULL) m_freeBuffers.push_back(it->second);
+          m_cache.erase(it++);
+        }
+        else ++it;
+      }
+
+      // Find the first frame in the window that has not been decoded yet.
+      size_t frame = m_prefetchStart;
+      while(frame < end && m_cache.find(frame) != m_cache.end()) ++frame;
+
+      if(m_stopping) return;
+      if(frame >= end)
+      {
+        m_prefetchChanged.wait(lock);
+        continue;
+      }
+
+      std::vector<char> *buffer;
+      if(m_freeBuffers.empty()) buffer = new std::vector<char>;
+      else
+      {
+        buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+      }
+      m_decoding = frame;
+      lock.unlock();
+
+      bool decoded = true;
+      try
+      {
+        MemoryBlockFileInfo info = GetFrameInfo(frame);
+        buffer->resize((size_t)(info.elementCount * info.elementSize));
+        DecodeFrame(frame, info, buffer->empty() ? NULL : &(*buffer)[0], buffer->size());
+      }
+      catch(...)
+      {
+        // Leave the frame for ReadFrame to decode, so that it reports the error.
+        decoded = false;
+      }
+
+      lock.lock();
+      m_decoding = m_index.size();
+      if(!decoded)
+      {
+        m_freeBuffers.push_back(buffer);
+        buffer = NULL;
+      }
+      m_cache[frame] = buffer;
+      m_frameDecoded.notify_all();
+    }
+  }
+};
+
+}
@@ -0,0 +1,147 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "Image.h"
+#include "MemoryBlockView.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** \brief
+	Non-owning view of a rectangular region of an image on the CPU or the GPU.
+
+	Rows are @p pitch elements apart, so a view can describe a crop or tile
+	of a larger image without copying. Like MemoryBlockView, it does not
+	keep the image alive. Use ImageView<const T> for read-only access.
+	*/
+	template <typename T>
+	class ImageView
+	{
+	public:
+		/** Pointer to the top-left pixel of the view. */
+		DEVICEPTR(T)* data;
+
+		/** Size of the view in pixels. */
+		Vector2<int> noDims;
+
+		/** Distance between the starts of two consecutive rows, in elements. */
+		int pitch;
+
+		/** Device the data pointer refers to. */
+		MemoryDeviceType memoryType;
+
+		_CPU_AND_GPU_CODE_ ImageView()
+			: data(NULL), noDims(0, 0), pitch(0), memoryType(MEMORYDEVICE_CPU)
+		{}
+
+		_CPU_AND_GPU_CODE_ ImageView(DEVICEPTR(T)* data, Vector2<int> noDims, int pitch, MemoryDeviceType memoryType)
+			: data(data), noDims(noDims), pitch(pitch), memoryType(memoryType)
+		{}
+
+		/** View the whole of @p image on the given device. */
+		template <typename U>
+		ImageView(Image<U>& image, MemoryDeviceType memoryType)
+			: data(image.GetData(memoryType)), noDims(image.noDims), pitch(image.noDims.x), memoryType(memoryType)
+		{}
+
+		template <typename U>
+		ImageView(const Image<U>& image, MemoryDeviceType memoryType)
+			: data(image.GetData(memoryType)), noDims(image.noDims), pitch(image.noDims.x), memoryType(memoryType)
+		{}
+
+		/** View the region of @p image with top-left corner @p origin and size @p size. */
+		template <typename U>
+		ImageView(Image<U>& image, MemoryDeviceType memoryType, Vector2<int> origin, Vector2<int> size)
+		{
+			*this = ImageView<T>(image, memoryType).SubView(origin, size);
+		}
+
+		template <typename U>
+		ImageView(const Image<U>& image, MemoryDeviceType memoryType, Vector2<int> origin, Vector2<int> size)
+		{
+			*this = ImageView<T>(image, memoryType).SubView(origin, size);
+		}
+
+		/** Allow views of T to be used where views of const T are expected. */
+		_CPU_AND_GPU_CODE_ operator ImageView<const T>() const
+		{
+			return ImageView<const T>(data, noDims, pitch, memoryType);
+		}
+
+		/** Get the data pointer, or NULL if the view is not on the requested device. */
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)* GetData(MemoryDeviceType memoryType) const
+		{
+			return memoryType == this->memoryType ? data : NULL;
+		}
+
+		/** Get a pointer to the first pixel of row @p y. */
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)* GetRow(int y) const { return data + (size_t)y * pitch; }
+
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)& operator()(int x, int y) const { return data[(size_t)y * pitch + x]; }
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)& operator()(Vector2<int> pnt) const { return data[(size_t)pnt.y * pitch + pnt.x]; }
+
+		/** Whether the rows follow each other without padding. */
+		_CPU_AND_GPU_CODE_ inline bool IsContiguous() const { return pitch == noDims.x || noDims.y <= 1; }
+
+		/** View the region of this view with top-left corner @p origin and size @p size. */
+		ImageView<T> SubView(Vector2<int> origin, Vector2<int> size) const
+		{
+			if (origin.x < 0 || origin.y < 0 || size.x < 0 || size.y < 0 ||
+				origin.x + size.x > noDims.x || origin.y + size.y > noDims.y)
+			{
+				DIEWITHEXCEPTION("Image view region lies outside the image");
+			}
+
+			return ImageView<T>(data == NULL ? NULL : data + (size_t)origin.y * pitch + origin.x, size, pitch, memoryType);
+		}
+
+		/** View the pixels of a contiguous view as a flat range of elements. */
+		MemoryBlockView<T> AsMemoryBlockView() const
+		{
+			if (!IsContiguous()) DIEWITHEXCEPTION("Only contiguous image views can be viewed as memory blocks");
+			return MemoryBlockView<T>(data, (size_t)noDims.x * noDims.y, memoryType);
+		}
+	};
+
+	/** Copy the pixels of @p source into @p destination, which must have
+	the same size. The copy direction follows the devices of the two views
+and device copies go through the default MemoryBackend.
+	Contiguous views are copied in one go, padded ones row by row.
+	*/
+	template <typename T>
+	inline void CopyImageView(const ImageView<T>& destination, const ImageView<const T>& source)
+	{
+		if (destination.noDims != source.noDims) DIEWITHEXCEPTION("Cannot copy between image views of different sizes");
+		if (destination.noDims.x == 0 || destination.noDims.y == 0) return;
+
+		size_t rowBytes = (size_t)source.noDims.x * sizeof(T);
+
+		if (destination.memoryType == MEMORYDEVICE_CPU && source.memoryType == MEMORYDEVICE_CPU)
+		{
+			if (destination.IsContiguous() && source.IsContiguous())
+			{
+				ParallelMemcpy(destination.data, source.data, rowBytes * source.noDims.y);
+			}
+			else
+			{
+				for (int y = 0; y < source.noDims.y; ++y) memcpy(destination.GetRow(y), source.GetRow(y), rowBytes);
+			}
+			return;
+		}
+
+		MemoryBackend *backend = MemoryBackend::GetDefault();
+		if (backend == NULL) return;
+
+		MemoryTransferKind kind;
+		if (source.memoryType == MEMORYDEVICE_CPU) kind = TRANSFER_HOST_TO_DEVICE;
+		else if (destination.memoryType == MEMORYDEVICE_CPU) kind = TRANSFER_DEVICE_TO_HOST;
+		else kind = TRANSFER_DEVICE_TO_DEVICE;
+
+		backend->Copy2D(destination.data, destination.pitch * sizeof(T), source.data, source.pitch * sizeof(T),
+			rowBytes, source.noDims.y, kind);
+	}
+}
+
+#endif
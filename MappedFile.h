@@ -0,0 +1,128 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ORUtils
+{
+	/** \brief
+	A whole file mapped into memory. Pages are read from disk on first
+	access rather than when the file is opened.
+	*/
+	class MappedFile
+	{
+	public:
+		/** MAPPING_READ_ONLY shares the pages with the page cache and faults
+		on writes. MAPPING_COPY_ON_WRITE gives a private, writable mapping:
+		modified pages are copied and never written back to the file.
+		*/
+		enum Mode { MAPPING_READ_ONLY, MAPPING_COPY_ON_WRITE };
+
+	private:
+		void *data;
+		size_t size;
+		Mode mode;
+#ifdef _WIN32
+		HANDLE file, mapping;
+#endif
+
+	public:
+		/** Map @p filename, throwing std::runtime_error if it cannot be opened or mapped. */
+		MappedFile(const std::string& filename, Mode mode = MAPPING_READ_ONLY)
+		{
+			this->data = NULL;
+			this->size = 0;
+			this->mode = mode;
+
+#ifdef _WIN32
+			this->mapping = NULL;
+			this->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("Could not open " + filename + " for mapping");
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize)) { CloseHandle(file); throw std::runtime_error("Could not get the size of " + filename); }
+			size = (size_t)fileSize.QuadPart;
+			if (size == 0) return;
+
+			mapping = CreateFileMappingA(file, NULL, mode == MAPPING_READ_ONLY ? PAGE_READONLY : PAGE_WRITECOPY, 0, 0, NULL);
+			if (mapping != NULL) data = MapViewOfFile(mapping, mode == MAPPING_READ_ONLY ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0);
+			if (data == NULL)
+			{
+				if (mapping != NULL) CloseHandle(mapping);
+				CloseHandle(file);
+				throw std::runtime_error("Could not map " + filename);
+			}
+#else
+			int fd = open(filename.c_str(), O_RDONLY);
+			if (fd < 0) throw std::runtime_error("Could not open " + filename + " for mapping");
+
+			struct stat st;
+			if (fstat(fd, &st) != 0) { close(fd); throw std::runtime_error("Could not get the size of " + filename); }
+			size = (size_t)st.st_size;
+
+			if (size > 0)
+			{
+				int protection = mode == MAPPING_READ_ONLY ? PROT_READ : PROT_READ | PROT_WRITE;
+				int flags = mode == MAPPING_READ_ONLY ? MAP_SHARED : MAP_PRIVATE;
+				data = mmap(NULL, size, protection, flags, fd, 0);
+			}
+
+			// The mapping keeps the file referenced, so the descriptor is no longer needed.
+			close(fd);
+			if (data == MAP_FAILED) { data = NULL; throw std::runtime_error("Could not map " + filename); }
+#endif
+		}
+
+		~MappedFile()
+		{
+#ifdef _WIN32
+			if (data != NULL) UnmapViewOfFile(data);
+			if (mapping != NULL) CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+			if (data != NULL) munmap(data, size);
+#endif
+		}
+
+		/** Start of the mapping, NULL for an empty file. */
+		inline void *GetData() const { return data; }
+
+		/** Size of the file in bytes. */
+		inline size_t GetSize() const { return size; }
+
+		inline Mode GetMode() const { return mode; }
+
+		/** Ask the OS to read [@p offset, @p offset + @p bytes) ahead of its
+		first access. This is only a hint and returns immediately.
+		*/
+		void Prefetch(size_t offset, size_t bytes) const
+		{
+			if (data == NULL || offset >= size) return;
+			if (bytes > size - offset) bytes = size - offset;
+
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+			size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+			size_t begin = offset / pageSize * pageSize;
+			madvise((char*)data + begin, offset + bytes - begin, MADV_WILLNEED);
+#endif
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+	};
+}
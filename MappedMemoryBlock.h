@@ -0,0 +1,74 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "MappedFile.h"
+#include "MemoryBlock.h"
+
+namespace ORUtils
+{
+	/** \brief
+	Memory block whose CPU data is a memory mapped range of a file.
+
+	Nothing is read when the block is created; pages are faulted in from
+	disk as they are first accessed. In MappedFile::MAPPING_READ_ONLY mode
+	the data must not be written. In MappedFile::MAPPING_COPY_ON_WRITE mode
+	writes are private to the block and never reach the file. Reallocating
+	the block (Allocate, or Resize/Reserve beyond the capacity) replaces the
+	mapped data with regular memory. The data stays owned by the mapping,
+	so it must not be moved or swapped into a plain MemoryBlock that
+	outlives this one.
+	*/
+	template <typename T>
+	class MappedMemoryBlock : public MemoryBlock<T>
+	{
+	private:
+		MappedFile file;
+
+	public:
+		/** Map @p dataSize elements starting @p offset bytes into @p filename.
+		With @p allocate_CUDA, device memory is allocated too and the mapped
+		data is uploaded to it, which reads the whole range.
+		*/
+		MappedMemoryBlock(const std::string& filename, size_t offset, size_t dataSize,
+			MappedFile::Mode mode = MappedFile::MAPPING_READ_ONLY, bool allocate_CUDA = false)
+			: MemoryBlock<T>(0, false, false), file(filename, mode)
+		{
+			if (offset > file.GetSize() || dataSize > (file.GetSize() - offset) / sizeof(T))
+				throw std::runtime_error("The mapped range extends past the end of " + filename);
+
+			char *data = (char*)file.GetData() + offset;
+			if ((uintptr_t)data % alignof(T) != 0)
+				throw std::runtime_error("The mapped data in " + filename + " is not suitably aligned");
+
+			this->Allocate(dataSize, false, allocate_CUDA, false);
+			if (dataSize == 0) return;
+
+			this->data_cpu = (T*)data;
+			this->isAllocated_CPU = true;
+			this->isExternal_CPU = true;
+
+			if (this->isAllocated_CUDA) this->UpdateDeviceFromHost();
+		}
+
+		~MappedMemoryBlock() { this->Free(); }
+
+		/** The underlying mapping, e.g. to prefetch parts of it. */
+		inline const MappedFile& GetMappedFile() const { return file; }
+
+		/** Whether the CPU data still lives in the mapping. */
+		inline bool IsMapped() const { return this->isExternal_CPU; }
+
+		/** Ask the OS to start reading entries [@p begin, @p end) from disk. */
+		void Prefetch(size_t begin, size_t end) const
+		{
+			if (!IsMapped() || begin >= end) return;
+			size_t offset = (size_t)((const char*)this->data_cpu - (const char*)file.GetData());
+			file.Prefetch(offset + begin * sizeof(T), (end - begin) * sizeof(T));
+		}
+	};
+}
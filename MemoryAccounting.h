@@ -0,0 +1,237 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace ORUtils
+{
+	/** Kinds of memory tracked by MemoryAccounting. */
+	enum MemoryAccountingDevice { ACCOUNTING_HOST, ACCOUNTING_HOST_PINNED, ACCOUNTING_HOST_METAL, ACCOUNTING_CUDA, ACCOUNTING_DEVICE_COUNT };
+
+	/** \brief
+	Opt-in, process-wide registry of the memory held by memory blocks.
+
+	When enabled, every MemoryBlock allocation and release is reported here,
+	broken down by kind of memory and by the tag in the block's allocation
+	policy. Blocks allocated while accounting was disabled are not counted,
+	not even when they are freed later, so totals stay consistent.
+	*/
+	class MemoryAccounting
+	{
+	public:
+		/** Counters for one kind of memory or one tag. */
+		struct Statistics
+		{
+			/** Bytes currently allocated. */
+			size_t currentBytes;
+			/** Largest value currentBytes has reached (high-water mark). */
+			size_t peakBytes;
+			/** Number of allocations that are currently live. */
+			size_t liveAllocations;
+			/** Total number of allocations and releases seen. */
+			size_t allocationCount, freeCount;
+
+			Statistics() : currentBytes(0), peakBytes(0), liveAllocations(0), allocationCount(0), freeCount(0) {}
+		};
+
+	private:
+		mutable std::mutex mutex;
+		std::atomic<bool> enabled;
+		Statistics devices[ACCOUNTING_DEVICE_COUNT];
+		std::map<std::string, Statistics> tags;
+
+		MemoryAccounting() : enabled(false) {}
+
+		static std::string TagName(const char *tag) { return tag == NULL ? "untagged" : tag; }
+
+		static void Add(Statistics& statistics, size_t bytes)
+		{
+			statistics.currentBytes += bytes;
+			if (statistics.currentBytes > statistics.peakBytes) statistics.peakBytes = statistics.currentBytes;
+			statistics.liveAllocations++;
+			statistics.allocationCount++;
+		}
+
+		static void Remove(Statistics& statistics, size_t bytes)
+		{
+			statistics.currentBytes -= bytes;
+			statistics.liveAllocations--;
+			statistics.freeCount++;
+		}
+
+		static void PrintRow(std::ostream& os, const std::string& name, const Statistics& s)
+		{
+			os << name << "\t" << s.currentBytes << "\t" << s.peakBytes << "\t" << s.liveAllocations
+				<< "\t" << s.allocationCount << "\t" << s.freeCount << "\n";
+		}
+
+		/** Write @p s as a JSON string, escaping quotes, backslashes and control characters. */
+		static void PrintJSONString(std::ostream& os, const std::string& s)
+		{
+			static const char *hex = "0123456789abcdef";
+
+			os << '"';
+			for (size_t i = 0; i < s.size(); ++i)
+			{
+				unsigned char c = (unsigned char)s[i];
+				switch (c)
+				{
+				case '"': os << "\\\""; break;
+				case '\\': os << "\\\\"; break;
+				case '\b': os << "\\b"; break;
+				case '\f': os << "\\f"; break;
+				case '\n': os << "\\n"; break;
+				case '\r': os << "\\r"; break;
+				case '\t': os << "\\t"; break;
+				default:
+					if (c < 0x20) os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+					else os << (char)c;
+				}
+			}
+			os << '"';
+		}
+
+		static void PrintJSON(std::ostream& os, const std::string& name, const Statistics& s)
+		{
+			PrintJSONString(os, name);
+			os << ": {\"currentBytes\": " << s.currentBytes << ", \"peakBytes\": " << s.peakBytes
+				<< ", \"liveAllocations\": " << s.liveAllocations << ", \"allocationCount\": " << s.allocationCount
+				<< ", \"freeCount\": " << s.freeCount << "}";
+		}
+
+	public:
+		/** The process-wide registry, never destroyed so that static blocks can report during shutdown. */
+		static MemoryAccounting& Instance()
+		{
+			static MemoryAccounting *instance = new MemoryAccounting();
+			return *instance;
+		}
+
+		static const char *GetDeviceName(MemoryAccountingDevice device)
+		{
+			switch (device)
+			{
+			case ACCOUNTING_HOST: return "host";
+			case ACCOUNTING_HOST_PINNED: return "host_pinned";
+			case ACCOUNTING_HOST_METAL: return "host_metal";
+			case ACCOUNTING_CUDA: return "cuda";
+			default: return "unknown";
+			}
+		}
+
+		bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+		void SetEnabled(bool enabled) { this->enabled.store(enabled); }
+
+		/** Report an allocation of @p bytes. Does nothing and returns false while accounting is disabled. */
+		bool RecordAllocation(MemoryAccountingDevice device, const char *tag, size_t bytes)
+		{
+			if (!IsEnabled()) return false;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			Add(devices[device], bytes);
+			Add(tags[TagName(tag)], bytes);
+			return true;
+		}
+
+		/** Report the release of an allocation for which RecordAllocation returned true. */
+		void RecordFree(MemoryAccountingDevice device, const char *tag, size_t bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Remove(devices[device], bytes);
+			Remove(tags[TagName(tag)], bytes);
+		}
+
+		/** Move a live allocation from one tag to another. */
+		void RecordRetag(const char *oldTag, const char *newTag, size_t bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Statistics& from = tags[TagName(oldTag)];
+			from.currentBytes -= bytes;
+			from.liveAllocations--;
+			Statistics& to = tags[TagName(newTag)];
+			to.currentBytes += bytes;
+			to.liveAllocations++;
+			if (to.currentBytes > to.peakBytes) to.peakBytes = to.currentBytes;
+		}
+
+		Statistics GetDeviceStatistics(MemoryAccountingDevice device) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return devices[device];
+		}
+
+		Statistics GetTagStatistics(const std::string& tag) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::map<std::string, Statistics>::const_iterator it = tags.find(tag);
+			return it == tags.end() ? Statistics() : it->second;
+		}
+
+		std::vector<std::string> GetTags() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::vector<std::string> result;
+			for (std::map<std::string, Statistics>::const_iterator it = tags.begin(); it != tags.end(); ++it) result.push_back(it->first);
+			return result;
+		}
+
+		/** Reset the high-water marks and counters to the current state. Live allocations stay accounted. */
+		void ResetPeaks()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (int i = 0; i < ACCOUNTING_DEVICE_COUNT; ++i)
+			{
+				devices[i].peakBytes = devices[i].currentBytes;
+				devices[i].allocationCount = devices[i].freeCount = 0;
+			}
+			for (std::map<std::string, Statistics>::iterator it = tags.begin(); it != tags.end(); ++it)
+			{
+				it->second.peakBytes = it->second.currentBytes;
+				it->second.allocationCount = it->second.freeCount = 0;
+			}
+		}
+
+		/** Write the statistics as a tab-separated table. */
+		void PrintTable(std::ostream& os) const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			os << "name\tcurrent_bytes\tpeak_bytes\tlive\tallocations\tfrees\n";
+			for (int i = 0; i < ACCOUNTING_DEVICE_COUNT; ++i) PrintRow(os, std::string("device:") + GetDeviceName((MemoryAccountingDevice)i), devices[i]);
+			for (std::map<std::string, Statistics>::const_iterator it = tags.begin(); it != tags.end(); ++it) PrintRow(os, "tag:" + it->first, it->second);
+		}
+
+		/** Get the statistics as a JSON object with "devices" and "tags" members. */
+		std::string ToJSON() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::ostringstream os;
+
+			os << "{\"devices\": {";
+			for (int i = 0; i < ACCOUNTING_DEVICE_COUNT; ++i)
+			{
+				if (i > 0) os << ", ";
+				PrintJSON(os, GetDeviceName((MemoryAccountingDevice)i), devices[i]);
+			}
+			os << "}, \"tags\": {";
+			for (std::map<std::string, Statistics>::const_iterator it = tags.begin(); it != tags.end(); ++it)
+			{
+				if (it != tags.begin()) os << ", ";
+				PrintJSON(os, it->first, it->second);
+			}
+			os << "}}";
+
+			return os.str();
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		MemoryAccounting(const MemoryAccounting&) = delete;
+		MemoryAccounting& operator=(const MemoryAccounting&) = delete;
+	};
+}
@@ -0,0 +1,261 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <stdint.h>
+#include <sys/mman.h>
+#endif
+
+#include "PlatformIndependence.h"
+
+#ifndef COMPILE_WITHOUT_CUDA
+#include "CUDADefines.h"
+#endif
+
+namespace ORUtils
+{
+	/** Kinds of host memory that can back the CPU side of a memory block. */
+	enum MemoryAllocationKind { ALLOCATIONKIND_HOST, ALLOCATIONKIND_HOST_PINNED };
+
+	/** \brief
+	Describes how the CPU side of a memory block should be allocated.
+	*/
+	struct MemoryAllocationPolicy
+	{
+		/** Whether freed buffers are returned to the process-wide MemoryPool.
+		POOLING_DEFAULT defers to MemoryPool::IsEnabledByDefault().
+		*/
+		enum Pooling { POOLING_DEFAULT, POOLING_ENABLED, POOLING_DISABLED };
+
+		/** Pages backing the allocation. Huge pages are 2 MB and are only
+		available on Linux; elsewhere they fall back to regular pages.
+		PAGES_EXPLICIT_HUGE uses the reserved hugetlbfs pool and falls back
+		to transparent huge pages if that pool is exhausted.
+		*/
+		enum PageType { PAGES_DEFAULT, PAGES_TRANSPARENT_HUGE, PAGES_EXPLICIT_HUGE };
+
+		/** What a freshly allocated block contains. INITIALISE_CLEAR memsets
+		it, INITIALISE_NONE leaves it uninitialised and INITIALISE_ZEROED
+		obtains zero pages from the OS (calloc or anonymous mappings) and
+		only memsets memory that does not come back zeroed, such as reused
+		pool buffers or device memory.
+		*/
+		enum Initialisation { INITIALISE_CLEAR, INITIALISE_NONE, INITIALISE_ZEROED };
+
+		Pooling pooling;
+		PageType pageType;
+		Initialisation initialisation;
+
+		/** Required alignment of the data in bytes, a power of two. 0 uses the
+		system allocator's natural alignment.
+		*/
+		size_t alignment;
+
+		/** Name under which the allocation is reported to MemoryAccounting,
+		or NULL. The string is not copied and must outlive the block, so it
+		is usually a literal.
+		*/
+		const char *tag;
+
+		MemoryAllocationPolicy(Pooling pooling = POOLING_DEFAULT)
+		{
+			this->pooling = pooling;
+			this->pageType = PAGES_DEFAULT;
+			this->initialisation = INITIALISE_CLEAR;
+			this->alignment = 0;
+			this->tag = NULL;
+		}
+
+		MemoryAllocationPolicy(Initialisation initialisation)
+		{
+			this->pooling = POOLING_DEFAULT;
+			this->pageType = PAGES_DEFAULT;
+			this->initialisation = initialisation;
+			this->alignment = 0;
+			this->tag = NULL;
+		}
+
+		MemoryAllocationPolicy(size_t alignment, PageType pageType = PAGES_DEFAULT, Pooling pooling = POOLING_DEFAULT,
+			Initialisation initialisation = INITIALISE_CLEAR)
+		{
+			this->pooling = pooling;
+			this->pageType = pageType;
+			this->initialisation = initialisation;
+			this->alignment = alignment;
+			this->tag = NULL;
+		}
+
+		static MemoryAllocationPolicy Pooled() { return MemoryAllocationPolicy(POOLING_ENABLED); }
+		static MemoryAllocationPolicy Unpooled() { return MemoryAllocationPolicy(POOLING_DISABLED); }
+		static MemoryAllocationPolicy Aligned(size_t alignment) { return MemoryAllocationPolicy(alignment); }
+		static MemoryAllocationPolicy HugePages(PageType pageType = PAGES_TRANSPARENT_HUGE) { return MemoryAllocationPolicy(0, pageType); }
+		static MemoryAllocationPolicy Uninitialised() { return MemoryAllocationPolicy(INITIALISE_NONE); }
+		static MemoryAllocationPolicy Zeroed() { return MemoryAllocationPolicy(INITIALISE_ZEROED); }
+
+		/** Return a copy of this policy with the given accounting tag. */
+		MemoryAllocationPolicy Tagged(const char *tag) const
+		{
+			MemoryAllocationPolicy policy = *this;
+			policy.tag = tag;
+			return policy;
+		}
+	};
+
+	/** The system call used to obtain host memory, derived from the kind and
+	policy so that allocation and release always agree.
+	*/
+	enum HostAllocationMethod { HOSTALLOC_MALLOC, HOSTALLOC_CALLOC, HOSTALLOC_ALIGNED, HOSTALLOC_MAPPED, HOSTALLOC_HUGE_PAGES, HOSTALLOC_PINNED };
+
+	/** Size of a huge page. */
+	const size_t HUGE_PAGE_SIZE = (size_t)2 << 20;
+
+	/** Alignment the system allocator is assumed to provide without help. */
+	const size_t DEFAULT_HOST_ALIGNMENT = 16;
+
+	/** Alignment anonymous mappings are guaranteed to have. */
+	const size_t MIN_PAGE_SIZE = 4096;
+
+	/** The page type an allocation actually gets on this platform. */
+	inline MemoryAllocationPolicy::PageType EffectivePageType(const MemoryAllocationPolicy& policy)
+	{
+#ifdef __linux__
+		return policy.pageType;
+#else
+		return MemoryAllocationPolicy::PAGES_DEFAULT;
+#endif
+	}
+
+#ifdef __linux__
+	/** Map @p bytes of anonymous memory backed by huge pages, @p bytes being a
+	multiple of HUGE_PAGE_SIZE. Returns NULL on failure.
+	*/
+	inline void *MapHugePages(size_t bytes, bool explicitHugePages)
+	{
+#ifdef MAP_HUGETLB
+		if (explicitHugePages)
+		{
+			void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (ptr != MAP_FAILED) return ptr;
+		}
+#endif
+
+		// Over-allocate so that a huge page aligned range can be cut out, then
+		// give the unaligned head and tail back.
+		size_t mappedBytes = bytes + HUGE_PAGE_SIZE;
+		char *mapped = (char*)mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped == MAP_FAILED) return NULL;
+
+		char *aligned = (char*)(((uintptr_t)mapped + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+		if (aligned != mapped) munmap(mapped, aligned - mapped);
+		size_t tail = (mapped + mappedBytes) - (aligned + bytes);
+		if (tail > 0) munmap(aligned + bytes, tail);
+
+#ifdef MADV_HUGEPAGE
+		madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+		return aligned;
+	}
+#endif
+
+	inline HostAllocationMethod SelectHostAllocationMethod(MemoryAllocationKind kind, const MemoryAllocationPolicy& policy)
+	{
+		if (kind == ALLOCATIONKIND_HOST_PINNED) return HOSTALLOC_PINNED;
+		if (EffectivePageType(policy) != MemoryAllocationPolicy::PAGES_DEFAULT) return HOSTALLOC_HUGE_PAGES;
+
+		bool zeroed = policy.initialisation == MemoryAllocationPolicy::INITIALISE_ZEROED;
+		if (policy.alignment <= DEFAULT_HOST_ALIGNMENT) return zeroed ? HOSTALLOC_CALLOC : HOSTALLOC_MALLOC;
+#ifdef __linux__
+		if (zeroed && policy.alignment <= MIN_PAGE_SIZE) return HOSTALLOC_MAPPED;
+#endif
+		return HOSTALLOC_ALIGNED;
+	}
+
+	/** Allocate @p bytes of host memory of the given kind straight from the
+	system. Pinned memory is page aligned and ignores the page type. If
+	@p zeroed is given, it reports whether the memory is known to be zero.
+	*/
+	inline void *AllocateHostMemory(size_t bytes, MemoryAllocationKind kind, const MemoryAllocationPolicy& policy, bool *zeroed = NULL)
+	{
+		void *ptr = NULL;
+		bool isZeroed = false;
+
+		switch (SelectHostAllocationMethod(kind, policy))
+		{
+		case HOSTALLOC_MALLOC:
+			ptr = malloc(bytes);
+			break;
+		case HOSTALLOC_CALLOC:
+			ptr = calloc(bytes, 1);
+			isZeroed = true;
+			break;
+		case HOSTALLOC_ALIGNED:
+#ifdef _WIN32
+			ptr = _aligned_malloc(bytes, policy.alignment);
+#else
+			if (posix_memalign(&ptr, policy.alignment < sizeof(void*) ? sizeof(void*) : policy.alignment, bytes) != 0) ptr = NULL;
+#endif
+			break;
+		case HOSTALLOC_MAPPED:
+#ifdef __linux__
+			ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ptr == MAP_FAILED) ptr = NULL;
+			isZeroed = true;
+#endif
+			break;
+		case HOSTALLOC_HUGE_PAGES:
+#ifdef __linux__
+			ptr = MapHugePages((bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, policy.pageType == MemoryAllocationPolicy::PAGES_EXPLICIT_HUGE);
+			isZeroed = true;
+#endif
+			break;
+		case HOSTALLOC_PINNED:
+#ifndef COMPILE_WITHOUT_CUDA
+			ORcudaSafeCall(cudaMallocHost(&ptr, bytes));
+#endif
+			break;
+		}
+
+		if (ptr == NULL) DIEWITHEXCEPTION("Could not allocate host memory");
+		if (zeroed != NULL) *zeroed = isZeroed;
+		return ptr;
+	}
+
+	/** Return memory obtained from AllocateHostMemory to the system. */
+	inline void FreeHostMemory(void *ptr, size_t bytes, MemoryAllocationKind kind, const MemoryAllocationPolicy& policy)
+	{
+		switch (SelectHostAllocationMethod(kind, policy))
+		{
+		case HOSTALLOC_MALLOC:
+		case HOSTALLOC_CALLOC:
+			free(ptr);
+			break;
+		case HOSTALLOC_ALIGNED:
+#ifdef _WIN32
+			_aligned_free(ptr);
+#else
+			free(ptr);
+#endif
+			break;
+		case HOSTALLOC_MAPPED:
+#ifdef __linux__
+			munmap(ptr, bytes);
+#endif
+			break;
+		case HOSTALLOC_HUGE_PAGES:
+#ifdef __linux__
+			munmap(ptr, (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+#endif
+			break;
+		case HOSTALLOC_PINNED:
+#ifndef COMPILE_WITHOUT_CUDA
+			ORcudaSafeCall(cudaFreeHost(ptr));
+#endif
+			break;
+		}
+	}
+}
@@ -0,0 +1,250 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "PlatformIndependence.h"
+
+#ifndef COMPILE_WITHOUT_CUDA
+#include "CUDADefines.h"
+#endif
+
+namespace ORUtils
+{
+	/** Direction of a transfer handled by a MemoryBackend. */
+	enum MemoryTransferKind { TRANSFER_HOST_TO_DEVICE, TRANSFER_DEVICE_TO_HOST, TRANSFER_DEVICE_TO_DEVICE };
+
+	/** \brief
+	Interface to the memory behind the MEMORYDEVICE_CUDA side of memory blocks.
+
+	Blocks pick up the default backend when they allocate device memory and
+	keep using it until that memory is freed. In CUDA builds the default is
+	CudaMemoryBackend; in CPU-only builds there is no default, and device
+	allocations are skipped unless a backend such as
+	HostEmulatedMemoryBackend is installed with SetDefault().
+	*/
+	class MemoryBackend
+	{
+	private:
+		static std::atomic<MemoryBackend*>& DefaultInstance();
+
+	public:
+		virtual ~MemoryBackend() {}
+
+		virtual const char *GetName() const = 0;
+
+		virtual void *Allocate(size_t bytes) = 0;
+		virtual void Free(void *ptr, size_t bytes) = 0;
+		virtual void Memset(void *ptr, unsigned char value, size_t bytes) = 0;
+
+		/** Copy @p bytes. Asynchronous copies may return before the copy has finished. */
+		virtual void Copy(void *dst, const void *src, size_t bytes, MemoryTransferKind kind, bool async = false) = 0;
+
+		/** Copy @p height rows of @p widthBytes bytes between pitched buffers. */
+		virtual void Copy2D(void *dst, size_t dstPitchBytes, const void *src, size_t srcPitchBytes, size_t widthBytes, size_t height, MemoryTransferKind kind)
+		{
+			for (size_t y = 0; y < height; ++y)
+				Copy((char*)dst + y * dstPitchBytes, (const char*)src + y * srcPitchBytes, widthBytes, kind);
+		}
+
+		/** The backend newly allocated device memory comes from, or NULL if device memory is unavailable. */
+		static MemoryBackend *GetDefault() { return DefaultInstance().load(); }
+
+		/** Install the backend for subsequent device allocations. Blocks that
+		already hold device memory keep using the backend they allocated it with.
+		*/
+		static void SetDefault(MemoryBackend *backend) { DefaultInstance().store(backend); }
+	};
+
+#ifndef COMPILE_WITHOUT_CUDA
+	/** \brief
+	Device memory backed by the CUDA runtime.
+	*/
+	class CudaMemoryBackend : public MemoryBackend
+	{
+	public:
+		static CudaMemoryBackend& Instance()
+		{
+			static CudaMemoryBackend instance;
+			return instance;
+		}
+
+		const char *GetName() const { return "cuda"; }
+
+		void *Allocate(size_t bytes)
+		{
+			void *ptr = NULL;
+			ORcudaSafeCall(cudaMalloc(&ptr, bytes));
+			return ptr;
+		}
+
+		void Free(void *ptr, size_t bytes) { ORcudaSafeCall(cudaFree(ptr)); }
+
+		void Memset(void *ptr, unsigned char value, size_t bytes) { ORcudaSafeCall(cudaMemset(ptr, value, bytes)); }
+
+		void Copy(void *dst, const void *src, size_t bytes, MemoryTransferKind kind, bool async = false)
+		{
+			if (async) ORcudaSafeCall(cudaMemcpyAsync(dst, src, bytes, ToCudaKind(kind)));
+			else ORcudaSafeCall(cudaMemcpy(dst, src, bytes, ToCudaKind(kind)));
+		}
+
+		void Copy2D(void *dst, size_t dstPitchBytes, const void *src, size_t srcPitchBytes, size_t widthBytes, size_t height, MemoryTransferKind kind)
+		{
+			ORcudaSafeCall(cudaMemcpy2D(dst, dstPitchBytes, src, srcPitchBytes, widthBytes, height, ToCudaKind(kind)));
+		}
+
+	private:
+		static cudaMemcpyKind ToCudaKind(MemoryTransferKind kind)
+		{
+			switch (kind)
+			{
+			case TRANSFER_HOST_TO_DEVICE: return cudaMemcpyHostToDevice;
+			case TRANSFER_DEVICE_TO_HOST: return cudaMemcpyDeviceToHost;
+			default: return cudaMemcpyDeviceToDevice;
+			}
+		}
+	};
+#endif
+
+	inline std::atomic<MemoryBackend*>& MemoryBackend::DefaultInstance()
+	{
+#ifndef COMPILE_WITHOUT_CUDA
+		static std::atomic<MemoryBackend*> instance(&CudaMemoryBackend::Instance());
+#else
+		static std::atomic<MemoryBackend*> instance(NULL);
+#endif
+		return instance;
+	}
+
+	/** \brief
+	Emulates device memory with separate host allocations, so that transfer
+	heavy code can be exercised, profiled and regression tested without a GPU.
+
+	Transfers are slowed down to the configured bandwidth and latency, and
+	counted. Fresh allocations can be filled with a poison pattern so that
+	reads of device data that was never transferred stand out.
+	*/
+	class HostEmulatedMemoryBackend : public MemoryBackend
+	{
+	public:
+		/** Counters of everything the backend has done. */
+		struct Statistics
+		{
+			size_t allocations, frees, currentBytes, peakBytes;
+			size_t transfers[3], transferredBytes[3];
+			/** Time spent in transfers, including simulated delays. */
+			double transferSeconds;
+		};
+
+	private:
+		double bandwidth, latency;
+		bool poisonAllocations;
+		std::atomic<size_t> allocations, frees, currentBytes, peakBytes;
+		std::atomic<size_t> transfers[3], transferredBytes[3];
+		std::atomic<long long> transferNanoseconds;
+
+		void Wait(std::chrono::steady_clock::time_point start, size_t bytes)
+		{
+			double seconds = latency + (bandwidth > 0 ? (double)bytes / bandwidth : 0.0);
+			std::chrono::steady_clock::time_point end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+
+			// Sleep for the bulk of the delay, then spin for precision.
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (end - now > std::chrono::milliseconds(2)) std::this_thread::sleep_until(end - std::chrono::milliseconds(1));
+			while (std::chrono::steady_clock::now() < end) {}
+
+			transferNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+
+	public:
+		/** Create a backend whose transfers take @p latency seconds plus the
+		time to move the data at @p bandwidth bytes per second. A bandwidth
+		of 0 disables the bandwidth limit.
+		*/
+		HostEmulatedMemoryBackend(double bandwidth = 12e9, double latency = 10e-6, bool poisonAllocations = true)
+		{
+			this->bandwidth = bandwidth;
+			this->latency = latency;
+			this->poisonAllocations = poisonAllocations;
+			currentBytes = 0;
+			ResetStatistics();
+		}
+
+		const char *GetName() const { return "host_emulated"; }
+
+		void SetBandwidth(double bandwidth) { this->bandwidth = bandwidth; }
+		void SetLatency(double latency) { this->latency = latency; }
+		double GetBandwidth() const { return bandwidth; }
+		double GetLatency() const { return latency; }
+
+		void *Allocate(size_t bytes)
+		{
+			void *ptr = malloc(bytes);
+			if (ptr == NULL) DIEWITHEXCEPTION("Could not allocate emulated device memory");
+			if (poisonAllocations) memset(ptr, 0xCD, bytes);
+
+			allocations++;
+			size_t current = currentBytes += bytes;
+			size_t peak = peakBytes.load();
+			while (current > peak && !peakBytes.compare_exchange_weak(peak, current)) {}
+			return ptr;
+		}
+
+		void Free(void *ptr, size_t bytes)
+		{
+			free(ptr);
+			frees++;
+			currentBytes -= bytes;
+		}
+
+		void Memset(void *ptr, unsigned char value, size_t bytes) { memset(ptr, value, bytes); }
+
+		/** Copies are always synchronous: there is no later synchronisation
+		point at which the delay of an asynchronous copy could be paid, so
+		every copy waits for its simulated transfer before returning.
+		*/
+		void Copy(void *dst, const void *src, size_t bytes, MemoryTransferKind kind, bool /*async*/ = false)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			memcpy(dst, src, bytes);
+			transfers[kind]++;
+			transferredBytes[kind] += bytes;
+			Wait(start, bytes);
+		}
+
+		void Copy2D(void *dst, size_t dstPitchBytes, const void *src, size_t srcPitchBytes, size_t widthBytes, size_t height, MemoryTransferKind kind)
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t y = 0; y < height; ++y)
+				memcpy((char*)dst + y * dstPitchBytes, (const char*)src + y * srcPitchBytes, widthBytes);
+			transfers[kind]++;
+			transferredBytes[kind] += widthBytes * height;
+			Wait(start, widthBytes * height);
+		}
+
+		Statistics GetStatistics() const
+		{
+			Statistics statistics;
+			statistics.allocations = allocations; statistics.frees = frees;
+			statistics.currentBytes = currentBytes; statistics.peakBytes = peakBytes;
+			for (int i = 0; i < 3; ++i) { statistics.transfers[i] = transfers[i]; statistics.transferredBytes[i] = transferredBytes[i]; }
+			statistics.transferSeconds = transferNanoseconds * 1e-9;
+			return statistics;
+		}
+
+		/** Reset the counters; currentBytes keeps reflecting live allocations. */
+		void ResetStatistics()
+		{
+			allocations = 0; frees = 0;
+			peakBytes = currentBytes.load();
+			for (int i = 0; i < 3; ++i) { transfers[i] = 0; transferredBytes[i] = 0; }
+			transferNanoseconds = 0;
+		}
+	};
+}
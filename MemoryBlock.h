@@ -17,6 +17,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <utility>
+#include <vector>
+
+#include "CoherenceTracker.h"
+#include "MemoryAccounting.h"
+#include "MemoryBackend.h"
+#include "MemoryPool.h"
+#include "ParallelMemory.h"
+
 #endif
 
 #ifndef MEMORY_DEVICE_TYPE
@@ -35,6 +44,79 @@ namespace ORUtils
 	protected:
 #ifndef __METALC__
 		bool isAllocated_CPU, isAllocated_CUDA, isMetalCompatible;
+
+		/** Whether the CPU data was taken from the MemoryPool. */
+		bool isPooled_CPU;
+
+		/** Whether the CPU data is known to be zero since it was allocated. */
+		bool isZeroed_CPU;
+
+		/** Whether the CPU data belongs to someone else, such as a file
+		mapping held by a derived class, and must not be released by Free.
+		*/
+		bool isExternal_CPU;
+
+		/** Whether the CPU and CUDA allocations were reported to MemoryAccounting. */
+		bool isAccounted_CPU, isAccounted_CUDA;
+
+		/** Which copy was written last, if coherence tracking is enabled. */
+		mutable CoherenceTracker coherence;
+
+		/** Backend the device data was allocated from, NULL if there is none. */
+		MemoryBackend *deviceBackend;
+
+		/** Policy the CPU data is allocated with. */
+		MemoryAllocationPolicy allocationPolicy;
+
+		/** Number of entries the current allocation can hold, at least dataSize. */
+		size_t capacity;
+
+		/** Bring the copy that is not on @p source up to date, transferring
+		only what the coherence tracker reports as modified.
+		*/
+		void Synchronise(MemoryDeviceType source) const
+		{
+			size_t totalBytes = dataSize * sizeof(T);
+			MemoryTransferCounters& counters = MemoryTransferCounters::Instance();
+
+			std::vector<CoherenceTracker::Range> ranges;
+			if (!coherence.IsEnabled()) ranges.push_back(CoherenceTracker::Range(0, totalBytes));
+			else if (!coherence.GetTransferRanges(source, totalBytes, ranges))
+			{
+				counters.avoidedBytes += totalBytes;
+				counters.skippedTransfers++;
+				return;
+			}
+
+			size_t movedBytes = 0;
+			for (size_t i = 0; i < ranges.size(); ++i)
+			{
+				size_t offset = ranges[i].first, length = ranges[i].second - ranges[i].first;
+				if (source == MEMORYDEVICE_CPU)
+					deviceBackend->Copy((char*)data_cuda + offset, (const char*)data_cpu + offset, length, TRANSFER_HOST_TO_DEVICE);
+				else
+					deviceBackend->Copy((char*)data_cpu + offset, (const char*)data_cuda + offset, length, TRANSFER_DEVICE_TO_HOST);
+				movedBytes += length;
+			}
+
+			if (source == MEMORYDEVICE_CPU) counters.hostToDeviceBytes += movedBytes;
+			else counters.deviceToHostBytes += movedBytes;
+			counters.avoidedBytes += totalBytes - movedBytes;
+			counters.transfers++;
+
+			coherence.MarkCoherent();
+		}
+
+		/** Kind of memory MemoryAccounting files a CPU allocation of the given type under. */
+		static MemoryAccountingDevice AccountingDevice_CPU(int allocType)
+		{
+			switch (allocType)
+			{
+			case 1: return ACCOUNTING_HOST_PINNED;
+			case 2: return ACCOUNTING_HOST_METAL;
+			default: return ACCOUNTING_HOST;
+			}
+		}
 #endif
 		/** Pointer to memory on CPU host. */
 		DEVICEPTR(T)* data_cpu;
@@ -55,9 +137,14 @@ namespace ORUtils
 		/** Total number of allocated entries in the data array. */
 		size_t dataSize;
 
-		/** Get the data pointer on CPU or GPU. */
+		/** Get the data pointer on CPU or GPU. If coherence tracking
+		is enabled, the copy on that device is assumed to be modified.
+		*/
 		inline DEVICEPTR(T)* GetData(MemoryDeviceType memoryType)
 		{
+#ifndef __METALC__
+			if (coherence.IsEnabled()) coherence.MarkModified(memoryType);
+#endif
 			switch (memoryType)
 			{
 			case MEMORYDEVICE_CPU: return data_cpu;
@@ -85,29 +172,90 @@ namespace ORUtils
 		inline const void *GetMetalBuffer() const { return data_metalBuffer; }
 #endif
 
+		/** Get a writable data pointer on CPU or GPU without marking that
+		copy as modified. Callers must report what they write through
+		MarkModified for coherence tracking to stay correct.
+		*/
+		inline T *GetDataUntracked(MemoryDeviceType memoryType)
+		{
+			return const_cast<T*>(static_cast<const MemoryBlock<T>*>(this)->GetData(memoryType));
+		}
+
+		/** Enable or disable tracking of which copy, host or device, was
+		written last. While enabled, UpdateDeviceFromHost and
+		UpdateHostFromDevice only transfer data if the source copy was
+		modified since the last synchronisation. With @p dirtyPageBytes > 0,
+		ranges reported through MarkModified are tracked per page of that
+		size and only the modified pages are transferred.
+		*/
+		void SetCoherenceTracking(bool enabled, size_t dirtyPageBytes = 0) { coherence.SetEnabled(enabled, dirtyPageBytes); }
+
+		inline bool IsCoherenceTracked() const { return coherence.IsEnabled(); }
+		inline CoherenceTracker::State GetCoherenceState() const { return coherence.GetState(); }
+
+		/** Report that the whole copy on the given device was written. */
+		void MarkModified(MemoryDeviceType memoryType)
+		{
+			if (coherence.IsEnabled()) coherence.MarkModified(memoryType);
+		}
+
+		/** Report that entries [@p begin, @p end) of the copy on the given device were written. */
+		void MarkModified(MemoryDeviceType memoryType, size_t begin, size_t end)
+		{
+			if (coherence.IsEnabled()) coherence.MarkModified(memoryType, begin * sizeof(T), end * sizeof(T), dataSize * sizeof(T));
+		}
+
+		/** Get the policy the CPU data is allocated with. */
+		inline const MemoryAllocationPolicy& GetAllocationPolicy() const { return allocationPolicy; }
+
+		/** Get the number of entries the block can hold without reallocating. */
+		inline size_t GetCapacity() const { return capacity; }
+
+		/** Get the backend the device data was allocated from, NULL if there is no device data. */
+		inline MemoryBackend *GetDeviceBackend() const { return deviceBackend; }
+
 		/** Initialize an empty memory block of the given size,
 		on CPU only or GPU only or on both. CPU might also use the
-		Metal compatible allocator (i.e. with 16384 alignment).
+		Metal compatible allocator (i.e. with 16384 alignment),
+		otherwise it is allocated according to @p policy, which selects
+		pooling, alignment and page type.
 		*/
-		MemoryBlock(size_t dataSize, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true)
+		MemoryBlock(size_t dataSize, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
 		{
 			this->isAllocated_CPU = false;
 			this->isAllocated_CUDA = false;
 			this->isMetalCompatible = false;
+			this->isPooled_CPU = false;
+			this->isZeroed_CPU = false;
+			this->isExternal_CPU = false;
+			this->isAccounted_CPU = false;
+			this->isAccounted_CUDA = false;
+			this->deviceBackend = NULL;
+			this->allocationPolicy = policy;
+			this->capacity = 0;
 
 			Allocate(dataSize, allocate_CPU, allocate_CUDA, metalCompatible);
-			Clear();
+			InitialiseData();
 		}
 
 		/** Initialize an empty memory block of the given size, either
 		on CPU only or on GPU only. CPU will be Metal compatible if Metal
-		is enabled.
+		is enabled, otherwise it is allocated according to @p policy.
 		*/
-		MemoryBlock(size_t dataSize, MemoryDeviceType memoryType)
+		MemoryBlock(size_t dataSize, MemoryDeviceType memoryType, const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
 		{
 			this->isAllocated_CPU = false;
 			this->isAllocated_CUDA = false;
 			this->isMetalCompatible = false;
+			this->isPooled_CPU = false;
+			this->isZeroed_CPU = false;
+			this->isExternal_CPU = false;
+			this->isAccounted_CPU = false;
+			this->isAccounted_CUDA = false;
+			this->deviceBackend = NULL;
+			this->allocationPolicy = policy;
+			this->capacity = 0;
 
 			switch (memoryType)
 			{
@@ -115,66 +263,119 @@ namespace ORUtils
 			case MEMORYDEVICE_CUDA: Allocate(dataSize, false, true, true); break;
 			}
 
-			Clear();
+			InitialiseData();
 		}
 
-		/** Set all image data to the given @p defaultValue. */
+		/** Set all image data to the given @p defaultValue. Large CPU
+		blocks are cleared in parallel, see ParallelMemoryConfig.
+		*/
 		void Clear(unsigned char defaultValue = 0)
 		{
-			if (isAllocated_CPU) memset(data_cpu, defaultValue, dataSize * sizeof(T));
-#ifndef COMPILE_WITHOUT_CUDA
-			if (isAllocated_CUDA) ORcudaSafeCall(cudaMemset(data_cuda, defaultValue, dataSize * sizeof(T)));
-#endif
+			if (isAllocated_CPU) ParallelMemset(data_cpu, defaultValue, dataSize * sizeof(T));
+			if (isAllocated_CUDA) deviceBackend->Memset(data_cuda, defaultValue, dataSize * sizeof(T));
+			coherence.MarkCoherent();
+		}
+
+		/** Bring freshly allocated data into the state requested by the
+		allocation policy's initialisation mode.
+		*/
+		void InitialiseData()
+		{
+			switch (allocationPolicy.initialisation)
+			{
+			case MemoryAllocationPolicy::INITIALISE_CLEAR:
+				Clear();
+				break;
+			case MemoryAllocationPolicy::INITIALISE_ZEROED:
+				if (isAllocated_CPU && !isZeroed_CPU) ParallelMemset(data_cpu, 0, dataSize * sizeof(T));
+				if (isAllocated_CUDA) deviceBackend->Memset(data_cuda, 0, dataSize * sizeof(T));
+				break;
+			case MemoryAllocationPolicy::INITIALISE_NONE:
+				break;
+			}
+
+			// Once handed out, the data can no longer be assumed to be zero.
+			isZeroed_CPU = false;
+			coherence.MarkCoherent();
 		}
 
-		/** Transfer data from CPU to GPU, if possible. */
+		/** Bring the data into the state requested by the allocation policy
+		after a change of dimensions. Only INITIALISE_ZEROED zeroes it;
+		otherwise the contents are undefined, so that callers that overwrite
+		the whole block do not pay for a memset on every resize.
+		*/
+		void InitialiseResizedData()
+		{
+			if (allocationPolicy.initialisation == MemoryAllocationPolicy::INITIALISE_ZEROED) InitialiseData();
+			else
+			{
+				isZeroed_CPU = false;
+				coherence.MarkCoherent();
+			}
+		}
+
+		/** Transfer data from CPU to GPU, if possible. With coherence
+		tracking, only data modified on the CPU is transferred.
+		*/
 		void UpdateDeviceFromHost() const {
-#ifndef COMPILE_WITHOUT_CUDA
-			if (isAllocated_CUDA && isAllocated_CPU)
-				ORcudaSafeCall(cudaMemcpy(data_cuda, data_cpu, dataSize * sizeof(T), cudaMemcpyHostToDevice));
-#endif
+			if (isAllocated_CUDA && isAllocated_CPU) Synchronise(MEMORYDEVICE_CPU);
 		}
-		/** Transfer data from GPU to CPU, if possible. */
+		/** Transfer data from GPU to CPU, if possible. With coherence
+		tracking, only data modified on the GPU is transferred.
+		*/
 		void UpdateHostFromDevice() const {
-#ifndef COMPILE_WITHOUT_CUDA
-			if (isAllocated_CUDA && isAllocated_CPU)
-				ORcudaSafeCall(cudaMemcpy(data_cpu, data_cuda, dataSize * sizeof(T), cudaMemcpyDeviceToHost));
-#endif
+			if (isAllocated_CUDA && isAllocated_CPU) Synchronise(MEMORYDEVICE_CUDA);
 		}
 
-		/** Copy data */
+		/** Copy data. Large CPU to CPU copies run in parallel, see
+		ParallelMemoryConfig; device copies go through the device backend.
+		*/
 		void SetFrom(const MemoryBlock<T> *source, MemoryCopyDirection memoryCopyDirection)
 		{
 			switch (memoryCopyDirection)
 			{
 			case CPU_TO_CPU:
-				memcpy(this->data_cpu, source->data_cpu, source->dataSize * sizeof(T));
+				ParallelMemcpy(this->data_cpu, source->data_cpu, source->dataSize * sizeof(T));
 				break;
-#ifndef COMPILE_WITHOUT_CUDA
 			case CPU_TO_CUDA:
-				ORcudaSafeCall(cudaMemcpyAsync(this->data_cuda, source->data_cpu, source->dataSize * sizeof(T), cudaMemcpyHostToDevice));
+				if (this->deviceBackend == NULL) return;
+				this->deviceBackend->Copy(this->data_cuda, source->data_cpu, source->dataSize * sizeof(T), TRANSFER_HOST_TO_DEVICE, true);
 				break;
 			case CUDA_TO_CPU:
-				ORcudaSafeCall(cudaMemcpy(this->data_cpu, source->data_cuda, source->dataSize * sizeof(T), cudaMemcpyDeviceToHost));
+				if (source->deviceBackend == NULL) return;
+				source->deviceBackend->Copy(this->data_cpu, source->data_cuda, source->dataSize * sizeof(T), TRANSFER_DEVICE_TO_HOST);
 				break;
 			case CUDA_TO_CUDA:
-				ORcudaSafeCall(cudaMemcpyAsync(this->data_cuda, source->data_cuda, source->dataSize * sizeof(T), cudaMemcpyDeviceToDevice));
+				if (this->deviceBackend == NULL) return;
+				this->deviceBackend->Copy(this->data_cuda, source->data_cuda, source->dataSize * sizeof(T), TRANSFER_DEVICE_TO_DEVICE, true);
 				break;
-#endif
+			}
+
+			switch (memoryCopyDirection)
+			{
+			case CPU_TO_CUDA: MemoryTransferCounters::Instance().hostToDeviceBytes += source->dataSize * sizeof(T); break;
+			case CUDA_TO_CPU: MemoryTransferCounters::Instance().deviceToHostBytes += source->dataSize * sizeof(T); break;
+			case CUDA_TO_CUDA: MemoryTransferCounters::Instance().deviceToDeviceBytes += source->dataSize * sizeof(T); break;
 			default: break;
 			}
+
+			if (coherence.IsEnabled())
+				coherence.MarkModified(memoryCopyDirection == CPU_TO_CPU || memoryCopyDirection == CUDA_TO_CPU ? MEMORYDEVICE_CPU : MEMORYDEVICE_CUDA);
 		}
 
 		virtual ~MemoryBlock() { this->Free(); }
 
 		/** Allocate image data of the specified size. If the
-		data has been allocated before, the data is freed.
+		data has been allocated before, the data is freed. The
+		CPU side follows the block's allocation policy.
 		*/
 		void Allocate(size_t dataSize, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible)
 		{
 			Free();
 
 			this->dataSize = dataSize;
+			this->capacity = dataSize;
+			coherence.MarkCoherent();
 			if (dataSize == 0) return;
 
 			if (allocate_CPU)
@@ -190,35 +391,87 @@ namespace ORUtils
 				switch (allocType)
 				{
 				case 0:
-					data_cpu = new T[dataSize];
-					break;
 				case 1:
-#ifndef COMPILE_WITHOUT_CUDA
-					ORcudaSafeCall(cudaMallocHost((void**)&data_cpu, dataSize * sizeof(T)));
-#endif
+				{
+					MemoryAllocationKind kind = allocType == 1 ? ALLOCATIONKIND_HOST_PINNED : ALLOCATIONKIND_HOST;
+					if (MemoryPool::Instance().ShouldPool(allocationPolicy))
+					{
+						data_cpu = (T*)MemoryPool::Instance().Acquire(dataSize * sizeof(T), kind, allocationPolicy, &isZeroed_CPU);
+						isPooled_CPU = true;
+					}
+					else data_cpu = (T*)AllocateHostMemory(dataSize * sizeof(T), kind, allocationPolicy, &isZeroed_CPU);
 					break;
+				}
 				case 2:
 #ifdef COMPILE_WITH_METAL
 					allocateMetalData((void**)&data_cpu, (void**)&data_metalBuffer, dataSize * sizeof(T), true);
+					isZeroed_CPU = true;
 #endif
 					break;
 				}
 
 				this->isAllocated_CPU = allocate_CPU;
 				this->isMetalCompatible = metalCompatible;
+				this->isAccounted_CPU = MemoryAccounting::Instance().RecordAllocation(AccountingDevice_CPU(allocType), allocationPolicy.tag, dataSize * sizeof(T));
 			}
 
 			if (allocate_CUDA)
 			{
-#ifndef COMPILE_WITHOUT_CUDA
-				ORcudaSafeCall(cudaMalloc((void**)&data_cuda, dataSize * sizeof(T)));
-				this->isAllocated_CUDA = allocate_CUDA;
-#endif
+				this->deviceBackend = MemoryBackend::GetDefault();
+				if (deviceBackend != NULL)
+				{
+					data_cuda = (T*)deviceBackend->Allocate(dataSize * sizeof(T));
+					this->isAllocated_CUDA = allocate_CUDA;
+					this->isAccounted_CUDA = MemoryAccounting::Instance().RecordAllocation(ACCOUNTING_CUDA, allocationPolicy.tag, dataSize * sizeof(T));
+				}
 			}
 		}
 
+		/** Change the tag under which the block is reported to MemoryAccounting. */
+		void SetTag(const char *tag)
+		{
+			if (isAccounted_CPU) MemoryAccounting::Instance().RecordRetag(allocationPolicy.tag, tag, capacity * sizeof(T));
+			if (isAccounted_CUDA) MemoryAccounting::Instance().RecordRetag(allocationPolicy.tag, tag, capacity * sizeof(T));
+			allocationPolicy.tag = tag;
+		}
+
+		/** Change the number of entries in the block. Sizes within the
+		current capacity only update dataSize and keep the data; larger
+		sizes reallocate on the same devices and lose the old data.
+		*/
+		void Resize(size_t newSize)
+		{
+			if (newSize <= capacity)
+			{
+				this->dataSize = newSize;
+				return;
+			}
+
+			Allocate(newSize, isAllocated_CPU, isAllocated_CUDA, isMetalCompatible);
+		}
+
+		/** Make sure the block can hold at least @p newCapacity entries
+		without reallocating. If it has to grow, the block is reallocated on
+		the same devices and the old data is lost; dataSize is unchanged.
+		*/
+		void Reserve(size_t newCapacity)
+		{
+			if (newCapacity <= capacity) return;
+
+			size_t size = dataSize;
+			Allocate(newCapacity, isAllocated_CPU, isAllocated_CUDA, isMetalCompatible);
+			this->dataSize = size;
+		}
+
 		void Free()
 		{
+			if (isAllocated_CPU && isExternal_CPU)
+			{
+				// The owner releases the data, the block only forgets about it.
+				isAllocated_CPU = false;
+				isExternal_CPU = false;
+			}
+
 			if (isAllocated_CPU)
 			{
 				int allocType = 0;
@@ -229,39 +482,108 @@ namespace ORUtils
 #ifdef COMPILE_WITH_METAL
 				if (isMetalCompatible) allocType = 2;
 #endif
+				if (isAccounted_CPU) MemoryAccounting::Instance().RecordFree(AccountingDevice_CPU(allocType), allocationPolicy.tag, capacity * sizeof(T));
+				isAccounted_CPU = false;
+
 				switch (allocType)
 				{
 				case 0:
-					delete[] data_cpu;
-					break;
 				case 1:
-#ifndef COMPILE_WITHOUT_CUDA
-					ORcudaSafeCall(cudaFreeHost(data_cpu));
-#endif
+				{
+					MemoryAllocationKind kind = allocType == 1 ? ALLOCATIONKIND_HOST_PINNED : ALLOCATIONKIND_HOST;
+					if (isPooled_CPU) MemoryPool::Instance().Release(data_cpu, capacity * sizeof(T), kind, allocationPolicy);
+					else FreeHostMemory(data_cpu, capacity * sizeof(T), kind, allocationPolicy);
+					isPooled_CPU = false;
 					break;
+				}
 				case 2:
 #ifdef COMPILE_WITH_METAL
-					freeMetalData((void**)&data_cpu, (void**)&data_metalBuffer, dataSize * sizeof(T), true);
+					freeMetalData((void**)&data_cpu, (void**)&data_metalBuffer, capacity * sizeof(T), true);
 #endif
 					break;
 				}
 
 				isMetalCompatible = false;
 				isAllocated_CPU = false;
+				isZeroed_CPU = false;
 			}
 
 			if (isAllocated_CUDA)
 			{
-#ifndef COMPILE_WITHOUT_CUDA
-				ORcudaSafeCall(cudaFree(data_cuda));
-#endif
+				deviceBackend->Free(data_cuda, capacity * sizeof(T));
+				deviceBackend = NULL;
+				if (isAccounted_CUDA) MemoryAccounting::Instance().RecordFree(ACCOUNTING_CUDA, allocationPolicy.tag, capacity * sizeof(T));
+				isAccounted_CUDA = false;
 				isAllocated_CUDA = false;
 			}
 		}
 
+		/** Take over the data of @p other, leaving it empty. */
+		MemoryBlock(MemoryBlock&& other) noexcept
+		{
+			this->isAllocated_CPU = false;
+			this->isAllocated_CUDA = false;
+			this->isMetalCompatible = false;
+			this->isPooled_CPU = false;
+			this->isZeroed_CPU = false;
+			this->isExternal_CPU = false;
+			this->isAccounted_CPU = false;
+			this->isAccounted_CUDA = false;
+			this->deviceBackend = NULL;
+			this->data_cpu = NULL;
+			this->data_cuda = NULL;
+#ifdef COMPILE_WITH_METAL
+			this->data_metalBuffer = NULL;
+#endif
+			this->dataSize = 0;
+			this->capacity = 0;
+
+			Swap(other);
+		}
+
+		/** Release the current data and take over the data of @p other, leaving it empty. */
+		MemoryBlock& operator=(MemoryBlock&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Free();
+				this->data_cpu = NULL;
+				this->data_cuda = NULL;
+				this->dataSize = 0;
+				this->capacity = 0;
+				Swap(other);
+			}
+			return *this;
+		}
+
+		/** Exchange the contents of two blocks, including their CPU, CUDA
+		and Metal pointers and allocation policies, without copying data.
+		*/
+		void Swap(MemoryBlock& other) noexcept
+		{
+			std::swap(isAllocated_CPU, other.isAllocated_CPU);
+			std::swap(isAllocated_CUDA, other.isAllocated_CUDA);
+			std::swap(isMetalCompatible, other.isMetalCompatible);
+			std::swap(isPooled_CPU, other.isPooled_CPU);
+			std::swap(isZeroed_CPU, other.isZeroed_CPU);
+			std::swap(isExternal_CPU, other.isExternal_CPU);
+			std::swap(isAccounted_CPU, other.isAccounted_CPU);
+			std::swap(isAccounted_CUDA, other.isAccounted_CUDA);
+			std::swap(deviceBackend, other.deviceBackend);
+			std::swap(allocationPolicy, other.allocationPolicy);
+			std::swap(data_cpu, other.data_cpu);
+			std::swap(data_cuda, other.data_cuda);
+#ifdef COMPILE_WITH_METAL
+			std::swap(data_metalBuffer, other.data_metalBuffer);
+#endif
+			std::swap(dataSize, other.dataSize);
+			std::swap(capacity, other.capacity);
+			coherence.Swap(other.coherence);
+		}
+
 		// Suppress the default copy constructor and assignment operator
-		MemoryBlock(const MemoryBlock&);
-		MemoryBlock& operator=(const MemoryBlock&);
+		MemoryBlock(const MemoryBlock&) = delete;
+		MemoryBlock& operator=(const MemoryBlock&) = delete;
 #endif
 	};
 }
@@ -0,0 +1,434 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MappedMemoryBlock.h"
+#include "MemoryBlock.h"
+#include "MemoryBlockFormat.h"
+#include "PositionedFile.h"
+
+namespace ORUtils
+{
+
+/**
+ * \brief The 64-byte header at the start of a memory block archive.
+ *
+ * An archive is this header, followed by the entries and then the table of contents. Each entry is a block in the
+ * format written by MemoryBlockPersister, starting at a position aligned like its payload. The table of contents
+ * holds, for each entry, its offset, a copy of its MemoryBlockFileHeader and its name.
+ */
+struct MemoryBlockArchiveHeader
+{
+  /** "ORMA". */
+  char magic[4];
+
+  /** The format version. */
+  uint16_t version;
+
+  /** The size of this header in bytes. */
+  uint16_t headerSize;
+
+  /** The number of entries in the archive. */
+  uint64_t entryCount;
+
+  /** The offset of the table of contents from the start of the file. */
+  uint64_t tocOffset;
+
+  /** The size of the table of contents in bytes. */
+  uint64_t tocBytes;
+
+  /** FastHash64 of the table of contents. */
+  uint64_t tocChecksum;
+
+  /** Reserved for future use, zero. */
+  uint8_t reserved[24];
+};
+
+/**
+ * \brief This class writes many named memory blocks into a single archive file.
+ *
+ * Blocks are written as they are added. The table of contents is written by Close, which the destructor calls if
+ * necessary; an archive that was never closed cannot be read.
+ */
+class MemoryBlockArchiveWriter
+{
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** The archive file. */
+  PositionedFile m_file;
+
+  /** Whether the table of contents has been written. */
+  bool m_closed;
+
+  /** The offset at which the next entry can start. */
+  uint64_t m_end;
+
+  /** The names of the entries written so far. */
+  std::map<std::string,bool> m_names;
+
+  /** The save options for the entries. */
+  MemoryBlockSaveOptions m_options;
+
+  /** The serialised table of contents. */
+  std::vector<char> m_toc;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Creates an archive, replacing any existing file with the same name.
+   *
+   * \param filename  The name of the archive file.
+   * \param options   Whether to store checksums, and how to align the entries' data in the file.
+   */
+  explicit MemoryBlockArchiveWriter(const std::string& filename, const MemoryBlockSaveOptions& options = MemoryBlockSaveOptions())
+  : m_file(filename, PositionedFile::OPEN_CREATE), m_closed(false), m_end(sizeof(MemoryBlockArchiveHeader)), m_options(options)
+  {}
+
+  //#################### DESTRUCTOR ####################
+public:
+  ~MemoryBlockArchiveWriter()
+  {
+    try { Close(); }
+    catch(...) {}
+  }
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Writes a memory block to the archive.
+   *
+   * \param name              The name of the entry, which must be unique within the archive.
+   * \param block             The memory block to write.
+   * \param memoryDeviceType  The type of memory device from which to write the data.
+   * \throws std::runtime_error If the name is already in use, the archive is closed or the write is unsuccessful.
+   */
+  template <typename T>
+  void AddMemoryBlock(const std::string& name, const ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType)
+  {
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we are saving the memory block from the GPU, first make a CPU copy of it.
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      cpuBlock.SetFrom(&block, ORUtils::MemoryBlock<T>::CUDA_TO_CPU);
+      AddEntry(name, cpuBlock.GetData(MEMORYDEVICE_CPU), cpuBlock.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value());
+    }
+    else
+    {
+      AddEntry(name, block.GetData(MEMORYDEVICE_CPU), block.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value());
+    }
+  }
+
+  /**
+   * \brief Writes the table of contents and finishes the archive. Further calls have no effect.
+   *
+   * \throws std::runtime_error If the write is unsuccessful.
+   */
+  void Close()
+  {
+    if(m_closed) return;
+    m_closed = true;
+
+    MemoryBlockArchiveHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "ORMA", 4);
+    header.version = 1;
+    header.headerSize = sizeof(MemoryBlockArchiveHeader);
+    header.entryCount = m_names.size();
+    header.tocOffset = m_end;
+    header.tocBytes = m_toc.size();
+    header.tocChecksum = FastHash64(m_toc.empty() ? NULL : &m_toc[0], m_toc.size());
+
+    if(!m_toc.empty()) m_file.Write(&m_toc[0], m_toc.size(), header.tocOffset);
+    m_file.Write(&header, sizeof(header), 0);
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Writes an entry to the archive and records it in the table of contents.
+   *
+   * \param name          The name of the entry.
+   * \param data          The entry's elements.
+   * \param elementCount  The number of elements.
+   * \param elementSize   The size of an element in bytes.
+   * \param typeTag       The element type tag.
+   */
+  void AddEntry(const std::string& name, const void *data, size_t elementCount, size_t elementSize, uint32_t typeTag)
+  {
+    if(m_closed) throw std::runtime_error("Cannot add " + name + " to an archive that has been closed");
+    if(m_names.find(name) != m_names.end()) throw std::runtime_error("The archive already contains an entry called " + name);
+
+    std::vector<char> buffer;
+    MemoryBlockFileHeader header;
+    const void *payload = PrepareMemoryBlockPayload(data, elementCount, (uint32_t)elementSize, typeTag, m_options, buffer, header);
+
+    // Start the entry at a position aligned like the payload offset, so that the payload is aligned within the file.
+    uint64_t offset = (m_end + header.payloadAlignment - 1) / header.payloadAlignment * header.payloadAlignment;
+    m_file.Write(&header, sizeof(header), offset);
+    if(header.payloadBytes > 0) m_file.Write(payload, (size_t)header.payloadBytes, offset + header.payloadOffset);
+    m_end = offset + header.payloadOffset + header.payloadBytes;
+    m_names[name] = true;
+
+    uint32_t nameLength = (uint32_t)name.size();
+    AppendToc(&offset, sizeof(offset));
+    AppendToc(&header, sizeof(header));
+    AppendToc(&nameLength, sizeof(nameLength));
+    AppendToc(name.data(), nameLength);
+  }
+
+  /**
+   * \brief Appends raw bytes to the table of contents.
+   */
+  void AppendToc(const void *data, size_t bytes)
+  {
+    const char *p = reinterpret_cast<const char *>(data);
+    m_toc.insert(m_toc.end(), p, p + bytes);
+  }
+};
+
+/**
+ * \brief This class provides random access to the memory blocks in an archive written by MemoryBlockArchiveWriter.
+ *
+ * The table of contents is read when the archive is opened, so any entry can be loaded without scanning the file.
+ * Entries are read with positioned reads, and the loading functions may be called from several threads at once to
+ * load independent entries in parallel.
+ */
+class MemoryBlockArchiveReader
+{
+  //#################### NESTED TYPES ####################
+public:
+  /**
+   * \brief An entry in the table of contents.
+   */
+  struct Entry
+  {
+    /** The name of the entry. */
+    std::string name;
+
+    /** The offset of the entry from the start of the file. */
+    uint64_t offset;
+
+    /** The entry's header. Its payload offset is relative to the start of the entry. */
+    MemoryBlockFileHeader header;
+  };
+
+  //#################### PRIVATE VARIABLES ####################
+private:
+  /** The entries in the order in which they were written. */
+  std::vector<Entry> m_entries;
+
+  /** The archive file. */
+  PositionedFile m_file;
+
+  /** A map from entry names to indices in m_entries. */
+  std::map<std::string,size_t> m_index;
+
+  //#################### CONSTRUCTORS ####################
+public:
+  /**
+   * \brief Opens an archive and reads its table of contents.
+   *
+   * \param filename            The name of the archive file.
+   * \throws std::runtime_error If the file is not a complete archive.
+   */
+  explicit MemoryBlockArchiveReader(const std::string& filename)
+  : m_file(filename, PositionedFile::OPEN_READ)
+  {
+    uint64_t length = m_file.GetSize();
+
+    MemoryBlockArchiveHeader header;
+    if(length < sizeof(header)) throw std::runtime_error(filename + " is not a memory block archive");
+    m_file.Read(&header, sizeof(header), 0);
+    if(memcmp(header.magic, "ORMA", 4) != 0) throw std::runtime_error(filename + " is not a memory block archive");
+    if(header.version != 1) throw std::runtime_error(filename + " has an unsupported archive version");
+    if(header.tocOffset > length || header.tocBytes > length - header.tocOffset)
+    {
+      throw std::runtime_error(filename + " is truncated");
+    }
+
+    std::vector<char> toc((size_t)header.tocBytes);
+    if(!toc.empty()) m_file.Read(&toc[0], toc.size(), header.tocOffset);
+    if(FastHash64(toc.empty() ? NULL : &toc[0], toc.size()) != header.tocChecksum)
+    {
+      throw std::runtime_error("The table of contents of " + filename + " is corrupt");
+    }
+
+    size_t pos = 0;
+    for(uint64_t i = 0; i < header.entryCount; ++i)
+    {
+      Entry entry;
+      uint32_t nameLength;
+      ReadToc(toc, pos, &entry.offset, sizeof(entry.offset));
+      ReadToc(toc, pos, &entry.header, sizeof(entry.header));
+      ReadToc(toc, pos, &nameLength, sizeof(nameLength));
+      if(nameLength > toc.size() - pos) throw std::runtime_error("The table of contents of " + filename + " is corrupt");
+      entry.name.assign(&toc[0] + pos, nameLength);
+      pos += nameLength;
+
+      m_index[entry.name] = m_entries.size();
+      m_entries.push_back(entry);
+    }
+  }
+
+  //#################### PUBLIC MEMBER FUNCTIONS ####################
+public:
+  /**
+   * \brief Gets whether the archive contains an entry with the specified name.
+   */
+  bool Contains(const std::string& name) const
+  {
+    return m_index.find(name) != m_index.end();
+  }
+
+  /**
+   * \brief Gets the entries in the archive, in the order in which they were written.
+   */
+  const std::vector<Entry>& GetEntries() const
+  {
+    return m_entries;
+  }
+
+  /**
+   * \brief Gets the description of the block stored in the specified entry.
+   *
+   * \param name                The name of the entry.
+   * \return                    The description of the block, with its payload offset relative to the start of the file.
+   * \throws std::runtime_error If there is no such entry.
+   */
+  MemoryBlockFileInfo GetInfo(const std::string& name) const
+  {
+    const Entry& entry = GetEntry(name);
+    MemoryBlockFileInfo info = MakeMemoryBlockFileInfo(entry.header);
+    info.headerOffset = entry.offset;
+    info.payloadOffset += entry.offset;
+    return info;
+  }
+
+  /**
+   * \brief Loads an entry into a memory block newly-allocated on the CPU with the appropriate size.
+   *
+   * \param name                The name of the entry.
+   * \param dummy               An optional dummy parameter that can be used for type inference.
+   * \return                    The loaded memory block.
+   * \throws std::runtime_error If there is no such entry, it has the wrong type, or it fails its checksum.
+   */
+  template <typename T>
+  ORUtils::MemoryBlock<T> *LoadMemoryBlock(const std::string& name, ORUtils::MemoryBlock<T> *dummy = NULL) const
+  {
+    MemoryBlockFileInfo info = GetInfo(name);
+    CheckMemoryBlockElementType<T>(info, name);
+
+    ORUtils::MemoryBlock<T> *block = new ORUtils::MemoryBlock<T>(info.elementCount, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+    try
+    {
+      ReadEntryData(info, name, block->GetData(MEMORYDEVICE_CPU), block->dataSize * sizeof(T));
+    }
+    catch(...)
+    {
+      delete block;
+      throw;
+    }
+    return block;
+  }
+
+  /**
+   * \brief Loads an entry into an existing memory block of the same size.
+   *
+   * \param name                The name of the entry.
+   * \param block               The memory block into which to load the data.
+   * \param memoryDeviceType    The type of memory device on which to load the data.
+   * \throws std::runtime_error If there is no such entry, it has the wrong type or size, or it fails its checksum.
+   */
+  template <typename T>
+  void LoadMemoryBlock(const std::string& name, ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType) const
+  {
+    MemoryBlockFileInfo info = GetInfo(name);
+    CheckMemoryBlockElementType<T>(info, name);
+    if(block.dataSize != info.elementCount)
+    {
+      throw std::runtime_error("Could not read data into a memory block of the wrong size");
+    }
+
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we're loading into a block on the GPU, first read the data into a temporary block on the CPU.
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      ReadEntryData(info, name, cpuBlock.GetData(MEMORYDEVICE_CPU), cpuBlock.dataSize * sizeof(T));
+      block.SetFrom(&cpuBlock, ORUtils::MemoryBlock<T>::CPU_TO_CUDA);
+    }
+    else
+    {
+      ReadEntryData(info, name, block.GetData(MEMORYDEVICE_CPU), block.dataSize * sizeof(T));
+    }
+  }
+
+  /**
+   * \brief Maps an entry into a memory block without reading it. See MemoryBlockPersister::LoadMemoryBlockMapped.
+   *
+   * \param name                The name of the entry.
+   * \param mode                Whether to map the entry read-only or copy-on-write.
+   * \param dummy               An optional dummy parameter that can be used for type inference.
+   * \return                    The mapped memory block.
+   * \throws std::runtime_error If there is no such entry, it has the wrong type or is compressed, or the file cannot be mapped.
+   */
+  template <typename T>
+  ORUtils::MappedMemoryBlock<T> *LoadMemoryBlockMapped(const std::string& name, MappedFile::Mode mode = MappedFile::MAPPING_READ_ONLY, ORUtils::MemoryBlock<T> *dummy = NULL) const
+  {
+    MemoryBlockFileInfo info = GetInfo(name);
+    CheckMemoryBlockElementType<T>(info, name);
+    if(info.IsCompressed()) throw std::runtime_error(name + " is compressed and cannot be mapped");
+    return new ORUtils::MappedMemoryBlock<T>(m_file.GetFilename(), info.payloadOffset, info.elementCount, mode);
+  }
+
+  //#################### PRIVATE MEMBER FUNCTIONS ####################
+private:
+  /**
+   * \brief Gets the table of contents entry with the specified name.
+   *
+   * \throws std::runtime_error If there is no such entry.
+   */
+  const Entry& GetEntry(const std::string& name) const
+  {
+    std::map<std::string,size_t>::const_iterator it = m_index.find(name);
+    if(it == m_index.end()) throw std::runtime_error("The archive does not contain an entry called " + name);
+    return m_entries[it->second];
+  }
+
+  /**
+   * \brief Reads the elements of an entry into a buffer, verifying its checksum and decompressing it if necessary.
+   *
+   * \param info                The description of the entry.
+   * \param name                The name of the entry, for error messages.
+   * \param data                The buffer.
+   * \param bytes               The size of the buffer, which must match the size of the entry's elements.
+   */
+  void ReadEntryData(const MemoryBlockFileInfo& info, const std::string& name, void *data, size_t bytes) const
+  {
+    std::vector<char> buffer;
+    void *payload = data;
+    if(info.IsCompressed())
+    {
+      buffer.resize((size_t)info.payloadBytes);
+      payload = &buffer[0];
+    }
+
+    if(info.payloadBytes > 0) m_file.Read(payload, (size_t)info.payloadBytes, info.payloadOffset);
+    UnpackMemoryBlockPayload(payload, info, data, bytes, name);
+  }
+
+  /**
+   * \brief Copies bytes out of the serialised table of contents, advancing the read position.
+   */
+  static void ReadToc(const std::vector<char>& toc, size_t& pos, void *data, size_t bytes)
+  {
+    if(bytes > toc.size() - pos) throw std::runtime_error("The table of contents is corrupt");
+    memcpy(data, &toc[0] + pos, bytes);
+    pos += bytes;
+  }
+};
+
+}
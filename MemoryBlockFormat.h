@@ -0,0 +1,490 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "BlockCompression.h"
+#include "FastHash.h"
+
+namespace ORUtils
+{
+
+template <class T> class Vector2;
+template <class T> class Vector3;
+template <class T> class Vector4;
+template <class T> class Vector6;
+template <class T, int s> class VectorX;
+
+//#################### TYPE TAGS ####################
+
+/**
+ * \brief The kinds of scalar that can be recorded in a type tag.
+ */
+enum MemoryBlockScalarKind
+{
+  SCALARKIND_UNKNOWN,
+  SCALARKIND_SIGNED,
+  SCALARKIND_UNSIGNED,
+  SCALARKIND_FLOAT,
+  SCALARKIND_BOOL
+};
+
+/**
+ * \brief Makes a type tag describing elements made up of a number of scalars of the same kind.
+ *
+ * Bits 0-7 hold the kind, bits 8-15 the size of a scalar in bytes and bits 16-23 the number of scalars.
+ * A tag of 0 means the element type is unknown, and is compatible with any type of the right size.
+ */
+inline uint32_t MakeMemoryBlockTypeTag(MemoryBlockScalarKind kind, size_t scalarSize, size_t components)
+{
+  if(kind == SCALARKIND_UNKNOWN) return 0;
+  return (uint32_t)kind | ((uint32_t)scalarSize << 8) | ((uint32_t)components << 16);
+}
+
+/**
+ * \brief Computes the type tag recorded in saved memory blocks of type T.
+ *
+ * Arithmetic types and ORUtils vectors of them are recognised. Other types get a tag of 0, and are only checked by size.
+ * Specialise this for other types that should be checked when loading.
+ */
+template <typename T>
+struct MemoryBlockTypeTag
+{
+  static uint32_t Value()
+  {
+    MemoryBlockScalarKind kind = SCALARKIND_UNKNOWN;
+    if(std::is_same<T,bool>::value) kind = SCALARKIND_BOOL;
+    else if(std::is_floating_point<T>::value) kind = SCALARKIND_FLOAT;
+    else if(std::is_integral<T>::value) kind = std::is_signed<T>::value ? SCALARKIND_SIGNED : SCALARKIND_UNSIGNED;
+    return MakeMemoryBlockTypeTag(kind, sizeof(T), 1);
+  }
+};
+
+/**
+ * \brief Computes the type tag of a vector of n elements of type T.
+ */
+template <typename T>
+inline uint32_t MakeMemoryBlockVectorTypeTag(size_t n)
+{
+  uint32_t scalarTag = MemoryBlockTypeTag<T>::Value();
+  if(scalarTag == 0 || (scalarTag >> 16) != 1) return 0;
+  return (scalarTag & 0xffff) | ((uint32_t)n << 16);
+}
+
+template <typename T> struct MemoryBlockTypeTag<Vector2<T> > { static uint32_t Value() { return MakeMemoryBlockVectorTypeTag<T>(2); } };
+template <typename T> struct MemoryBlockTypeTag<Vector3<T> > { static uint32_t Value() { return MakeMemoryBlockVectorTypeTag<T>(3); } };
+template <typename T> struct MemoryBlockTypeTag<Vector4<T> > { static uint32_t Value() { return MakeMemoryBlockVectorTypeTag<T>(4); } };
+template <typename T> struct MemoryBlockTypeTag<Vector6<T> > { static uint32_t Value() { return MakeMemoryBlockVectorTypeTag<T>(6); } };
+template <typename T, int s> struct MemoryBlockTypeTag<VectorX<T,s> > { static uint32_t Value() { return MakeMemoryBlockVectorTypeTag<T>(s); } };
+
+//#################### FILE HEADER ####################
+
+/** The current version of the memory block file format. */
+const uint16_t MEMORYBLOCK_FORMAT_VERSION = 1;
+
+/** Set in MemoryBlockFileHeader::flags if the header contains a checksum of the payload. */
+const uint32_t MEMORYBLOCK_FLAG_CHECKSUM = 1;
+
+/** Set in MemoryBlockFileHeader::flags if the payload was compressed with CompressBlock. */
+const uint32_t MEMORYBLOCK_FLAG_COMPRESSED = 2;
+
+/** Set in MemoryBlockFileHeader::flags if the block is an image whose dimensions are stored in the header. */
+const uint32_t MEMORYBLOCK_FLAG_IMAGE = 4;
+
+/**
+ * \brief The 64-byte header at the start of a saved memory block.
+ *
+ * All fields are stored in the byte order of the machine that wrote the file (little-endian in practice).
+ * The payload starts at payloadOffset, which is padded to the requested alignment so that it can be memory mapped.
+ */
+struct MemoryBlockFileHeader
+{
+  /** "ORMB". */
+  char magic[4];
+
+  /** The format version, MEMORYBLOCK_FORMAT_VERSION when written. */
+  uint16_t version;
+
+  /** The size of this header in bytes. */
+  uint16_t headerSize;
+
+  /** The number of elements in the block. */
+  uint64_t elementCount;
+
+  /** The size of an element in bytes. */
+  uint32_t elementSize;
+
+  /** The element type, as given by MemoryBlockTypeTag. */
+  uint32_t typeTag;
+
+  /** A combination of the MEMORYBLOCK_FLAG_* values. */
+  uint32_t flags;
+
+  /** The alignment the payload offset was padded to. */
+  uint32_t payloadAlignment;
+
+  /** The offset of the payload from the start of the file. */
+  uint64_t payloadOffset;
+
+  /** The number of bytes stored in the payload. */
+  uint64_t payloadBytes;
+
+  /** FastHash64 of the payload, if MEMORYBLOCK_FLAG_CHECKSUM is set. */
+  uint64_t checksum;
+
+  /** The width of the image, if MEMORYBLOCK_FLAG_IMAGE is set, otherwise zero. */
+  uint32_t imageWidth;
+
+  /** The height of the image, if MEMORYBLOCK_FLAG_IMAGE is set, otherwise zero. */
+  uint32_t imageHeight;
+};
+
+/**
+ * \brief Options controlling how memory blocks are saved.
+ */
+struct MemoryBlockSaveOptions
+{
+  /** Whether to store a checksum of the payload that is verified when the block is loaded. */
+  bool checksum;
+
+  /** The alignment of the payload within the file, a power of two. Use the page size to allow mapping the payload on its own. */
+  size_t payloadAlignment;
+
+  /** How to compress the payload. Compressed blocks are smaller on disk, but cannot be memory mapped. */
+  CompressionOptions compression;
+
+  MemoryBlockSaveOptions()
+  : checksum(true), payloadAlignment(64)
+  {}
+};
+
+/**
+ * \brief A description of a saved memory block, read from a file in the current or the legacy format.
+ */
+struct MemoryBlockFileInfo
+{
+  /** The format version, or 0 for the legacy format that only stores the number of elements. */
+  uint32_t version;
+
+  uint64_t elementCount;
+
+  /** The size of an element in bytes, or 0 if unknown (legacy format). */
+  uint32_t elementSize;
+
+  uint32_t typeTag;
+  uint32_t flags;
+
+  /** The offset of the block's header, measured from the same place as payloadOffset. */
+  uint64_t headerOffset;
+
+  uint64_t payloadOffset;
+  uint64_t payloadBytes;
+  uint64_t checksum;
+  uint32_t imageWidth;
+  uint32_t imageHeight;
+
+  bool HasChecksum() const { return (flags & MEMORYBLOCK_FLAG_CHECKSUM) != 0; }
+  bool IsCompressed() const { return (flags & MEMORYBLOCK_FLAG_COMPRESSED) != 0; }
+  bool IsImage() const { return (flags & MEMORYBLOCK_FLAG_IMAGE) != 0; }
+};
+
+/**
+ * \brief Makes the header for a block with the specified layout.
+ *
+ * \param elementCount  The number of elements.
+ * \param elementSize   The size of an element in bytes.
+ * \param typeTag       The element type tag.
+ * \param payloadBytes  The number of bytes in the payload.
+ * \param checksum      The checksum of the payload, which is only stored if the options ask for it.
+ * \param options       The save options.
+ * \return              The header.
+ */
+inline MemoryBlockFileHeader MakeMemoryBlockFileHeader(uint64_t elementCount, uint32_t elementSize, uint32_t typeTag, uint64_t payloadBytes,
+                                                       uint64_t checksum, const MemoryBlockSaveOptions& options)
+{
+  MemoryBlockFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "ORMB", 4);
+  header.version = MEMORYBLOCK_FORMAT_VERSION;
+  header.headerSize = sizeof(MemoryBlockFileHeader);
+  header.elementCount = elementCount;
+  header.elementSize = elementSize;
+  header.typeTag = typeTag;
+  header.payloadAlignment = (uint32_t)(options.payloadAlignment > 0 ? options.payloadAlignment : 1);
+  header.payloadOffset = (sizeof(MemoryBlockFileHeader) + header.payloadAlignment - 1) / header.payloadAlignment * header.payloadAlignment;
+  header.payloadBytes = payloadBytes;
+  if(options.checksum)
+  {
+    header.flags |= MEMORYBLOCK_FLAG_CHECKSUM;
+    header.checksum = checksum;
+  }
+  return header;
+}
+
+/**
+ * \brief Makes the description of a block from its header.
+ *
+ * \param header  The header.
+ * \return        The description of the block.
+ */
+inline MemoryBlockFileInfo MakeMemoryBlockFileInfo(const MemoryBlockFileHeader& header)
+{
+  MemoryBlockFileInfo info;
+  info.version = header.version;
+  info.elementCount = header.elementCount;
+  info.elementSize = header.elementSize;
+  info.typeTag = header.typeTag;
+  info.flags = header.flags;
+  info.headerOffset = 0;
+  info.payloadOffset = header.payloadOffset;
+  info.payloadBytes = header.payloadBytes;
+  info.checksum = header.checksum;
+  info.imageWidth = header.imageWidth;
+  info.imageHeight = header.imageHeight;
+  return info;
+}
+
+/**
+ * \brief Checks that a saved block contains elements of type T.
+ *
+ * Legacy files do not record their element type, so they always pass.
+ *
+ * \param info                The description of the block.
+ * \param source              The name of the file or entry, for error messages.
+ * \throws std::runtime_error If the block does not contain elements of type T.
+ */
+template <typename T>
+inline void CheckMemoryBlockElementType(const MemoryBlockFileInfo& info, const std::string& source)
+{
+  if(info.version == 0) return;
+
+  if(info.elementSize != sizeof(T))
+  {
+    throw std::runtime_error(source + " contains elements of a different size");
+  }
+
+  uint32_t typeTag = MemoryBlockTypeTag<T>::Value();
+  if(info.typeTag != 0 && typeTag != 0 && info.typeTag != typeTag)
+  {
+    throw std::runtime_error(source + " contains elements of a different type");
+  }
+
+  if(!info.IsCompressed() && info.payloadBytes != info.elementCount * sizeof(T))
+  {
+    throw std::runtime_error(source + " has an unexpected amount of data");
+  }
+}
+
+/**
+ * \brief Prepares the header and payload for writing a block, compressing the block's data if the options ask for it.
+ *
+ * \param data          The block's elements.
+ * \param elementCount  The number of elements.
+ * \param elementSize   The size of an element in bytes.
+ * \param typeTag       The element type tag.
+ * \param options       The save options.
+ * \param buffer        Storage for the compressed payload.
+ * \param header        Filled with the block's header.
+ * \return              The payload to write at header.payloadOffset, which is header.payloadBytes long.
+ */
+inline const void *PrepareMemoryBlockPayload(const void *data, uint64_t elementCount, uint32_t elementSize, uint32_t typeTag,
+                                             const MemoryBlockSaveOptions& options, std::vector<char>& buffer, MemoryBlockFileHeader& header)
+{
+  const void *payload = data;
+  uint64_t payloadBytes = elementCount * elementSize;
+
+  bool compressed = options.compression.codec != COMPRESSION_NONE;
+  if(compressed)
+  {
+    CompressBlock(data, (size_t)payloadBytes, elementSize, options.compression, buffer);
+    payload = &buffer[0];
+    payloadBytes = buffer.size();
+  }
+
+  uint64_t checksum = options.checksum ? FastHash64(payload, (size_t)payloadBytes) : 0;
+  header = MakeMemoryBlockFileHeader(elementCount, elementSize, typeTag, payloadBytes, checksum, options);
+  if(compressed) header.flags |= MEMORYBLOCK_FLAG_COMPRESSED;
+  return payload;
+}
+
+/**
+ * \brief Records in a header that the block is an image with the specified dimensions.
+ *
+ * \param header              The header.
+ * \param width               The width of the image.
+ * \param height              The height of the image.
+ * \throws std::runtime_error If the dimensions do not match the number of elements.
+ */
+inline void SetMemoryBlockImageDims(MemoryBlockFileHeader& header, int width, int height)
+{
+  if(width < 0 || height < 0 || (uint64_t)width * (uint64_t)height != header.elementCount)
+  {
+    throw std::runtime_error("The image dimensions do not match the number of pixels");
+  }
+
+  header.flags |= MEMORYBLOCK_FLAG_IMAGE;
+  header.imageWidth = (uint32_t)width;
+  header.imageHeight = (uint32_t)height;
+}
+
+/**
+ * \brief Checks a payload read from a file against its checksum and unpacks it into the block's elements.
+ *
+ * \param payload             The payload, which is info.payloadBytes long. For blocks that are not compressed, this
+ *                            may be the same as data, in which case only the checksum is verified.
+ * \param info                The description of the block.
+ * \param data                The block's elements.
+ * \param bytes               The size of the block's elements in bytes.
+ * \param source              A description of the data, for error messages.
+ * \throws std::runtime_error If the payload does not match its checksum or cannot be decompressed.
+ */
+inline void UnpackMemoryBlockPayload(const void *payload, const MemoryBlockFileInfo& info, void *data, size_t bytes, const std::string& source)
+{
+  if(info.HasChecksum() && FastHash64(payload, (size_t)info.payloadBytes) != info.checksum)
+  {
+    throw std::runtime_error(source + " does not match its checksum");
+  }
+
+  if(info.IsCompressed()) DecompressBlock(payload, (size_t)info.payloadBytes, data, bytes);
+  else if(payload != data) memcpy(data, payload, bytes);
+}
+
+/**
+ * \brief Attempts to write a header, followed by the padding up to the payload, to an output stream.
+ *
+ * \param os                  The output stream.
+ * \param header              The header.
+ * \throws std::runtime_error If the write is unsuccessful.
+ */
+inline void WriteMemoryBlockFileHeader(std::ostream& os, const MemoryBlockFileHeader& header)
+{
+  static const char zeros[256] = { 0 };
+
+  if(!os.write(reinterpret_cast<const char *>(&header), sizeof(header)))
+  {
+    throw std::runtime_error("Could not write memory block header");
+  }
+
+  for(uint64_t padding = header.payloadOffset - sizeof(header); padding > 0;)
+  {
+    size_t n = padding < sizeof(zeros) ? (size_t)padding : sizeof(zeros);
+    if(!os.write(zeros, n)) throw std::runtime_error("Could not write memory block header");
+    padding -= n;
+  }
+}
+
+/**
+ * \brief Attempts to read the description of a saved memory block from the start of an input stream.
+ *
+ * Files in the legacy format, which starts with the number of elements, are recognised by their length: the
+ * count is read as a size_t or, if the rest of the file is not that many elements of the specified size, as an int.
+ *
+ * \param is                  The input stream, positioned at the start of the block. It is left at an unspecified position.
+ * \param elementSize         The expected element size used to recognise legacy files, or 0 if unknown.
+ * \return                    The description of the block.
+ * \throws std::runtime_error If the stream does not contain a memory block.
+ */
+inline MemoryBlockFileInfo ReadMemoryBlockFileInfo(std::istream& is, size_t elementSize)
+{
+  std::streamoff start = is.tellg();
+  if(!is.seekg(0, std::ios::end)) throw std::runtime_error("Could not determine the length of the memory block file");
+  uint64_t length = (uint64_t)(is.tellg() - start);
+  is.seekg(start);
+
+  MemoryBlockFileInfo info;
+  memset(&info, 0, sizeof(info));
+
+  MemoryBlockFileHeader header;
+  if(length >= sizeof(header))
+  {
+    if(!is.read(reinterpret_cast<char*>(&header), sizeof(header))) throw std::runtime_error("Could not read memory block header");
+
+    if(memcmp(header.magic, "ORMB", 4) == 0 && header.version >= 1 && header.headerSize >= sizeof(header))
+    {
+      if(header.version > MEMORYBLOCK_FORMAT_VERSION) throw std::runtime_error("Memory block file has an unsupported version");
+      if((header.flags & ~(MEMORYBLOCK_FLAG_CHECKSUM | MEMORYBLOCK_FLAG_COMPRESSED | MEMORYBLOCK_FLAG_IMAGE)) != 0)
+      {
+        throw std::runtime_error("Memory block file uses unsupported features");
+      }
+      if(header.payloadOffset > length || header.payloadBytes > length - header.payloadOffset)
+      {
+        throw std::runtime_error("Memory block file is truncated");
+      }
+
+      return MakeMemoryBlockFileInfo(header);
+    }
+  }
+
+  // Legacy format: the element count as a size_t or an int, followed by the raw elements.
+  is.clear();
+  is.seekg(start);
+
+  // Files written by this library always stored a size_t, so that is tried first.
+  uint64_t count64 = 0;
+  bool haveCount64 = length >= sizeof(uint64_t) && is.read(reinterpret_cast<char*>(&count64), sizeof(count64));
+  uint64_t rest64 = length - sizeof(uint64_t);
+  if(haveCount64 && (elementSize == 0 || (rest64 % elementSize == 0 && count64 == rest64 / elementSize)))
+  {
+    info.elementCount = count64;
+    info.payloadOffset = sizeof(uint64_t);
+  }
+  else
+  {
+    is.clear();
+    is.seekg(start);
+
+    int32_t count32 = 0;
+    if(length < sizeof(int32_t) || !is.read(reinterpret_cast<char*>(&count32), sizeof(count32)) || count32 < 0 ||
+       (elementSize > 0 && (uint64_t)count32 * elementSize != length - sizeof(int32_t)))
+    {
+      throw std::runtime_error("Memory block file is not in a recognised format");
+    }
+
+    info.elementCount = (uint64_t)count32;
+    info.payloadOffset = sizeof(int32_t);
+  }
+
+  info.payloadBytes = length - info.payloadOffset;
+  return info;
+}
+
+/**
+ * \brief Attempts to write a block, given as raw elements, to an output stream.
+ *
+ * \param os                  The output stream.
+ * \param data                The block's elements.
+ * \param elementCount        The number of elements.
+ * \param elementSize         The size of an element in bytes.
+ * \param typeTag             The element type tag.
+ * \param options             The save options.
+ * \param imageDims           The width and height of the block if it is an image, or NULL if it is not.
+ * \throws std::runtime_error If the write is unsuccessful.
+ */
+inline void WriteMemoryBlock(std::ostream& os, const void *data, uint64_t elementCount, uint32_t elementSize, uint32_t typeTag,
+                             const MemoryBlockSaveOptions& options, const int *imageDims = NULL)
+{
+  std::vector<char> buffer;
+  MemoryBlockFileHeader header;
+  const void *payload = PrepareMemoryBlockPayload(data, elementCount, elementSize, typeTag, options, buffer, header);
+  if(imageDims != NULL) SetMemoryBlockImageDims(header, imageDims[0], imageDims[1]);
+
+  // Try and write the block's header.
+  WriteMemoryBlockFileHeader(os, header);
+
+  // Try and write the block's data.
+  if(!os.write(reinterpret_cast<const char *>(payload), header.payloadBytes))
+  {
+    throw std::runtime_error("Could not write memory block data");
+  }
+}
+
+}
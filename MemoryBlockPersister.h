@@ -2,16 +2,33 @@
 
 #pragma once
 
+#include <limits.h>
+#include <stddef.h>
+
 #include <fstream>
 #include <string>
 
+#include "Image.h"
+#include "MappedMemoryBlock.h"
 #include "MemoryBlock.h"
+#include "MemoryBlockFormat.h"
+#include "PositionedFile.h"
 
 namespace ORUtils
 {
 
 /**
  * \brief This class provides functions for loading and saving memory blocks.
+ *
+ * Blocks are saved with a MemoryBlockFileHeader that records the 64-bit element count, the element size and type and,
+ * optionally, a checksum of the data, which may be compressed. Files in the legacy format, which only stored the element count, can still be
+ * loaded.
+ *
+ * Images are saved in the same format, with their dimensions recorded in the header, so an image file can also be
+ * loaded as a plain memory block.
+ *
+ * Ranges of elements in uncompressed files can also be read and updated in place. These use positioned I/O, so any
+ * number of threads can read or write ranges of the same open PositionedFile concurrently.
  */
 class MemoryBlockPersister
 {
@@ -23,16 +40,20 @@ public:
    * \param filename          The name of the file.
    * \param block             The memory block into which to load the data.
    * \param memoryDeviceType  The type of memory device on which to load the data.
+   * \throws std::runtime_error If the file does not contain a block of the right type and size, or fails its checksum.
    */
   template <typename T>
   static void LoadMemoryBlock(const std::string& filename, ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType)
   {
-    int blockSize = ReadBlockSize(filename);
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(fs, filename);
+
     if(memoryDeviceType == MEMORYDEVICE_CUDA)
     {
       // If we're loading into a block on the GPU, first try and read the data into a temporary block on the CPU.
-      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU);
-      ReadBlockData(filename, cpuBlock, blockSize);
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      ReadBlockData(fs, cpuBlock, info);
 
       // Then copy the data across to the GPU.
       block.SetFrom(&cpuBlock, ORUtils::MemoryBlock<T>::CPU_TO_CUDA);
@@ -40,51 +61,369 @@ public:
     else
     {
       // If we're loading into a block on the CPU, read the data directly into the block.
-      ReadBlockData(filename, block, blockSize);
+      ReadBlockData(fs, block, info);
     }
   }
 
+  /**
+   * \brief Loads an image from a file on disk, changing the image's dimensions to match the file if necessary.
+   *
+   * \param filename          The name of the file.
+   * \param image             The image into which to load the data.
+   * \param memoryDeviceType  The type of memory device on which to load the data.
+   * \throws std::runtime_error If the file does not contain an image of the right type, or fails its checksum.
+   */
+  template <typename T>
+  static void LoadImage(const std::string& filename, ORUtils::Image<T>& image, MemoryDeviceType memoryDeviceType)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadImageInfo<T>(fs, filename);
+
+    image.ChangeDims(Vector2<int>(info.imageWidth, info.imageHeight));
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we're loading into an image on the GPU, first read the data into a temporary block on the CPU.
+      ORUtils::MemoryBlock<T> cpuBlock(image.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      ReadBlockData(fs, cpuBlock, info);
+      image.SetFrom(&cpuBlock, ORUtils::MemoryBlock<T>::CPU_TO_CUDA);
+    }
+    else
+    {
+      ReadBlockData(fs, image, info);
+    }
+  }
+
+  /**
+   * \brief Loads an image from a file on disk into an image newly-allocated on the CPU with the appropriate size.
+   *
+   * \param filename  The name of the file.
+   * \param dummy     An optional dummy parameter that can be used for type inference.
+   * \return          The loaded image.
+   * \throws std::runtime_error If the file does not contain an image of the right type, or fails its checksum.
+   */
+  template <typename T>
+  static ORUtils::Image<T> *LoadImage(const std::string& filename, ORUtils::Image<T> *dummy = NULL)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadImageInfo<T>(fs, filename);
+
+    ORUtils::Image<T> *image = new ORUtils::Image<T>(Vector2<int>(info.imageWidth, info.imageHeight), MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+    try
+    {
+      ReadBlockData(fs, *image, info);
+    }
+    catch(...)
+    {
+      delete image;
+      throw;
+    }
+    return image;
+  }
+
   /**
    * \brief Loads data from a file on disk into a memory block newly-allocated on the CPU with the appropriate size.
    *
    * \param filename  The name of the file.
    * \param dummy     An optional dummy parameter that can be used for type inference.
    * \return          The loaded memory block.
+   * \throws std::runtime_error If the file does not contain a block of the right type, or fails its checksum.
    */
   template <typename T>
   static ORUtils::MemoryBlock<T> *LoadMemoryBlock(const std::string& filename, ORUtils::MemoryBlock<T> *dummy = NULL)
   {
-    int blockSize = ReadBlockSize(filename);
-    ORUtils::MemoryBlock<T> *block = new ORUtils::MemoryBlock<T>(blockSize, MEMORYDEVICE_CPU);
-    ReadBlockData(filename, *block, blockSize);
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(fs, filename);
+
+    // The data is about to be overwritten, so there is no point clearing it first.
+    ORUtils::MemoryBlock<T> *block = new ORUtils::MemoryBlock<T>(info.elementCount, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+    try
+    {
+      ReadBlockData(fs, *block, info);
+    }
+    catch(...)
+    {
+      delete block;
+      throw;
+    }
     return block;
   }
 
   /**
-   * \brief Attempts to read the size of a memory block from a file containing data for a single block.
+   * \brief Maps a file on disk into a memory block without reading it.
+   *
+   * The block's data points straight into the mapped file, so loading takes constant time and pages are only read
+   * from disk when they are first accessed. Unless copy-on-write mode is requested, the block must not be written.
+   * The checksum is not verified, since that would read the whole file; use VerifyChecksum for that. Compressed
+   * blocks cannot be mapped.
+   *
+   * \param filename  The name of the file.
+   * \param mode      Whether to map the file read-only or copy-on-write.
+   * \param dummy     An optional dummy parameter that can be used for type inference.
+   * \return          The mapped memory block.
+   * \throws std::runtime_error If the file cannot be mapped or does not contain an uncompressed block of the right type.
+   */
+  template <typename T>
+  static ORUtils::MappedMemoryBlock<T> *LoadMemoryBlockMapped(const std::string& filename, MappedFile::Mode mode = MappedFile::MAPPING_READ_ONLY, ORUtils::MemoryBlock<T> *dummy = NULL)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(fs, filename);
+    fs.close();
+    if(info.IsCompressed()) throw std::runtime_error(filename + " is compressed and cannot be mapped");
+
+    return new ORUtils::MappedMemoryBlock<T>(filename, info.payloadOffset, info.elementCount, mode);
+  }
+
+  /**
+   * \brief Loads the elements [begin, end) of the block in a file on disk into a buffer on the CPU.
+   *
+   * The checksum is not verified, since that would read the whole block.
+   *
+   * \param filename            The name of the file.
+   * \param begin               The index of the first element to load.
+   * \param end                 The index one past the last element to load.
+   * \param dst                 The buffer, which must have room for end - begin elements.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the range.
+   */
+  template <typename T>
+  static void LoadMemoryBlockRange(const std::string& filename, size_t begin, size_t end, T *dst)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(fs, filename);
+    fs.close();
+
+    PositionedFile file(filename, PositionedFile::OPEN_READ);
+    ReadBlockRange(file, info, begin, end, dst);
+  }
+
+  /**
+   * \brief Loads the elements [begin, end) of the block in a file on disk into part of a memory block.
+   *
+   * \param filename            The name of the file.
+   * \param begin               The index of the first element to load.
+   * \param end                 The index one past the last element to load.
+   * \param block               The memory block into which to load the data.
+   * \param blockOffset         The index in the memory block at which to store the first element.
+   * \param memoryDeviceType    The type of memory device on which to load the data.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the
+   *                            range, or the range does not fit in the memory block.
+   */
+  template <typename T>
+  static void LoadMemoryBlockRange(const std::string& filename, size_t begin, size_t end, ORUtils::MemoryBlock<T>& block, size_t blockOffset,
+                                   MemoryDeviceType memoryDeviceType)
+  {
+    if(begin > end || blockOffset > block.dataSize || end - begin > block.dataSize - blockOffset)
+    {
+      throw std::runtime_error("Could not read data beyond the end of a memory block");
+    }
+
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we're loading into a block on the GPU, first read the range into a temporary buffer on the CPU.
+      std::vector<T> buffer(end - begin);
+      LoadMemoryBlockRange(filename, begin, end, buffer.empty() ? NULL : &buffer[0]);
+
+      MemoryBackend *backend = block.GetDeviceBackend();
+      if(backend == NULL) throw std::runtime_error("Cannot load data onto the device of a memory block that has no device data");
+      if(!buffer.empty()) backend->Copy(block.GetData(MEMORYDEVICE_CUDA) + blockOffset, &buffer[0], buffer.size() * sizeof(T), TRANSFER_HOST_TO_DEVICE);
+    }
+    else
+    {
+      LoadMemoryBlockRange(filename, begin, end, block.GetData(MEMORYDEVICE_CPU) + blockOffset);
+    }
+  }
+
+  /**
+   * \brief Reads the elements [begin, end) of the block in an open file into a buffer on the CPU.
+   *
+   * This can be called from many threads at once for the same file.
+   *
+   * \param file                The file, opened for reading.
+   * \param info                The description of the block in the file, as returned by ReadBlockInfo.
+   * \param begin               The index of the first element to read.
+   * \param end                 The index one past the last element to read.
+   * \param dst                 The buffer, which must have room for end - begin elements.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the
+   *                            range, or the read is unsuccessful.
+   */
+  template <typename T>
+  static void ReadBlockRange(const PositionedFile& file, const MemoryBlockFileInfo& info, size_t begin, size_t end, T *dst)
+  {
+    CheckBlockRange<T>(info, begin, end, file.GetFilename());
+    file.Read(dst, (end - begin) * sizeof(T), info.payloadOffset + (uint64_t)begin * sizeof(T));
+  }
+
+  /**
+   * \brief Overwrites the elements [begin, end) of the block in an existing file on disk.
+   *
+   * The rest of the file is left untouched. If the file has a checksum, it no longer describes the data, so it is
+   * removed from the file's header.
+   *
+   * \param filename            The name of the file.
+   * \param begin               The index of the first element to write.
+   * \param end                 The index one past the last element to write.
+   * \param src                 The end - begin elements to write.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the
+   *                            range, or the write is unsuccessful.
+   */
+  template <typename T>
+  static void SaveMemoryBlockRange(const std::string& filename, size_t begin, size_t end, const T *src)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(fs, filename);
+    fs.close();
+
+    PositionedFile file(filename, PositionedFile::OPEN_READ_WRITE);
+    WriteBlockRange(file, info, begin, end, src);
+  }
+
+  /**
+   * \brief Overwrites the elements [begin, end) of the block in an existing file on disk with part of a memory block.
+   *
+   * \param filename            The name of the file.
+   * \param begin               The index of the first element to write.
+   * \param end                 The index one past the last element to write.
+   * \param block               The memory block containing the data.
+   * \param blockOffset         The index in the memory block of the first element to write.
+   * \param memoryDeviceType    The type of memory device from which to save the data.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the
+   *                            range, the range is not in the memory block, or the write is unsuccessful.
+   */
+  template <typename T>
+  static void SaveMemoryBlockRange(const std::string& filename, size_t begin, size_t end, const ORUtils::MemoryBlock<T>& block, size_t blockOffset,
+                                   MemoryDeviceType memoryDeviceType)
+  {
+    if(begin > end || blockOffset > block.dataSize || end - begin > block.dataSize - blockOffset)
+    {
+      throw std::runtime_error("Could not write data beyond the end of a memory block");
+    }
+
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we are saving from the GPU, first copy the range into a temporary buffer on the CPU.
+      std::vector<T> buffer(end - begin);
+      MemoryBackend *backend = block.GetDeviceBackend();
+      if(backend == NULL) throw std::runtime_error("Cannot save a memory block that has no device data from the device");
+      if(!buffer.empty()) backend->Copy(&buffer[0], block.GetData(MEMORYDEVICE_CUDA) + blockOffset, buffer.size() * sizeof(T), TRANSFER_DEVICE_TO_HOST);
+
+      SaveMemoryBlockRange(filename, begin, end, buffer.empty() ? NULL : &buffer[0]);
+    }
+    else
+    {
+      SaveMemoryBlockRange(filename, begin, end, block.GetData(MEMORYDEVICE_CPU) + blockOffset);
+    }
+  }
+
+  /**
+   * \brief Writes the elements [begin, end) of the block in an open file.
    *
-   * The size is stored as a single integer and precedes the data for the block.
+   * This can be called from many threads at once for the same file, provided that the ranges do not overlap. If the
+   * file has a checksum, it is removed from the file's header; callers that write many ranges can remove it once
+   * beforehand with ClearBlockChecksum.
+   *
+   * \param file                The file, opened for reading and writing.
+   * \param info                The description of the block in the file, as returned by ReadBlockInfo.
+   * \param begin               The index of the first element to write.
+   * \param end                 The index one past the last element to write.
+   * \param src                 The end - begin elements to write.
+   * \throws std::runtime_error If the file does not contain an uncompressed block of the right type that includes the
+   *                            range, or the write is unsuccessful.
+   */
+  template <typename T>
+  static void WriteBlockRange(PositionedFile& file, const MemoryBlockFileInfo& info, size_t begin, size_t end, const T *src)
+  {
+    CheckBlockRange<T>(info, begin, end, file.GetFilename());
+
+    if(info.HasChecksum())
+    {
+      // Every writer stores the same values here, so concurrent writers do not conflict.
+      MemoryBlockFileInfo cleared = info;
+      ClearBlockChecksum(file, cleared);
+    }
+
+    file.Write(src, (end - begin) * sizeof(T), info.payloadOffset + (uint64_t)begin * sizeof(T));
+  }
+
+  /**
+   * \brief Removes the checksum from the header of the block in an open file, so that the block can be modified.
+   *
+   * \param file                The file, opened for reading and writing.
+   * \param info                The description of the block in the file, which is updated to have no checksum.
+   * \throws std::runtime_error If the write is unsuccessful.
+   */
+  static void ClearBlockChecksum(PositionedFile& file, MemoryBlockFileInfo& info)
+  {
+    if(!info.HasChecksum()) return;
+
+    uint32_t flags = info.flags & ~MEMORYBLOCK_FLAG_CHECKSUM;
+    uint64_t checksum = 0;
+    file.Write(&flags, sizeof(flags), info.headerOffset + offsetof(MemoryBlockFileHeader, flags));
+    file.Write(&checksum, sizeof(checksum), info.headerOffset + offsetof(MemoryBlockFileHeader, checksum));
+
+    info.flags = flags;
+    info.checksum = 0;
+  }
+
+  /**
+   * \brief Attempts to read the size of a memory block from a file containing data for a single block.
    *
    * \param filename            The name of the file.
-   * \return                    The size of the memory block in the file.
+   * \return                    The number of elements in the memory block in the file.
    * \throws std::runtime_error If the read is unsuccessful.
    */
-  static int ReadBlockSize(const std::string& filename)
+  static size_t ReadBlockSize(const std::string& filename)
   {
     std::ifstream fs(filename.c_str(), std::ios::binary);
     if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
     return ReadBlockSize(fs);
   }
 
+  /**
+   * \brief Attempts to read the description of the memory block in a file containing data for a single block.
+   *
+   * \param filename            The name of the file.
+   * \return                    The description of the block. For legacy files, the element size and type are unknown.
+   * \throws std::runtime_error If the read is unsuccessful.
+   */
+  static MemoryBlockFileInfo ReadBlockInfo(const std::string& filename)
+  {
+    std::ifstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    return ReadMemoryBlockFileInfo(fs, 0);
+  }
+
+  /**
+   * \brief Checks the data in a file containing a single block against the checksum stored with it.
+   *
+   * \param filename            The name of the file.
+   * \return                    false if the data does not match the checksum, true if it does or there is no checksum.
+   * \throws std::runtime_error If the file cannot be read.
+   */
+  static bool VerifyChecksum(const std::string& filename)
+  {
+    MemoryBlockFileInfo info = ReadBlockInfo(filename);
+    if(!info.HasChecksum()) return true;
+
+    MappedFile file(filename);
+    return FastHash64((const char *)file.GetData() + info.payloadOffset, (size_t)info.payloadBytes) == info.checksum;
+  }
+
   /**
    * \brief Saves a memory block to a file on disk.
    *
    * \param filename          The name of the file.
    * \param block             The memory block to save.
    * \param memoryDeviceType  The type of memory device from which to save the data.
+   * \param options           Whether to store a checksum, how to compress the data and how to align it in the file.
    */
   template <typename T>
-  static void SaveMemoryBlock(const std::string& filename, const ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType)
+  static void SaveMemoryBlock(const std::string& filename, const ORUtils::MemoryBlock<T>& block, MemoryDeviceType memoryDeviceType,
+                              const MemoryBlockSaveOptions& options = MemoryBlockSaveOptions())
   {
     std::ofstream fs(filename.c_str(), std::ios::binary);
     if(!fs) throw std::runtime_error("Could not open " + filename + " for writing");
@@ -92,109 +431,165 @@ public:
     if(memoryDeviceType == MEMORYDEVICE_CUDA)
     {
       // If we are saving the memory block from the GPU, first make a CPU copy of it.
-      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU);
+      ORUtils::MemoryBlock<T> cpuBlock(block.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
       cpuBlock.SetFrom(&block, ORUtils::MemoryBlock<T>::CUDA_TO_CPU);
 
       // Then write the CPU copy to disk.
-      WriteBlock(fs, cpuBlock);
+      WriteBlock(fs, cpuBlock, options);
     }
     else
     {
       // If we are saving the memory block from the CPU, write it directly to disk.
-      WriteBlock(fs, block);
+      WriteBlock(fs, block, options);
+    }
+  }
+
+  /**
+   * \brief Saves an image, including its dimensions, to a file on disk.
+   *
+   * \param filename          The name of the file.
+   * \param image             The image to save.
+   * \param memoryDeviceType  The type of memory device from which to save the data.
+   * \param options           Whether to store a checksum, how to compress the data and how to align it in the file.
+   */
+  template <typename T>
+  static void SaveImage(const std::string& filename, const ORUtils::Image<T>& image, MemoryDeviceType memoryDeviceType,
+                        const MemoryBlockSaveOptions& options = MemoryBlockSaveOptions())
+  {
+    std::ofstream fs(filename.c_str(), std::ios::binary);
+    if(!fs) throw std::runtime_error("Could not open " + filename + " for writing");
+
+    int dims[] = { image.noDims.x, image.noDims.y };
+    if(memoryDeviceType == MEMORYDEVICE_CUDA)
+    {
+      // If we are saving the image from the GPU, first make a CPU copy of it.
+      ORUtils::MemoryBlock<T> cpuBlock(image.dataSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised());
+      cpuBlock.SetFrom(&image, ORUtils::MemoryBlock<T>::CUDA_TO_CPU);
+      WriteMemoryBlock(fs, cpuBlock.GetData(MEMORYDEVICE_CPU), cpuBlock.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value(), options, dims);
+    }
+    else
+    {
+      WriteMemoryBlock(fs, image.GetData(MEMORYDEVICE_CPU), image.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value(), options, dims);
     }
   }
 
   //#################### PRIVATE STATIC MEMBER FUNCTIONS ####################
 private:
   /**
-   * \brief Attempts to read data into a memory block allocated on the CPU from an input stream.
+   * \brief Checks that elements [begin, end) of type T can be accessed in place in a file.
    *
-   * The memory block must have the specified size (which should have been obtained by a call to ReadBlockSize).
+   * \throws std::runtime_error If the block is compressed, does not contain elements of type T or does not include the range.
+   */
+  template <typename T>
+  static void CheckBlockRange(const MemoryBlockFileInfo& info, size_t begin, size_t end, const std::string& filename)
+  {
+    CheckMemoryBlockElementType<T>(info, filename);
+    if(info.IsCompressed()) throw std::runtime_error(filename + " is compressed, so ranges of it cannot be accessed");
+    if(begin > end || end > info.elementCount) throw std::runtime_error("The range is outside the memory block in " + filename);
+  }
+
+  /**
+   * \brief Attempts to read the description of a memory block of type T from an input stream, and checks that it matches T.
    *
-   * \param is                  The input stream.
-   * \param block               The memory block into which to read.
-   * \param blockSize           The required size for the memory block.
-   * \throws std::runtime_error If the read is unsuccessful.
+   * \param is                  The input stream, positioned at the start of the block.
+   * \param filename            The name of the file, for error messages.
+   * \return                    The description of the block.
+   * \throws std::runtime_error If the read is unsuccessful or the block does not contain elements of type T.
    */
   template <typename T>
-  static void ReadBlockData(std::istream& is, ORUtils::MemoryBlock<T>& block, int blockSize)
+  static MemoryBlockFileInfo ReadBlockInfo(std::istream& is, const std::string& filename)
   {
-    // Try and read the block's size.
-    if(block.dataSize != blockSize)
-    {
-      throw std::runtime_error("Could not read data into a memory block of the wrong size");
-    }
+    MemoryBlockFileInfo info = ReadMemoryBlockFileInfo(is, sizeof(T));
+    CheckMemoryBlockElementType<T>(info, filename);
+    return info;
+  }
 
-    // Try and read the block's data.
-    if(!is.read(reinterpret_cast<char*>(block.GetData(MEMORYDEVICE_CPU)), blockSize * sizeof(T)))
+  /**
+   * \brief Attempts to read the description of an image of type T from an input stream, and checks that it matches T.
+   *
+   * \param is                  The input stream, positioned at the start of the image.
+   * \param filename            The name of the file, for error messages.
+   * \return                    The description of the image.
+   * \throws std::runtime_error If the read is unsuccessful or the file does not contain an image of type T.
+   */
+  template <typename T>
+  static MemoryBlockFileInfo ReadImageInfo(std::istream& is, const std::string& filename)
+  {
+    MemoryBlockFileInfo info = ReadBlockInfo<T>(is, filename);
+    if(!info.IsImage()) throw std::runtime_error(filename + " does not record image dimensions");
+    if((uint64_t)info.imageWidth * info.imageHeight != info.elementCount || info.imageWidth > INT_MAX || info.imageHeight > INT_MAX)
     {
-      throw std::runtime_error("Could not read memory block data");
+      throw std::runtime_error(filename + " has inconsistent image dimensions");
     }
+    return info;
   }
 
   /**
-   * \brief Attempts to read data into a memory block allocated on the CPU from a file that contains data for a single block.
+   * \brief Attempts to read data into a memory block allocated on the CPU from an input stream.
    *
-   * The memory block must have the specified size (which should have been obtained by a call to ReadBlockSize).
+   * The memory block must have the specified size (which should have been obtained by a call to ReadBlockInfo).
    *
-   * \param filename            The name of the file.
+   * \param is                  The input stream.
    * \param block               The memory block into which to read.
-   * \param blockSize           The required size for the memory block.
-   * \throws std::runtime_error If the read is unsuccessful.
+   * \param info                The description of the block in the stream.
+   * \throws std::runtime_error If the read is unsuccessful or the data does not match its checksum.
    */
   template <typename T>
-  static void ReadBlockData(const std::string& filename, ORUtils::MemoryBlock<T>& block, int blockSize)
+  static void ReadBlockData(std::istream& is, ORUtils::MemoryBlock<T>& block, const MemoryBlockFileInfo& info)
   {
-    std::ifstream fs(filename.c_str(), std::ios::binary);
-    if(!fs) throw std::runtime_error("Could not open " + filename + " for reading");
+    // Try and read the block's size.
+    if(block.dataSize != info.elementCount)
+    {
+      throw std::runtime_error("Could not read data into a memory block of the wrong size");
+    }
+
+    // Try and skip to the block's data.
+    if(!is.seekg(info.payloadOffset)) throw std::runtime_error("Could not skip memory block header");
 
-    // Try and skip the block's size.
-    if(!fs.seekg(sizeof(int))) throw std::runtime_error("Could not skip memory block size");
+    // Try and read the block's data, straight into the block unless it has to be decompressed.
+    char *data = reinterpret_cast<char*>(block.GetData(MEMORYDEVICE_CPU));
+    std::vector<char> buffer;
+    char *payload = data;
+    if(info.IsCompressed())
+    {
+      buffer.resize((size_t)info.payloadBytes);
+      payload = &buffer[0];
+    }
+
+    if(!is.read(payload, info.payloadBytes))
+    {
+      throw std::runtime_error("Could not read memory block data");
+    }
 
-    // Try and read the block's data.
-    ReadBlockData(fs, block, blockSize);
+    UnpackMemoryBlockPayload(payload, info, data, info.elementCount * sizeof(T), "Memory block data");
   }
 
   /**
    * \brief Attempts to read the size of a memory block from an input stream.
    *
-   * The size is stored as a single integer and precedes the data for the block.
-   *
    * \param is                  The input stream.
-   * \return                    The size of the memory block.
+   * \return                    The number of elements in the memory block.
    * \throws std::runtime_error If the read is unsuccesssful.
    */
-  static int ReadBlockSize(std::istream& is)
+  static size_t ReadBlockSize(std::istream& is)
   {
-    int blockSize;
-    if(is.read(reinterpret_cast<char*>(&blockSize), sizeof(int))) return blockSize;
-    else throw std::runtime_error("Could not read memory block size");
+    return (size_t)ReadMemoryBlockFileInfo(is, 0).elementCount;
   }
 
   /**
    * \brief Attempts to write a memory block allocated on the CPU to an output stream.
    *
-   * A single integer containing the number of elements in the block is written prior to the block itself.
+   * A MemoryBlockFileHeader describing the block is written prior to the block itself.
    *
    * \param os                  The output stream.
    * \param block               The memory block to write.
+   * \param options             The save options.
    * \throws std::runtime_error If the write is unsuccessful.
    */
   template <typename T>
-  static void WriteBlock(std::ostream& os, const ORUtils::MemoryBlock<T>& block)
+  static void WriteBlock(std::ostream& os, const ORUtils::MemoryBlock<T>& block, const MemoryBlockSaveOptions& options)
   {
-    // Try and write the block's size.
-    if(!os.write(reinterpret_cast<const char *>(&block.dataSize), sizeof(block.dataSize)))
-    {
-      throw std::runtime_error("Could not write memory block size");
-    }
-
-    // Try and write the block's data.
-    if(!os.write(reinterpret_cast<const char *>(block.GetData(MEMORYDEVICE_CPU)), block.dataSize * sizeof(T)))
-    {
-      throw std::runtime_error("Could not write memory block data");
-    }
+    WriteMemoryBlock(os, block.GetData(MEMORYDEVICE_CPU), block.dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value(), options);
   }
 };
 
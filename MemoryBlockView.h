@@ -0,0 +1,97 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "MemoryBlock.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** \brief
+	Non-owning view of a contiguous range of elements on the CPU or the GPU.
+
+	Views are cheap to copy and can be passed by value to kernels. They do
+	not keep the viewed memory alive, so the block they were created from
+	must outlive them and must not be reallocated while they are in use.
+	Use MemoryBlockView<const T> for read-only access.
+	*/
+	template <typename T>
+	class MemoryBlockView
+	{
+	public:
+		/** Pointer to the first element of the view. */
+		DEVICEPTR(T)* data;
+
+		/** Number of elements in the view. */
+		size_t dataSize;
+
+		/** Device the data pointer refers to. */
+		MemoryDeviceType memoryType;
+
+		_CPU_AND_GPU_CODE_ MemoryBlockView()
+			: data(NULL), dataSize(0), memoryType(MEMORYDEVICE_CPU)
+		{}
+
+		_CPU_AND_GPU_CODE_ MemoryBlockView(DEVICEPTR(T)* data, size_t dataSize, MemoryDeviceType memoryType)
+			: data(data), dataSize(dataSize), memoryType(memoryType)
+		{}
+
+		/** View @p count elements of @p block on the given device, starting
+		at element @p begin. By default the view covers the rest of the block.
+		*/
+		template <typename U>
+		MemoryBlockView(MemoryBlock<U>& block, MemoryDeviceType memoryType, size_t begin = 0, size_t count = (size_t)-1)
+		{
+			Initialise(block.GetData(memoryType), block.dataSize, memoryType, begin, count);
+		}
+
+		template <typename U>
+		MemoryBlockView(const MemoryBlock<U>& block, MemoryDeviceType memoryType, size_t begin = 0, size_t count = (size_t)-1)
+		{
+			Initialise(block.GetData(memoryType), block.dataSize, memoryType, begin, count);
+		}
+
+		/** Allow views of T to be used where views of const T are expected. */
+		_CPU_AND_GPU_CODE_ operator MemoryBlockView<const T>() const
+		{
+			return MemoryBlockView<const T>(data, dataSize, memoryType);
+		}
+
+		/** Get the data pointer, or NULL if the view is not on the requested
+		device. Mirrors MemoryBlock::GetData, so code written against blocks
+		can take views instead.
+		*/
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)* GetData(MemoryDeviceType memoryType) const
+		{
+			return memoryType == this->memoryType ? data : NULL;
+		}
+
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)& operator[](size_t i) const { return data[i]; }
+
+		/** View @p count elements of this view, starting at element @p begin. */
+		MemoryBlockView<T> SubView(size_t begin, size_t count = (size_t)-1) const
+		{
+			MemoryBlockView<T> view;
+			view.Initialise(data, dataSize, memoryType, begin, count);
+			return view;
+		}
+
+	private:
+		template <typename U>
+		void Initialise(DEVICEPTR(U)* base, size_t baseSize, MemoryDeviceType memoryType, size_t begin, size_t count)
+		{
+			if (begin > baseSize) DIEWITHEXCEPTION("View starts beyond the end of the memory block");
+			if (count == (size_t)-1) count = baseSize - begin;
+			if (count > baseSize - begin) DIEWITHEXCEPTION("View extends beyond the end of the memory block");
+
+			this->data = base == NULL ? NULL : base + begin;
+			this->dataSize = count;
+			this->memoryType = memoryType;
+		}
+
+		template <typename U> friend class MemoryBlockView;
+	};
+}
+
+#endif
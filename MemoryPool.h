@@ -0,0 +1,268 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "MemoryAllocation.h"
+
+namespace ORUtils
+{
+	/** \brief
+	Process-wide cache of host buffers, grouped into size classes.
+
+	Buffers released to the pool are kept and handed out again to later
+	requests of the same size class, kind and policy, so that blocks that
+	are created and destroyed every frame do not go back to the system
+	allocator (or cudaMallocHost) each time.
+	*/
+	class MemoryPool
+	{
+	public:
+		/** Counters describing how well the pool is doing. */
+		struct Statistics
+		{
+			/** Number of buffers requested from the pool. */
+			size_t requests;
+			/** Requests served from a cached buffer. */
+			size_t hits;
+			/** Requests that had to go to the system allocator. */
+			size_t misses;
+			/** Buffers given back to the pool. */
+			size_t releases;
+			/** Cached buffers returned to the system, either by Trim() or because the pool was full. */
+			size_t evictions;
+			/** Bytes currently held in the pool's free lists. */
+			size_t bytesCached;
+			/** Largest value bytesCached has reached. */
+			size_t peakBytesCached;
+
+			double HitRate() const { return requests == 0 ? 0.0 : (double)hits / (double)requests; }
+		};
+
+	private:
+		struct BucketKey
+		{
+			MemoryAllocationKind kind;
+			HostAllocationMethod method;
+			MemoryAllocationPolicy::PageType pageType;
+			size_t alignment;
+			size_t sizeClass;
+
+			bool operator<(const BucketKey& other) const
+			{
+				if (kind != other.kind) return kind < other.kind;
+				if (method != other.method) return method < other.method;
+				if (pageType != other.pageType) return pageType < other.pageType;
+				if (alignment != other.alignment) return alignment < other.alignment;
+				return sizeClass < other.sizeClass;
+			}
+		};
+
+		struct Bucket
+		{
+			MemoryAllocationPolicy policy;
+			std::vector<void*> buffers;
+		};
+
+		mutable std::mutex mutex;
+		std::map<BucketKey, Bucket> buckets;
+		Statistics statistics;
+		size_t maxCachedBytes;
+		bool enabledByDefault;
+
+		MemoryPool()
+		{
+			memset(&statistics, 0, sizeof(Statistics));
+			maxCachedBytes = (size_t)1 << 30;
+			enabledByDefault = false;
+		}
+
+		static BucketKey MakeKey(size_t sizeClass, MemoryAllocationKind kind, const MemoryAllocationPolicy& policy)
+		{
+			BucketKey key;
+			key.kind = kind;
+			key.method = SelectHostAllocationMethod(kind, policy);
+			key.pageType = EffectivePageType(policy);
+			key.alignment = policy.alignment > DEFAULT_HOST_ALIGNMENT ? policy.alignment : 0;
+			key.sizeClass = sizeClass;
+			return key;
+		}
+
+		/** Free cached buffers until no more than @p targetBytes remain. Expects the mutex to be held. */
+		void EvictUntil(size_t targetBytes)
+		{
+			// Release the largest buffers first, they give back the most memory per call.
+			std::map<BucketKey, Bucket>::reverse_iterator it = buckets.rbegin();
+			while (statistics.bytesCached > targetBytes && it != buckets.rend())
+			{
+				std::vector<void*>& buffers = it->second.buffers;
+				while (statistics.bytesCached > targetBytes && !buffers.empty())
+				{
+					FreeHostMemory(buffers.back(), it->first.sizeClass, it->first.kind, it->second.policy);
+					buffers.pop_back();
+					statistics.bytesCached -= it->first.sizeClass;
+					statistics.evictions++;
+				}
+				++it;
+			}
+		}
+
+	public:
+		/** The process-wide pool. It is intentionally never destroyed, so
+		that blocks living in other static objects can still release into it
+		during shutdown.
+		*/
+		static MemoryPool& Instance()
+		{
+			static MemoryPool *instance = new MemoryPool();
+			return *instance;
+		}
+
+		/** Round a request up to the size class it is served from. Classes are
+		spaced four per power of two, so at most a quarter of a buffer is wasted.
+		*/
+		static size_t RoundToSizeClass(size_t bytes)
+		{
+			const size_t minClass = 256;
+			if (bytes <= minClass) return minClass;
+
+			size_t base = minClass;
+			while (base * 2 < bytes) base *= 2;
+
+			size_t step = base / 4;
+			return (bytes + step - 1) / step * step;
+		}
+
+		/** Whether blocks using POOLING_DEFAULT go through the pool. */
+		bool IsEnabledByDefault() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return enabledByDefault;
+		}
+
+		void SetEnabledByDefault(bool enabled)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			enabledByDefault = enabled;
+		}
+
+		/** Whether an allocation with the given policy should be served by the pool. */
+		bool ShouldPool(const MemoryAllocationPolicy& policy) const
+		{
+			switch (policy.pooling)
+			{
+			case MemoryAllocationPolicy::POOLING_ENABLED: return true;
+			case MemoryAllocationPolicy::POOLING_DISABLED: return false;
+			default: return IsEnabledByDefault();
+			}
+		}
+
+		/** Upper bound on the bytes kept in the free lists. Buffers released
+		beyond this are returned to the system immediately.
+		*/
+		size_t GetMaxCachedBytes() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return maxCachedBytes;
+		}
+
+		void SetMaxCachedBytes(size_t maxCachedBytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->maxCachedBytes = maxCachedBytes;
+			EvictUntil(maxCachedBytes);
+		}
+
+		/** Get a buffer of at least @p bytes, reusing a cached one if possible.
+		The buffer must be given back with Release() using the same size, kind
+		and policy. If @p zeroed is given, it reports whether the buffer is
+		known to be zero, which is never the case for reused buffers.
+		*/
+		void *Acquire(size_t bytes, MemoryAllocationKind kind, const MemoryAllocationPolicy& policy, bool *zeroed = NULL)
+		{
+			size_t sizeClass = RoundToSizeClass(bytes);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				statistics.requests++;
+
+				std::map<BucketKey, Bucket>::iterator it = buckets.find(MakeKey(sizeClass, kind, policy));
+				if (it != buckets.end() && !it->second.buffers.empty())
+				{
+					void *ptr = it->second.buffers.back();
+					it->second.buffers.pop_back();
+					statistics.bytesCached -= sizeClass;
+					statistics.hits++;
+					if (zeroed != NULL) *zeroed = false;
+					return ptr;
+				}
+
+				statistics.misses++;
+			}
+
+			return AllocateHostMemory(sizeClass, kind, policy, zeroed);
+		}
+
+		/** Give a buffer obtained from Acquire() back to the pool. */
+		void Release(void *ptr, size_t bytes, MemoryAllocationKind kind, const MemoryAllocationPolicy& policy)
+		{
+			if (ptr == NULL) return;
+
+			size_t sizeClass = RoundToSizeClass(bytes);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				statistics.releases++;
+
+				if (sizeClass <= maxCachedBytes)
+				{
+					if (statistics.bytesCached + sizeClass > maxCachedBytes) EvictUntil(maxCachedBytes - sizeClass);
+
+					Bucket& bucket = buckets[MakeKey(sizeClass, kind, policy)];
+					bucket.policy = policy;
+					bucket.buffers.push_back(ptr);
+
+					statistics.bytesCached += sizeClass;
+					if (statistics.bytesCached > statistics.peakBytesCached) statistics.peakBytesCached = statistics.bytesCached;
+					return;
+				}
+
+				statistics.evictions++;
+			}
+
+			FreeHostMemory(ptr, sizeClass, kind, policy);
+		}
+
+		/** Return cached buffers to the system until at most @p maxCachedBytes remain. */
+		void Trim(size_t maxCachedBytes = 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			EvictUntil(maxCachedBytes);
+		}
+
+		Statistics GetStatistics() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return statistics;
+		}
+
+		/** Reset all counters; bytesCached keeps reflecting the current contents. */
+		void ResetStatistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t bytesCached = statistics.bytesCached;
+			memset(&statistics, 0, sizeof(Statistics));
+			statistics.bytesCached = bytesCached;
+			statistics.peakBytesCached = bytesCached;
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		MemoryPool(const MemoryPool&) = delete;
+		MemoryPool& operator=(const MemoryPool&) = delete;
+	};
+}
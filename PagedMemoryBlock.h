@@ -0,0 +1,555 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MemoryBlock.h"
+#include "MemoryBlockFormat.h"
+#include "MemoryBlockPersister.h"
+#include "PositionedFile.h"
+
+namespace ORUtils
+{
+	/** \brief
+	Memory block that lives in a file on disk and keeps only a bounded
+	working set of fixed-size pages in memory.
+
+	The backing file is an uncompressed block in the MemoryBlockPersister
+	format, so it can be created by SaveMemoryBlock and read back by
+	LoadMemoryBlock. Pages are loaded on demand and the least recently used
+	unpinned page is evicted, and written back if it was modified, when the
+	budget of resident pages is reached.
+
+	Code that accesses a page directly must Pin() it first, which loads it
+	if necessary and keeps it resident, and Unpin() it afterwards, saying
+	whether it was modified. Read() and Write() do this for element ranges.
+	Prefetch() is a hint that queues pages to be loaded by a background
+	thread. All member functions are thread-safe, and disk I/O is done
+	without holding the lock, so several threads can page at once.
+	*/
+	template <typename T>
+	class PagedMemoryBlock
+	{
+	public:
+		/** PAGING_CREATE creates or truncates the backing file, PAGING_OPEN
+		opens an existing one for update.
+		*/
+		enum Mode { PAGING_CREATE, PAGING_OPEN };
+
+		/** Counters describing how well the working set fits the access pattern. */
+		struct Statistics
+		{
+			/** Pins of pages that were already resident. */
+			size_t hits;
+			/** Pins that had to load their page from disk. */
+			size_t misses;
+			/** Pages dropped from memory to make room for others. */
+			size_t evictions;
+			/** Modified pages written back to disk. */
+			size_t writeBacks;
+			/** Pages loaded by the prefetch thread. */
+			size_t prefetches;
+			/** Pages currently in memory. */
+			size_t residentPages;
+
+			double HitRate() const { return hits + misses == 0 ? 0.0 : (double)hits / (double)(hits + misses); }
+		};
+
+	private:
+		enum FrameState { FRAME_LOADING, FRAME_READY, FRAME_EVICTING };
+
+		struct Frame
+		{
+			size_t page;
+			MemoryBlock<T> *buffer;
+			size_t pinCount;
+			bool dirty;
+			FrameState state;
+			bool inLRU;
+			typename std::list<Frame*>::iterator lruPosition;
+		};
+
+		PositionedFile file;
+		MemoryBlockFileInfo info;
+
+		size_t dataSize;
+		size_t pageSize;
+		size_t maxResidentPages;
+
+		mutable std::mutex mutex;
+		std::condition_variable changed;
+		std::condition_variable prefetchQueued;
+
+		/** The frame holding each page, or NULL if the page is not resident. */
+		std::vector<Frame*> pageTable;
+		/** Resident, unpinned pages, most recently used first. */
+		std::list<Frame*> lru;
+		std::vector<MemoryBlock<T>*> freeBuffers;
+		size_t allocatedBuffers;
+		/** Number of buffers that pages are being read into or written back from. */
+		size_t transitBuffers;
+		/** Pins held on resident pages, in total and by each thread. */
+		size_t totalPins;
+		std::map<std::thread::id, size_t> threadPins;
+		Statistics statistics;
+
+		std::deque<size_t> prefetchQueue;
+		bool stopping;
+		std::thread prefetchThread;
+
+		static MemoryBlockFileInfo OpenBackingFile(PositionedFile& file, Mode mode, size_t dataSize)
+		{
+			if (mode == PAGING_CREATE)
+			{
+				// Page-align the payload, and make the file the right length without writing the data.
+				MemoryBlockSaveOptions options;
+				options.checksum = false;
+				options.payloadAlignment = 4096;
+
+				MemoryBlockFileHeader header = MakeMemoryBlockFileHeader(dataSize, sizeof(T), MemoryBlockTypeTag<T>::Value(),
+					(uint64_t)dataSize * sizeof(T), 0, options);
+				file.Write(&header, sizeof(header), 0);
+
+				char zero = 0;
+				uint64_t fileSize = header.payloadOffset + header.payloadBytes;
+				if (fileSize > sizeof(header)) file.Write(&zero, 1, fileSize - 1);
+				return MakeMemoryBlockFileInfo(header);
+			}
+
+			std::ifstream fs(file.GetFilename().c_str(), std::ios::binary);
+			if (!fs) throw std::runtime_error("Could not open " + file.GetFilename() + " for reading");
+			MemoryBlockFileInfo info = ReadMemoryBlockFileInfo(fs, sizeof(T));
+			CheckMemoryBlockElementType<T>(info, file.GetFilename());
+			if (info.IsCompressed()) throw std::runtime_error(file.GetFilename() + " is compressed and cannot be paged");
+
+			// Writing pages back invalidates the checksum, so remove it now rather than on every writeback.
+			MemoryBlockPersister::ClearBlockChecksum(file, info);
+			return info;
+		}
+
+		size_t PageBegin(size_t page) const { return page * pageSize; }
+		size_t PageEnd(size_t page) const { return page * pageSize + pageSize < dataSize ? page * pageSize + pageSize : dataSize; }
+
+		/** Number of pins held by the calling thread. Expects the mutex to be held. */
+		size_t ThreadPins() const
+		{
+			typename std::map<std::thread::id, size_t>::const_iterator it = threadPins.find(std::this_thread::get_id());
+			return it != threadPins.end() ? it->second : 0;
+		}
+
+		void AddThreadPin()
+		{
+			totalPins++;
+			threadPins[std::this_thread::get_id()]++;
+		}
+
+		void RemoveThreadPin()
+		{
+			totalPins--;
+			typename std::map<std::thread::id, size_t>::iterator it = threadPins.find(std::this_thread::get_id());
+			if (it != threadPins.end() && --it->second == 0) threadPins.erase(it);
+		}
+
+		void AddToLRU(Frame *frame)
+		{
+			lru.push_front(frame);
+			frame->lruPosition = lru.begin();
+			frame->inLRU = true;
+		}
+
+		void RemoveFromLRU(Frame *frame)
+		{
+			if (!frame->inLRU) return;
+			lru.erase(frame->lruPosition);
+			frame->inLRU = false;
+		}
+
+		/** Get a buffer for a page, evicting the least recently used unpinned
+		page if the budget is used up. Expects @p lock to be held; it is
+		released while a modified page is written back. Returns NULL if
+		@p wait is false and no buffer is available without waiting.
+		*/
+		MemoryBlock<T> *AcquireBuffer(std::unique_lock<std::mutex>& lock, bool wait)
+		{
+			for (;;)
+			{
+				if (!freeBuffers.empty())
+				{
+					MemoryBlock<T> *buffer = freeBuffers.back();
+					freeBuffers.pop_back();
+					return buffer;
+				}
+
+				if (allocatedBuffers < maxResidentPages)
+				{
+					allocatedBuffers++;
+					return new MemoryBlock<T>(pageSize, MEMORYDEVICE_CPU, MemoryAllocationPolicy::Uninitialised().Tagged("PagedMemoryBlock"));
+				}
+
+				if (!lru.empty())
+				{
+					Frame *victim = lru.back();
+					RemoveFromLRU(victim);
+
+					if (victim->dirty)
+					{
+						// Keep the page in the table while it is written back, so that anyone pinning it waits for it.
+						victim->state = FRAME_EVICTING;
+						transitBuffers++;
+						lock.unlock();
+						try
+						{
+							WritePage(*victim);
+						}
+						catch (...)
+						{
+							lock.lock();
+							transitBuffers--;
+							victim->state = FRAME_READY;
+							AddToLRU(victim);
+							changed.notify_all();
+							throw;
+						}
+						lock.lock();
+						transitBuffers--;
+						statistics.writeBacks++;
+					}
+
+					MemoryBlock<T> *buffer = victim->buffer;
+					pageTable[victim->page] = NULL;
+					delete victim;
+					statistics.evictions++;
+					statistics.residentPages--;
+					changed.notify_all();
+					return buffer;
+				}
+
+				// Every buffer is pinned or in transit. Wait for another thread to unpin a page or for a transfer
+				// to finish, unless the calling thread holds every pin itself, in which case waiting would block forever.
+				if (!wait) return NULL;
+				if (transitBuffers == 0 && totalPins == ThreadPins())
+					throw std::runtime_error("Cannot load a page: all resident pages of the paged memory block are pinned");
+				changed.wait(lock);
+			}
+		}
+
+		/** Make @p page resident, pinning it if @p pin is set. Expects @p lock
+		to be held. Returns NULL without loading anything if @p pin is false and
+		the page is already resident or no buffer is available.
+		*/
+		Frame *Load(std::unique_lock<std::mutex>& lock, size_t page, bool pin)
+		{
+			for (;;)
+			{
+				Frame *frame = pageTable[page];
+				if (frame == NULL) break;
+				if (!pin) return NULL;
+
+				if (frame->state == FRAME_READY)
+				{
+					statistics.hits++;
+					RemoveFromLRU(frame);
+					frame->pinCount++;
+					AddThreadPin();
+					return frame;
+				}
+
+				changed.wait(lock);
+			}
+
+			Frame *frame = new Frame;
+			frame->page = page;
+			frame->buffer = NULL;
+			frame->pinCount = pin ? 1 : 0;
+			frame->dirty = false;
+			frame->state = FRAME_LOADING;
+			frame->inLRU = false;
+			pageTable[page] = frame;
+
+			try
+			{
+				frame->buffer = AcquireBuffer(lock, pin);
+				if (frame->buffer == NULL)
+				{
+					pageTable[page] = NULL;
+					delete frame;
+					changed.notify_all();
+					return NULL;
+				}
+
+				transitBuffers++;
+				lock.unlock();
+				try
+				{
+					MemoryBlockPersister::ReadBlockRange(file, info, PageBegin(page), PageEnd(page), frame->buffer->GetData(MEMORYDEVICE_CPU));
+				}
+				catch (...)
+				{
+					lock.lock();
+					throw;
+				}
+				lock.lock();
+			}
+			catch (...)
+			{
+				if (frame->buffer != NULL)
+				{
+					freeBuffers.push_back(frame->buffer);
+					transitBuffers--;
+				}
+				pageTable[page] = NULL;
+				delete frame;
+				changed.notify_all();
+				throw;
+			}
+
+			transitBuffers--;
+			frame->state = FRAME_READY;
+			statistics.residentPages++;
+			if (pin)
+			{
+				statistics.misses++;
+				AddThreadPin();
+			}
+			else
+			{
+				statistics.prefetches++;
+				AddToLRU(frame);
+			}
+			changed.notify_all();
+			return frame;
+		}
+
+		void WritePage(const Frame& frame)
+		{
+			MemoryBlockPersister::WriteBlockRange(file, info, PageBegin(frame.page), PageEnd(frame.page), frame.buffer->GetData(MEMORYDEVICE_CPU));
+		}
+
+		void RunPrefetchThread()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			for (;;)
+			{
+				while (prefetchQueue.empty() && !stopping) prefetchQueued.wait(lock);
+				if (stopping) return;
+
+				size_t page = prefetchQueue.front();
+				prefetchQueue.pop_front();
+
+				// Prefetching is only a hint, so give up on pages that cannot be loaded.
+				try { Load(lock, page, false); }
+				catch (...) {}
+			}
+		}
+
+	public:
+		/** Open the backing file @p filename, creating it with @p dataSize
+		zero elements in PAGING_CREATE mode (@p dataSize is ignored in
+		PAGING_OPEN mode). At most @p maxResidentPages pages of @p pageSize
+		elements are kept in memory.
+		*/
+		PagedMemoryBlock(const std::string& filename, Mode mode, size_t pageSize, size_t maxResidentPages, size_t dataSize = 0)
+			: file(filename, mode == PAGING_CREATE ? PositionedFile::OPEN_CREATE : PositionedFile::OPEN_READ_WRITE),
+			  info(OpenBackingFile(file, mode, dataSize)),
+			  pageSize(pageSize > 0 ? pageSize : 1), maxResidentPages(maxResidentPages > 0 ? maxResidentPages : 1),
+			  allocatedBuffers(0), transitBuffers(0), totalPins(0), stopping(false)
+		{
+			this->dataSize = (size_t)info.elementCount;
+			pageTable.resize((this->dataSize + this->pageSize - 1) / this->pageSize, NULL);
+			memset(&statistics, 0, sizeof(Statistics));
+			prefetchThread = std::thread(&PagedMemoryBlock::RunPrefetchThread, this);
+		}
+
+		/** Write back modified pages and release the working set. Pages must
+		not be pinned any more.
+		*/
+		~PagedMemoryBlock()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			prefetchQueued.notify_all();
+			prefetchThread.join();
+
+			// Errors cannot be reported from a destructor; call Flush() first to see them.
+			try { Flush(); }
+			catch (...) {}
+
+			for (size_t i = 0; i < pageTable.size(); ++i)
+			{
+				if (pageTable[i] == NULL) continue;
+				delete pageTable[i]->buffer;
+				delete pageTable[i];
+			}
+			for (size_t i = 0; i < freeBuffers.size(); ++i) delete freeBuffers[i];
+		}
+
+		inline size_t GetDataSize() const { return dataSize; }
+		inline size_t GetPageSize() const { return pageSize; }
+		inline size_t GetPageCount() const { return pageTable.size(); }
+		inline size_t GetMaxResidentPages() const { return maxResidentPages; }
+		inline const std::string& GetFilename() const { return file.GetFilename(); }
+
+		/** Index of the page holding element @p index. */
+		inline size_t GetPageIndex(size_t index) const { return index / pageSize; }
+
+		/** Number of elements in @p page, which is pageSize except for the last page. */
+		inline size_t GetPageElements(size_t page) const { return PageEnd(page) - PageBegin(page); }
+
+		/** Load @p page if necessary and keep it resident until the matching
+		Unpin(), which must be called from the same thread. The returned
+		pointer to the page's first element is valid until then. If every
+		resident page is pinned, this waits for another thread to unpin one,
+		or throws std::runtime_error if the calling thread holds all the pins.
+		*/
+		T *Pin(size_t page)
+		{
+			if (page >= pageTable.size()) throw std::runtime_error("Cannot pin a page beyond the end of the paged memory block");
+
+			std::unique_lock<std::mutex> lock(mutex);
+			return Load(lock, page, true)->buffer->GetData(MEMORYDEVICE_CPU);
+		}
+
+		/** Release a pin taken by Pin(). Set @p dirty if the page was
+		modified, so that it is written back before being evicted.
+		*/
+		void Unpin(size_t page, bool dirty = false)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Frame *frame = page < pageTable.size() ? pageTable[page] : NULL;
+			if (frame == NULL || frame->state != FRAME_READY || frame->pinCount == 0)
+				throw std::runtime_error("Cannot unpin a page that is not pinned");
+
+			if (dirty) frame->dirty = true;
+			RemoveThreadPin();
+			if (--frame->pinCount == 0)
+			{
+				AddToLRU(frame);
+				changed.notify_all();
+			}
+		}
+
+		/** Hint that elements [begin, end) will be needed soon. Their pages
+		are loaded in the background, as long as that does not require waiting
+		for pinned pages.
+		*/
+		void Prefetch(size_t begin, size_t end)
+		{
+			if (end > dataSize) end = dataSize;
+			if (begin >= end) return;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t page = GetPageIndex(begin), last = GetPageIndex(end - 1); page <= last; ++page)
+				{
+					if (pageTable[page] == NULL) prefetchQueue.push_back(page);
+				}
+			}
+			prefetchQueued.notify_one();
+		}
+
+		/** Copy elements [begin, end) into @p dst, paging them in as needed. */
+		void Read(size_t begin, size_t end, T *dst)
+		{
+			if (begin > end || end > dataSize) throw std::runtime_error("Cannot read beyond the end of the paged memory block");
+
+			while (begin < end)
+			{
+				size_t page = GetPageIndex(begin);
+				size_t count = (PageEnd(page) < end ? PageEnd(page) : end) - begin;
+				const T *data = Pin(page);
+				memcpy(dst, data + (begin - PageBegin(page)), count * sizeof(T));
+				Unpin(page);
+				dst += count; begin += count;
+			}
+		}
+
+		/** Copy @p src into elements [begin, end), paging them in as needed. */
+		void Write(size_t begin, size_t end, const T *src)
+		{
+			if (begin > end || end > dataSize) throw std::runtime_error("Cannot write beyond the end of the paged memory block");
+
+			while (begin < end)
+			{
+				size_t page = GetPageIndex(begin);
+				size_t count = (PageEnd(page) < end ? PageEnd(page) : end) - begin;
+				T *data = Pin(page);
+				memcpy(data + (begin - PageBegin(page)), src, count * sizeof(T));
+				Unpin(page, true);
+				src += count; begin += count;
+			}
+		}
+
+		/** Write every modified resident page back to the backing file. Pages
+		stay resident.
+		*/
+		void Flush()
+		{
+			std::vector<Frame*> frames;
+			{
+				// Pin the modified pages so that they are not evicted while being written.
+				std::lock_guard<std::mutex> lock(mutex);
+				for (size_t i = 0; i < pageTable.size(); ++i)
+				{
+					Frame *frame = pageTable[i];
+					if (frame == NULL || frame->state != FRAME_READY || !frame->dirty) continue;
+					RemoveFromLRU(frame);
+					frame->pinCount++;
+					frame->dirty = false;
+					frames.push_back(frame);
+				}
+				totalPins += frames.size();
+			}
+
+			size_t written = 0;
+			try
+			{
+				for (; written < frames.size(); ++written) WritePage(*frames[written]);
+			}
+			catch (...) {}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < frames.size(); ++i)
+			{
+				if (i >= written) frames[i]->dirty = true;
+				if (--frames[i]->pinCount == 0) AddToLRU(frames[i]);
+			}
+			totalPins -= frames.size();
+			statistics.writeBacks += written;
+			changed.notify_all();
+			if (written < frames.size()) throw std::runtime_error("Could not write back the pages of " + file.GetFilename());
+		}
+
+		Statistics GetStatistics() const
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return statistics;
+		}
+
+		/** Zero the counters, except for the number of resident pages. */
+		void ResetStatistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t residentPages = statistics.residentPages;
+			memset(&statistics, 0, sizeof(Statistics));
+			statistics.residentPages = residentPages;
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		PagedMemoryBlock(const PagedMemoryBlock&) = delete;
+		PagedMemoryBlock& operator=(const PagedMemoryBlock&) = delete;
+	};
+}
@@ -0,0 +1,195 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <functional>
+#include <thread>
+
+#include "ImageView.h"
+#include "ThreadPool.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** \brief
+	Tuning knobs for ForEachPixel, ForEachElement and ForEachNeighbourhood.
+	*/
+	struct ParallelForConfig
+	{
+		/** Number of threads, including the calling one, 0 for one per hardware thread. */
+		unsigned int numThreads;
+
+		/** Size of the tiles images are split into; each tile is one task. */
+		Vector2<int> tileSize;
+
+		/** Number of elements of a memory block per task. */
+		size_t grainSize;
+
+		/** Run every task in order on the calling thread, e.g. for debugging. */
+		bool serial;
+
+		ParallelForConfig()
+		{
+			numThreads = 0;
+			tileSize = Vector2<int>(64, 16);
+			grainSize = 16384;
+			serial = false;
+		}
+
+		/** The process-wide configuration. */
+		static ParallelForConfig& Instance()
+		{
+			static ParallelForConfig instance;
+			return instance;
+		}
+	};
+
+	namespace ParallelForDetail
+	{
+		inline unsigned int NumThreads(const ParallelForConfig& config)
+		{
+			unsigned int numThreads = config.numThreads;
+			if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+			return numThreads == 0 ? 1 : numThreads;
+		}
+
+		/** Run @p op(i) for every i in [0, @p count), serially or on the thread pool as configured. */
+		inline void Run(size_t count, const ParallelForConfig& config, const std::function<void(size_t)>& op)
+		{
+			if (config.serial)
+			{
+				for (size_t i = 0; i < count; ++i) op(i);
+			}
+			else ThreadPool::Instance().Run(count, NumThreads(config), op);
+		}
+
+		/** Run @p op(x, y) for every pixel of a @p noDims image, one tile per task. */
+		template <typename Op>
+		inline void RunTiled(Vector2<int> noDims, const ParallelForConfig& config, const Op& op)
+		{
+			if (noDims.x <= 0 || noDims.y <= 0) return;
+
+			Vector2<int> tile(config.tileSize.x > 0 ? config.tileSize.x : noDims.x, config.tileSize.y > 0 ? config.tileSize.y : 1);
+			int tilesX = (noDims.x + tile.x - 1) / tile.x, tilesY = (noDims.y + tile.y - 1) / tile.y;
+
+			Run((size_t)tilesX * tilesY, config, [&](size_t t)
+			{
+				int x0 = (int)(t % tilesX) * tile.x, y0 = (int)(t / tilesX) * tile.y;
+				int x1 = x0 + tile.x < noDims.x ? x0 + tile.x : noDims.x;
+				int y1 = y0 + tile.y < noDims.y ? y0 + tile.y : noDims.y;
+
+				for (int y = y0; y < y1; ++y)
+					for (int x = x0; x < x1; ++x) op(x, y);
+			});
+		}
+	}
+
+	/** \brief
+	Read-only access to the pixels around one pixel of an image, with
+	coordinates outside the image clamped to its border.
+	*/
+	template <typename T>
+	struct PixelNeighbourhood
+	{
+		ImageView<const T> image;
+
+		/** Coordinates of the centre pixel. */
+		int x, y;
+
+		_CPU_AND_GPU_CODE_ PixelNeighbourhood(const ImageView<const T>& image, int x, int y)
+			: image(image), x(x), y(y)
+		{}
+
+		_CPU_AND_GPU_CODE_ inline const T& Centre() const { return image(x, y); }
+
+		/** Get the pixel at offset (@p dx, @p dy) from the centre. */
+		_CPU_AND_GPU_CODE_ inline const T& operator()(int dx, int dy) const
+		{
+			return image(CLAMP(x + dx, 0, image.noDims.x - 1), CLAMP(y + dy, 0, image.noDims.y - 1));
+		}
+
+		/** Whether every offset up to @p radius in each direction lies inside the image. */
+		_CPU_AND_GPU_CODE_ inline bool IsInterior(int radius) const
+		{
+			return x >= radius && y >= radius && x + radius < image.noDims.x && y + radius < image.noDims.y;
+		}
+	};
+
+	/** Run @p f(x, y) for every pixel of a @p noDims image. The pixels are
+	split into tiles of ParallelForConfig::tileSize that run in parallel,
+	so @p f must be safe to call concurrently for different pixels.
+	*/
+	template <typename F>
+	inline void ForEachPixel(Vector2<int> noDims, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		ParallelForDetail::RunTiled(noDims, config, [&](int x, int y) { f(x, y); });
+	}
+
+	/** Run @p f(pixel, x, y) for every pixel of @p image, which must be on the CPU. */
+	template <typename T, typename F>
+	inline void ForEachPixel(const ImageView<T>& image, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		if (image.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("ForEachPixel can only run on images on the CPU");
+		ParallelForDetail::RunTiled(image.noDims, config, [&](int x, int y) { f(image(x, y), x, y); });
+	}
+
+	template <typename T, typename F>
+	inline void ForEachPixel(Image<T>& image, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		ForEachPixel(ImageView<T>(image, MEMORYDEVICE_CPU), f, config);
+	}
+
+	template <typename T, typename F>
+	inline void ForEachPixel(const Image<T>& image, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		ForEachPixel(ImageView<const T>(image, MEMORYDEVICE_CPU), f, config);
+	}
+
+	/** Run @p f(neighbourhood, x, y) for every pixel of @p image, which must
+	be on the CPU, where neighbourhood is a PixelNeighbourhood<T> around (x, y).
+	*/
+	template <typename T, typename F>
+	inline void ForEachNeighbourhood(const ImageView<const T>& image, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		if (image.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("ForEachNeighbourhood can only run on images on the CPU");
+		ParallelForDetail::RunTiled(image.noDims, config, [&](int x, int y) { f(PixelNeighbourhood<T>(image, x, y), x, y); });
+	}
+
+	template <typename T, typename F>
+	inline void ForEachNeighbourhood(const Image<T>& image, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		ForEachNeighbourhood(ImageView<const T>(image, MEMORYDEVICE_CPU), f, config);
+	}
+
+	/** Run @p f(i) for every i in [0, @p count), ParallelForConfig::grainSize
+	indices per task.
+	*/
+	template <typename F>
+	inline void ForEachElement(size_t count, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		size_t grain = config.grainSize > 0 ? config.grainSize : 1;
+		ParallelForDetail::Run((count + grain - 1) / grain, config, [&](size_t t)
+		{
+			size_t end = (t + 1) * grain < count ? (t + 1) * grain : count;
+			for (size_t i = t * grain; i < end; ++i) f(i);
+		});
+	}
+
+	/** Run @p f(element, i) for every element of the CPU data of @p block. */
+	template <typename T, typename F>
+	inline void ForEachElement(MemoryBlock<T>& block, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		T *data = block.GetData(MEMORYDEVICE_CPU);
+		ForEachElement(block.dataSize, [&](size_t i) { f(data[i], i); }, config);
+	}
+
+	template <typename T, typename F>
+	inline void ForEachElement(const MemoryBlock<T>& block, const F& f, const ParallelForConfig& config = ParallelForConfig::Instance())
+	{
+		const T *data = block.GetData(MEMORYDEVICE_CPU);
+		ForEachElement(block.dataSize, [&](size_t i) { f(data[i], i); }, config);
+	}
+}
+
+#endif
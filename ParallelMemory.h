@@ -0,0 +1,177 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+
+#include "ThreadPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORUTILS_HAS_SSE2
+#endif
+
+namespace ORUtils
+{
+	/** \brief
+	Tuning knobs for the bulk CPU memory operations used by MemoryBlock.
+	*/
+	struct ParallelMemoryConfig
+	{
+		/** Operations on fewer bytes than this run as a single memset/memcpy. */
+		size_t parallelThreshold;
+
+		/** Number of worker threads for large operations, 0 for one per hardware thread. */
+		unsigned int numThreads;
+
+		/** Operations on at least this many bytes use streaming stores that
+		bypass the cache, so that clearing or copying a huge block does not
+		evict everything else. Set to SIZE_MAX to disable.
+		*/
+		size_t nonTemporalThreshold;
+
+		ParallelMemoryConfig()
+		{
+			parallelThreshold = (size_t)32 << 20;
+			numThreads = 0;
+			nonTemporalThreshold = (size_t)256 << 20;
+		}
+
+		/** The process-wide configuration. */
+		static ParallelMemoryConfig& Instance()
+		{
+			static ParallelMemoryConfig instance;
+			return instance;
+		}
+	};
+
+	namespace ParallelMemoryDetail
+	{
+		/** Set @p bytes at @p dst to @p value, using streaming stores for the 16-byte aligned body if requested. */
+		inline void SetRange(unsigned char *dst, unsigned char value, size_t bytes, bool nonTemporal)
+		{
+#ifdef ORUTILS_HAS_SSE2
+			if (nonTemporal)
+			{
+				size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+				if (head > bytes) head = bytes;
+				memset(dst, value, head);
+				dst += head; bytes -= head;
+
+				__m128i v = _mm_set1_epi8((char)value);
+				size_t body = bytes & ~(size_t)63;
+				for (size_t i = 0; i < body; i += 64)
+				{
+					_mm_stream_si128((__m128i*)(dst + i), v);
+					_mm_stream_si128((__m128i*)(dst + i + 16), v);
+					_mm_stream_si128((__m128i*)(dst + i + 32), v);
+					_mm_stream_si128((__m128i*)(dst + i + 48), v);
+				}
+				_mm_sfence();
+
+				memset(dst + body, value, bytes - body);
+				return;
+			}
+#endif
+			memset(dst, value, bytes);
+		}
+
+		/** Copy @p bytes from @p src to @p dst, using streaming stores for the 16-byte aligned body if requested. */
+		inline void CopyRange(unsigned char *dst, const unsigned char *src, size_t bytes, bool nonTemporal)
+		{
+#ifdef ORUTILS_HAS_SSE2
+			if (nonTemporal)
+			{
+				size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+				if (head > bytes) head = bytes;
+				memcpy(dst, src, head);
+				dst += head; src += head; bytes -= head;
+
+				size_t body = bytes & ~(size_t)63;
+				for (size_t i = 0; i < body; i += 64)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+					__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+					__m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+					__m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+					_mm_stream_si128((__m128i*)(dst + i), a);
+					_mm_stream_si128((__m128i*)(dst + i + 16), b);
+					_mm_stream_si128((__m128i*)(dst + i + 32), c);
+					_mm_stream_si128((__m128i*)(dst + i + 48), d);
+				}
+				_mm_sfence();
+
+				memcpy(dst + body, src + body, bytes - body);
+				return;
+			}
+#endif
+			memcpy(dst, src, bytes);
+		}
+
+		inline unsigned int NumThreads(const ParallelMemoryConfig& config)
+		{
+			unsigned int numThreads = config.numThreads;
+			if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+			return numThreads == 0 ? 1 : numThreads;
+		}
+
+		/** Split [0, count) into at most @p numThreads slices whose starts are
+		multiples of @p granularity, pages for byte ranges by default, and run
+		@p op(offset, length) on each on the shared thread pool.
+		*/
+		template <typename Op>
+		inline void RunSliced(size_t count, unsigned int numThreads, const Op& op, size_t granularity = 4096)
+		{
+			if (count == 0) return;
+
+			size_t slice = ((count + numThreads - 1) / numThreads + granularity - 1) / granularity * granularity;
+			ThreadPool::Instance().Run((count + slice - 1) / slice, numThreads, [&](size_t i)
+			{
+				size_t offset = i * slice;
+				op(offset, count - offset < slice ? count - offset : slice);
+			});
+		}
+
+		struct SetOp
+		{
+			unsigned char *dst; unsigned char value; bool nonTemporal;
+			void operator()(size_t offset, size_t length) const { SetRange(dst + offset, value, length, nonTemporal); }
+		};
+
+		struct CopyOp
+		{
+			unsigned char *dst; const unsigned char *src; bool nonTemporal;
+			void operator()(size_t offset, size_t length) const { CopyRange(dst + offset, src + offset, length, nonTemporal); }
+		};
+	}
+
+	/** memset replacement that splits large ranges across threads and uses
+	streaming stores for very large ones, as configured by ParallelMemoryConfig.
+	*/
+	inline void ParallelMemset(void *dst, unsigned char value, size_t bytes, const ParallelMemoryConfig& config = ParallelMemoryConfig::Instance())
+	{
+		ParallelMemoryDetail::SetOp op;
+		op.dst = (unsigned char*)dst; op.value = value; op.nonTemporal = bytes >= config.nonTemporalThreshold;
+
+		unsigned int numThreads = ParallelMemoryDetail::NumThreads(config);
+		if (bytes < config.parallelThreshold || numThreads == 1) op(0, bytes);
+		else ParallelMemoryDetail::RunSliced(bytes, numThreads, op);
+	}
+
+	/** memcpy replacement that splits large ranges across threads and uses
+	streaming stores for very large ones, as configured by ParallelMemoryConfig.
+	The ranges must not overlap.
+	*/
+	inline void ParallelMemcpy(void *dst, const void *src, size_t bytes, const ParallelMemoryConfig& config = ParallelMemoryConfig::Instance())
+	{
+		ParallelMemoryDetail::CopyOp op;
+		op.dst = (unsigned char*)dst; op.src = (const unsigned char*)src; op.nonTemporal = bytes >= config.nonTemporalThreshold;
+
+		unsigned int numThreads = ParallelMemoryDetail::NumThreads(config);
+		if (bytes < config.parallelThreshold || numThreads == 1) op(0, bytes);
+		else ParallelMemoryDetail::RunSliced(bytes, numThreads, op);
+	}
+}
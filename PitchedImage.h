@@ -0,0 +1,185 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "ImageView.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** \brief
+	Represents images whose rows start on aligned boundaries, templated on
+	the pixel type.
+
+	Each row is padded to a multiple of the row alignment, so row-wise SIMD
+	code can use aligned loads and camera buffers with padded rows can be
+	stored without repacking. Pixels must be addressed through GetRow(),
+	GetPixelIndex() or an ImageView, as the data is not tightly packed.
+	*/
+	template <typename T>
+	class PitchedImage : public MemoryBlock < T >
+	{
+	public:
+		/** Size of the image in pixels. */
+		Vector2<int> noDims;
+
+		/** Distance between the starts of two consecutive rows, in elements. */
+		int pitch;
+
+		/** Alignment of the start of every row, in bytes. */
+		size_t rowAlignment;
+
+		/** Initialize an empty image of the given size, on CPU only or on
+		both CPU and GPU, with rows aligned to @p rowAlignment bytes.
+		*/
+		PitchedImage(Vector2<int> noDims, bool allocate_CPU, bool allocate_CUDA, size_t rowAlignment = 64,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>((size_t)ComputePitch(noDims.x, rowAlignment) * noDims.y, allocate_CPU, allocate_CUDA, false, AlignedPolicy(policy, rowAlignment))
+		{
+			this->noDims = noDims;
+			this->pitch = ComputePitch(noDims.x, rowAlignment);
+			this->rowAlignment = rowAlignment;
+		}
+
+		PitchedImage(Vector2<int> noDims, MemoryDeviceType memoryType, size_t rowAlignment = 64,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>((size_t)ComputePitch(noDims.x, rowAlignment) * noDims.y, memoryType == MEMORYDEVICE_CPU, memoryType == MEMORYDEVICE_CUDA, false, AlignedPolicy(policy, rowAlignment))
+		{
+			this->noDims = noDims;
+			this->pitch = ComputePitch(noDims.x, rowAlignment);
+			this->rowAlignment = rowAlignment;
+		}
+
+		/** Number of elements per row for an image @p width pixels wide whose
+		rows start on @p rowAlignment byte boundaries.
+		*/
+		static int ComputePitch(int width, size_t rowAlignment)
+		{
+			// Rows must be a whole number of elements as well as a multiple of
+			// the alignment, so round up to the least common multiple of both.
+			size_t a = rowAlignment == 0 ? 1 : rowAlignment, b = sizeof(T);
+			while (b != 0) { size_t t = a % b; a = b; b = t; }
+			size_t step = (rowAlignment == 0 ? 1 : rowAlignment) / a * sizeof(T);
+
+			size_t rowBytes = (size_t)width * sizeof(T);
+			return (int)((rowBytes + step - 1) / step * step / sizeof(T));
+		}
+
+		/** Index of pixel (@p x, @p y) in the data array. */
+		_CPU_AND_GPU_CODE_ inline int GetPixelIndex(int x, int y) const { return y * pitch + x; }
+
+		/** Get a pointer to the first pixel of row @p y on CPU or GPU. */
+		inline T *GetRow(int y, MemoryDeviceType memoryType) { return this->GetData(memoryType) + (size_t)y * pitch; }
+		inline const T *GetRow(int y, MemoryDeviceType memoryType) const { return this->GetData(memoryType) + (size_t)y * pitch; }
+
+		/** Get a pitch-aware view of the image on CPU or GPU. */
+		inline ImageView<T> GetView(MemoryDeviceType memoryType) { return ImageView<T>(this->GetData(memoryType), noDims, pitch, memoryType); }
+		inline ImageView<const T> GetView(MemoryDeviceType memoryType) const { return ImageView<const T>(this->GetData(memoryType), noDims, pitch, memoryType); }
+
+		/** Resize an image, loosing all old image data. The memory is reused
+		if the new size fits in the current capacity. The row alignment and
+		allocation policy are kept. The data is undefined afterwards, unless
+		the allocation policy is INITIALISE_ZEROED.
+		*/
+		void ChangeDims(Vector2<int> newDims)
+		{
+			if (newDims != noDims)
+			{
+				this->noDims = newDims;
+				this->pitch = ComputePitch(newDims.x, rowAlignment);
+
+				this->Resize((size_t)pitch * newDims.y);
+				this->InitialiseResizedData();
+			}
+		}
+
+		/** Preallocate memory for images up to @p maxDims in size. */
+		void Reserve(Vector2<int> maxDims)
+		{
+			MemoryBlock<T>::Reserve((size_t)ComputePitch(maxDims.x, rowAlignment) * maxDims.y);
+		}
+
+		/** Copy a packed image of the same size into this one. */
+		void SetFrom(const Image<T> *source, typename MemoryBlock<T>::MemoryCopyDirection memoryCopyDirection)
+		{
+			MemoryDeviceType sourceType, destinationType;
+			GetDeviceTypes(memoryCopyDirection, sourceType, destinationType);
+			CopyImageView(GetView(destinationType), ImageView<const T>(*source, sourceType));
+		}
+
+		/** Copy another pitched image of the same size into this one. */
+		void SetFrom(const PitchedImage<T> *source, typename MemoryBlock<T>::MemoryCopyDirection memoryCopyDirection)
+		{
+			MemoryDeviceType sourceType, destinationType;
+			GetDeviceTypes(memoryCopyDirection, sourceType, destinationType);
+			CopyImageView(GetView(destinationType), source->GetView(sourceType));
+		}
+
+		/** Copy this image into a packed image of the same size. */
+		void CopyTo(Image<T> *destination, typename MemoryBlock<T>::MemoryCopyDirection memoryCopyDirection) const
+		{
+			MemoryDeviceType sourceType, destinationType;
+			GetDeviceTypes(memoryCopyDirection, sourceType, destinationType);
+			CopyImageView(ImageView<T>(*destination, destinationType), GetView(sourceType));
+		}
+
+		/** Exchange the contents and layout of two images without copying data. */
+		void Swap(PitchedImage& other) noexcept
+		{
+			MemoryBlock<T>::Swap(other);
+			std::swap(this->noDims, other.noDims);
+			std::swap(this->pitch, other.pitch);
+			std::swap(this->rowAlignment, other.rowAlignment);
+		}
+
+		PitchedImage(PitchedImage&& other) noexcept
+			: MemoryBlock<T>(std::move(other))
+		{
+			this->noDims = other.noDims;
+			this->pitch = other.pitch;
+			this->rowAlignment = other.rowAlignment;
+			other.noDims = Vector2<int>(0, 0);
+			other.pitch = 0;
+		}
+
+		PitchedImage& operator=(PitchedImage&& other) noexcept
+		{
+			if (this != &other)
+			{
+				MemoryBlock<T>::operator=(std::move(other));
+				this->noDims = other.noDims;
+				this->pitch = other.pitch;
+				this->rowAlignment = other.rowAlignment;
+				other.noDims = Vector2<int>(0, 0);
+				other.pitch = 0;
+			}
+			return *this;
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		PitchedImage(const PitchedImage&) = delete;
+		PitchedImage& operator=(const PitchedImage&) = delete;
+
+	private:
+		/** Raise the alignment requested by @p policy so that the first row is aligned too. */
+		static MemoryAllocationPolicy AlignedPolicy(MemoryAllocationPolicy policy, size_t rowAlignment)
+		{
+			if (policy.alignment < rowAlignment) policy.alignment = rowAlignment;
+			return policy;
+		}
+
+		static void GetDeviceTypes(typename MemoryBlock<T>::MemoryCopyDirection memoryCopyDirection, MemoryDeviceType& sourceType, MemoryDeviceType& destinationType)
+		{
+			switch (memoryCopyDirection)
+			{
+			case MemoryBlock<T>::CPU_TO_CPU: sourceType = MEMORYDEVICE_CPU; destinationType = MEMORYDEVICE_CPU; break;
+			case MemoryBlock<T>::CPU_TO_CUDA: sourceType = MEMORYDEVICE_CPU; destinationType = MEMORYDEVICE_CUDA; break;
+			case MemoryBlock<T>::CUDA_TO_CPU: sourceType = MEMORYDEVICE_CUDA; destinationType = MEMORYDEVICE_CPU; break;
+			default: sourceType = MEMORYDEVICE_CUDA; destinationType = MEMORYDEVICE_CUDA; break;
+			}
+		}
+	};
+}
+
+#endif
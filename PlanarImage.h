@@ -0,0 +1,349 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <type_traits>
+
+#include "ImageView.h"
+#include "ParallelMemory.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	namespace PlanarImageDetail
+	{
+		/** Conversion of @p n pixels between interleaved Vector4<T> and four
+		separate component arrays. The generic versions work for any
+		component type; float and unsigned char have SSE2 versions.
+		*/
+		template <typename T>
+		struct Kernels
+		{
+			static void Split(const Vector4<T> *src, T *const planes[4], int n)
+			{
+				for (int i = 0; i < n; ++i)
+					for (int c = 0; c < 4; ++c) planes[c][i] = src[i].v[c];
+			}
+
+			static void Merge(const T *const planes[4], Vector4<T> *dst, int n)
+			{
+				for (int i = 0; i < n; ++i)
+					for (int c = 0; c < 4; ++c) dst[i].v[c] = planes[c][i];
+			}
+		};
+
+#ifdef ORUTILS_HAS_SSE2
+		template <>
+		struct Kernels<float>
+		{
+			static void Split(const Vector4<float> *src, float *const planes[4], int n)
+			{
+				int i = 0;
+				for (; i + 4 <= n; i += 4)
+				{
+					__m128 p0 = _mm_loadu_ps(src[i].v), p1 = _mm_loadu_ps(src[i + 1].v);
+					__m128 p2 = _mm_loadu_ps(src[i + 2].v), p3 = _mm_loadu_ps(src[i + 3].v);
+					_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+					_mm_storeu_ps(planes[0] + i, p0);
+					_mm_storeu_ps(planes[1] + i, p1);
+					_mm_storeu_ps(planes[2] + i, p2);
+					_mm_storeu_ps(planes[3] + i, p3);
+				}
+				for (; i < n; ++i)
+					for (int c = 0; c < 4; ++c) planes[c][i] = src[i].v[c];
+			}
+
+			static void Merge(const float *const planes[4], Vector4<float> *dst, int n)
+			{
+				int i = 0;
+				for (; i + 4 <= n; i += 4)
+				{
+					__m128 p0 = _mm_loadu_ps(planes[0] + i), p1 = _mm_loadu_ps(planes[1] + i);
+					__m128 p2 = _mm_loadu_ps(planes[2] + i), p3 = _mm_loadu_ps(planes[3] + i);
+					_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+					_mm_storeu_ps(dst[i].v, p0);
+					_mm_storeu_ps(dst[i + 1].v, p1);
+					_mm_storeu_ps(dst[i + 2].v, p2);
+					_mm_storeu_ps(dst[i + 3].v, p3);
+				}
+				for (; i < n; ++i)
+					for (int c = 0; c < 4; ++c) dst[i].v[c] = planes[c][i];
+			}
+		};
+
+		template <>
+		struct Kernels<unsigned char>
+		{
+			static void Split(const Vector4<unsigned char> *src, unsigned char *const planes[4], int n)
+			{
+				int i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					__m128i a = _mm_loadu_si128((const __m128i*)(src + i)), b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+					__m128i c = _mm_loadu_si128((const __m128i*)(src + i + 8)), d = _mm_loadu_si128((const __m128i*)(src + i + 12));
+
+					// Three rounds of byte interleaving gather each component of
+					// eight pixels into one half of a register.
+					__m128i t0 = _mm_unpacklo_epi8(a, b), t1 = _mm_unpackhi_epi8(a, b);
+					__m128i t2 = _mm_unpacklo_epi8(c, d), t3 = _mm_unpackhi_epi8(c, d);
+					__m128i u0 = _mm_unpacklo_epi8(t0, t1), u1 = _mm_unpackhi_epi8(t0, t1);
+					__m128i u2 = _mm_unpacklo_epi8(t2, t3), u3 = _mm_unpackhi_epi8(t2, t3);
+					__m128i xy0 = _mm_unpacklo_epi8(u0, u1), zw0 = _mm_unpackhi_epi8(u0, u1);
+					__m128i xy1 = _mm_unpacklo_epi8(u2, u3), zw1 = _mm_unpackhi_epi8(u2, u3);
+
+					_mm_storeu_si128((__m128i*)(planes[0] + i), _mm_unpacklo_epi64(xy0, xy1));
+					_mm_storeu_si128((__m128i*)(planes[1] + i), _mm_unpackhi_epi64(xy0, xy1));
+					_mm_storeu_si128((__m128i*)(planes[2] + i), _mm_unpacklo_epi64(zw0, zw1));
+					_mm_storeu_si128((__m128i*)(planes[3] + i), _mm_unpackhi_epi64(zw0, zw1));
+				}
+				for (; i < n; ++i)
+					for (int c = 0; c < 4; ++c) planes[c][i] = src[i].v[c];
+			}
+
+			static void Merge(const unsigned char *const planes[4], Vector4<unsigned char> *dst, int n)
+			{
+				int i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					__m128i x = _mm_loadu_si128((const __m128i*)(planes[0] + i)), y = _mm_loadu_si128((const __m128i*)(planes[1] + i));
+					__m128i z = _mm_loadu_si128((const __m128i*)(planes[2] + i)), w = _mm_loadu_si128((const __m128i*)(planes[3] + i));
+
+					__m128i xy0 = _mm_unpacklo_epi8(x, y), xy1 = _mm_unpackhi_epi8(x, y);
+					__m128i zw0 = _mm_unpacklo_epi8(z, w), zw1 = _mm_unpackhi_epi8(z, w);
+
+					_mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(xy0, zw0));
+					_mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(xy0, zw0));
+					_mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(xy1, zw1));
+					_mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(xy1, zw1));
+				}
+				for (; i < n; ++i)
+					for (int c = 0; c < 4; ++c) dst[i].v[c] = planes[c][i];
+			}
+		};
+#endif
+	}
+
+	/** \brief
+	Non-owning view of a PlanarImage on the CPU or the GPU.
+
+	Indexing a view gives whole Vector4<T> pixels, and the pixels of a
+	writable view can be assigned like those of an array, as in
+	view(x, y) = pixel, so per-pixel kernels written for Image<Vector4<T> >
+	data can take a view instead. The components of a pixel live in
+	different planes, so a single one is written with view(x, y)[c] rather
+	than view(x, y).w. Kernels that only need some components can use the
+	planes directly.
+	*/
+	template <typename T>
+	class PlanarImageView
+	{
+	public:
+		/** Pixel type, without the const of read-only views. */
+		typedef Vector4<typename std::remove_const<T>::type> Pixel;
+
+		/** Writable reference to one pixel, spread over the four planes. */
+		class PixelReference
+		{
+		private:
+			DEVICEPTR(T)* element;
+			size_t planeStride;
+
+		public:
+			_CPU_AND_GPU_CODE_ PixelReference(DEVICEPTR(T)* element, size_t planeStride)
+				: element(element), planeStride(planeStride)
+			{}
+
+			_CPU_AND_GPU_CODE_ inline operator Pixel() const
+			{
+				return Pixel(element[0], element[planeStride], element[2 * planeStride], element[3 * planeStride]);
+			}
+
+			_CPU_AND_GPU_CODE_ inline const PixelReference& operator=(const Pixel& pixel) const
+			{
+				element[0] = pixel.x;
+				element[planeStride] = pixel.y;
+				element[2 * planeStride] = pixel.z;
+				element[3 * planeStride] = pixel.w;
+				return *this;
+			}
+
+			_CPU_AND_GPU_CODE_ inline const PixelReference& operator=(const PixelReference& other) const
+			{
+				return *this = (Pixel)other;
+			}
+
+			/** Get component @p c, 0 to 3 for x to w. */
+			_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)& operator[](int c) const { return element[c * planeStride]; }
+		};
+
+		/** What indexing returns: pixels by value for read-only views, references otherwise. */
+		typedef typename std::conditional<std::is_const<T>::value, Pixel, PixelReference>::type Reference;
+
+		/** Pointer to the first element of the x plane. */
+		DEVICEPTR(T)* data;
+
+		/** Size of the image in pixels. */
+		Vector2<int> noDims;
+
+		/** Distance between the starts of two consecutive planes, in elements. */
+		size_t planeStride;
+
+		/** Device the data pointer refers to. */
+		MemoryDeviceType memoryType;
+
+		_CPU_AND_GPU_CODE_ PlanarImageView()
+			: data(NULL), noDims(0, 0), planeStride(0), memoryType(MEMORYDEVICE_CPU)
+		{}
+
+		_CPU_AND_GPU_CODE_ PlanarImageView(DEVICEPTR(T)* data, Vector2<int> noDims, size_t planeStride, MemoryDeviceType memoryType)
+			: data(data), noDims(noDims), planeStride(planeStride), memoryType(memoryType)
+		{}
+
+		/** Get the plane holding component @p c, 0 to 3 for x to w. */
+		_CPU_AND_GPU_CODE_ inline DEVICEPTR(T)* GetPlane(int c) const { return data + c * planeStride; }
+
+		/** Get pixel @p i, counting in row-major order. */
+		_CPU_AND_GPU_CODE_ inline Reference operator[](size_t i) const
+		{
+			return PixelReference(data + i, planeStride);
+		}
+
+		_CPU_AND_GPU_CODE_ inline Reference operator()(int x, int y) const { return (*this)[(size_t)y * noDims.x + x]; }
+
+		_CPU_AND_GPU_CODE_ inline void Set(size_t i, const Pixel& pixel) const { PixelReference(data + i, planeStride) = pixel; }
+
+		_CPU_AND_GPU_CODE_ inline void Set(int x, int y, const Pixel& pixel) const { Set((size_t)y * noDims.x + x, pixel); }
+	};
+
+	/** \brief
+	Image of Vector4<T> pixels stored as four planes, one per component,
+	instead of interleaved.
+
+	Each plane holds the components of all pixels in row-major order and
+	starts on a 64-byte boundary, so
+	SIMD kernels that only read some components load only those. Use
+	CopyFrom and CopyTo to convert from and to interleaved images.
+	*/
+	template <typename T>
+	class PlanarImage : public MemoryBlock < T >
+	{
+	private:
+		size_t planeStride;
+
+		/** Number of elements of each plane, rounded up to a multiple of 64 bytes. */
+		static size_t PlaneStrideFor(Vector2<int> noDims)
+		{
+			const size_t alignment = sizeof(T) < 64 && 64 % sizeof(T) == 0 ? 64 / sizeof(T) : 1;
+			return ((size_t)noDims.x * noDims.y + alignment - 1) / alignment * alignment;
+		}
+
+		/** Raise the alignment of @p policy so that the planes, not just
+		their offsets, start on 64-byte boundaries.
+		*/
+		static MemoryAllocationPolicy AlignedPolicy(MemoryAllocationPolicy policy)
+		{
+			if (policy.alignment < 64) policy.alignment = 64;
+			return policy;
+		}
+
+	public:
+		/** Size of the image in pixels. */
+		Vector2<int> noDims;
+
+		/** Initialize an empty image of the given size, either
+		on CPU only or on both CPU and GPU.
+		*/
+		PlanarImage(Vector2<int> noDims, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>(4 * PlaneStrideFor(noDims), allocate_CPU, allocate_CUDA, metalCompatible, AlignedPolicy(policy)),
+			  planeStride(PlaneStrideFor(noDims))
+		{
+			this->noDims = noDims;
+		}
+
+		/** Resize an image, loosing all old image data. The memory is
+		reused if the new size fits in the current capacity. The data is
+		undefined afterwards, unless the allocation policy is
+		INITIALISE_ZEROED.
+		*/
+		void ChangeDims(Vector2<int> newDims)
+		{
+			if (newDims != noDims)
+			{
+				this->noDims = newDims;
+				planeStride = PlaneStrideFor(newDims);
+
+				this->Resize(4 * planeStride);
+				this->InitialiseResizedData();
+			}
+		}
+
+		inline size_t GetPlaneStride() const { return planeStride; }
+
+		/** Get the plane holding component @p c, 0 to 3 for x to w, on CPU or GPU. */
+		inline DEVICEPTR(T)* GetPlane(int c, MemoryDeviceType memoryType) { return this->GetData(memoryType) + c * planeStride; }
+		inline const DEVICEPTR(T)* GetPlane(int c, MemoryDeviceType memoryType) const { return this->GetData(memoryType) + c * planeStride; }
+
+		/** View the image on the given device. */
+		PlanarImageView<T> GetView(MemoryDeviceType memoryType)
+		{
+			return PlanarImageView<T>(this->GetData(memoryType), noDims, planeStride, memoryType);
+		}
+
+		PlanarImageView<const T> GetView(MemoryDeviceType memoryType) const
+		{
+			return PlanarImageView<const T>(this->GetData(memoryType), noDims, planeStride, memoryType);
+		}
+
+		/** Split the interleaved pixels of @p source, which must be on the
+		CPU and the same size as this image, into the CPU planes.
+		*/
+		void CopyFrom(const ImageView<const Vector4<T> >& source)
+		{
+			if (source.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Planar images can only be converted on the CPU");
+			if (source.noDims != noDims) DIEWITHEXCEPTION("Cannot convert between images of different sizes");
+
+			T *data = this->GetData(MEMORYDEVICE_CPU);
+			for (int y = 0; y < noDims.y; ++y)
+			{
+				size_t offset = (size_t)y * noDims.x;
+				T *const planes[4] = { data + offset, data + planeStride + offset, data + 2 * planeStride + offset, data + 3 * planeStride + offset };
+				PlanarImageDetail::Kernels<T>::Split(source.GetRow(y), planes, noDims.x);
+			}
+		}
+
+		void CopyFrom(const Image<Vector4<T> >& source)
+		{
+			CopyFrom(ImageView<const Vector4<T> >(source, MEMORYDEVICE_CPU));
+		}
+
+		/** Interleave the CPU planes into @p target, which must be on the
+		CPU and the same size as this image.
+		*/
+		void CopyTo(const ImageView<Vector4<T> >& target) const
+		{
+			if (target.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Planar images can only be converted on the CPU");
+			if (target.noDims != noDims) DIEWITHEXCEPTION("Cannot convert between images of different sizes");
+
+			const T *data = this->GetData(MEMORYDEVICE_CPU);
+			for (int y = 0; y < noDims.y; ++y)
+			{
+				size_t offset = (size_t)y * noDims.x;
+				const T *const planes[4] = { data + offset, data + planeStride + offset, data + 2 * planeStride + offset, data + 3 * planeStride + offset };
+				PlanarImageDetail::Kernels<T>::Merge(planes, target.GetRow(y), noDims.x);
+			}
+		}
+
+		void CopyTo(Image<Vector4<T> >& target) const
+		{
+			CopyTo(ImageView<Vector4<T> >(target, MEMORYDEVICE_CPU));
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		PlanarImage(const PlanarImage&) = delete;
+		PlanarImage& operator=(const PlanarImage&) = delete;
+	};
+}
+
+#endif
@@ -0,0 +1,154 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ORUtils
+{
+	/** \brief
+	A file accessed with positioned reads and writes (pread/pwrite).
+
+	There is no shared file position, so any number of threads can read
+	and write disjoint ranges of the same file concurrently.
+	*/
+	class PositionedFile
+	{
+	public:
+		/** OPEN_READ opens an existing file read-only, OPEN_READ_WRITE opens
+		an existing file for update and OPEN_CREATE creates or truncates a
+		file for reading and writing.
+		*/
+		enum Mode { OPEN_READ, OPEN_READ_WRITE, OPEN_CREATE };
+
+	private:
+		std::string filename;
+#ifdef _WIN32
+		HANDLE handle;
+#else
+		int fd;
+#endif
+
+		/** Largest number of bytes passed to a single system call. */
+		static size_t MaxChunkBytes() { return (size_t)1 << 30; }
+
+	public:
+		/** Open @p filename, throwing std::runtime_error on failure. */
+		PositionedFile(const std::string& filename, Mode mode)
+			: filename(filename)
+		{
+#ifdef _WIN32
+			DWORD access = mode == OPEN_READ ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+			DWORD disposition = mode == OPEN_CREATE ? CREATE_ALWAYS : OPEN_EXISTING;
+			handle = CreateFileA(filename.c_str(), access, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (handle == INVALID_HANDLE_VALUE) throw std::runtime_error("Could not open " + filename);
+#else
+			int flags = mode == OPEN_READ ? O_RDONLY : mode == OPEN_READ_WRITE ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC;
+			fd = open(filename.c_str(), flags, 0644);
+			if (fd < 0) throw std::runtime_error("Could not open " + filename);
+#endif
+		}
+
+		~PositionedFile()
+		{
+#ifdef _WIN32
+			CloseHandle(handle);
+#else
+			close(fd);
+#endif
+		}
+
+		inline const std::string& GetFilename() const { return filename; }
+
+		/** Current size of the file in bytes. */
+		uint64_t GetSize() const
+		{
+#ifdef _WIN32
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(handle, &size)) throw std::runtime_error("Could not get the size of " + filename);
+			return (uint64_t)size.QuadPart;
+#else
+			struct stat st;
+			if (fstat(fd, &st) != 0) throw std::runtime_error("Could not get the size of " + filename);
+			return (uint64_t)st.st_size;
+#endif
+		}
+
+		/** Read exactly @p bytes at @p offset into @p dst, throwing std::runtime_error if the file is too short. */
+		void Read(void *dst, size_t bytes, uint64_t offset) const
+		{
+			char *p = (char*)dst;
+			while (bytes > 0)
+			{
+				size_t chunk = bytes < MaxChunkBytes() ? bytes : MaxChunkBytes();
+#ifdef _WIN32
+				OVERLAPPED overlapped = OVERLAPPED();
+				overlapped.Offset = (DWORD)offset;
+				overlapped.OffsetHigh = (DWORD)(offset >> 32);
+				DWORD done = 0;
+				if (!ReadFile(handle, p, (DWORD)chunk, &done, &overlapped)) done = 0;
+				size_t n = done;
+#else
+				ssize_t n = pread(fd, p, chunk, (off_t)offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) n = 0;
+#endif
+				if (n == 0) throw std::runtime_error("Could not read from " + filename);
+				p += n; offset += n; bytes -= n;
+			}
+		}
+
+		/** Write @p bytes from @p src at @p offset, extending the file if needed. */
+		void Write(const void *src, size_t bytes, uint64_t offset)
+		{
+			const char *p = (const char*)src;
+			while (bytes > 0)
+			{
+				size_t chunk = bytes < MaxChunkBytes() ? bytes : MaxChunkBytes();
+#ifdef _WIN32
+				OVERLAPPED overlapped = OVERLAPPED();
+				overlapped.Offset = (DWORD)offset;
+				overlapped.OffsetHigh = (DWORD)(offset >> 32);
+				DWORD done = 0;
+				if (!WriteFile(handle, p, (DWORD)chunk, &done, &overlapped)) done = 0;
+				size_t n = done;
+#else
+				ssize_t n = pwrite(fd, p, chunk, (off_t)offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) n = 0;
+#endif
+				if (n == 0) throw std::runtime_error("Could not write to " + filename);
+				p += n; offset += n; bytes -= n;
+			}
+		}
+
+		/** Flush written data to the storage device. */
+		void Sync()
+		{
+#ifdef _WIN32
+			FlushFileBuffers(handle);
+#else
+			fsync(fd);
+#endif
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		PositionedFile(const PositionedFile&) = delete;
+		PositionedFile& operator=(const PositionedFile&) = delete;
+	};
+}
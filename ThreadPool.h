@@ -0,0 +1,170 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** \brief
+	Worker threads that are started once and then reused, so that
+	ForEachPixel kernels and the bulk memory operations do not pay for
+	creating threads.
+
+	The calling thread takes part in each run. Runs started from inside
+	a task, or while another thread is using the pool, execute serially
+	on the calling thread instead of waiting.
+	*/
+	class ThreadPool
+	{
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex, runMutex;
+		std::condition_variable wake, done;
+
+		const std::function<void(size_t)> *task;
+		size_t taskCount;
+		std::atomic<size_t> nextTask;
+
+		/** Number of workers taking part in the current run. */
+		size_t participants;
+		/** Number of those that have not finished yet. */
+		size_t running;
+		/** Incremented for every run so workers can tell a new one has started. */
+		unsigned long long generation;
+		bool stopping;
+
+		std::exception_ptr error;
+
+		/** Whether the current thread is running tasks, either as a worker
+		or as the caller of Run. Runs started from such a thread are nested
+		and must not wait for the pool, or take runMutex, which it may own.
+		*/
+		static bool& IsRunningTasks()
+		{
+			static thread_local bool isRunning = false;
+			return isRunning;
+		}
+
+		/** Run tasks until there are none left, remembering the first exception. */
+		void RunTasks()
+		{
+			for (size_t i = nextTask++; i < taskCount; i = nextTask++)
+			{
+				try
+				{
+					(*task)(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!error) error = std::current_exception();
+					nextTask = taskCount;
+				}
+			}
+		}
+
+		void WorkerLoop(size_t index)
+		{
+			IsRunningTasks() = true;
+			unsigned long long seen = 0;
+
+			for (;;)
+			{
+				{
+					// Wait for a run that this worker takes part in.
+					std::unique_lock<std::mutex> lock(mutex);
+					for (;;)
+					{
+						if (stopping) return;
+						if (generation != seen)
+						{
+							seen = generation;
+							if (index < participants) break;
+						}
+						wake.wait(lock);
+					}
+				}
+
+				RunTasks();
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (--running == 0) done.notify_one();
+				}
+			}
+		}
+
+	public:
+		ThreadPool()
+			: task(NULL), taskCount(0), nextTask(0), participants(0), running(0), generation(0), stopping(false)
+		{}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+		}
+
+		static ThreadPool& Instance()
+		{
+			static ThreadPool instance;
+			return instance;
+		}
+
+		/** Run @p op(i) for every i in [0, @p count) on up to @p numThreads threads. */
+		void Run(size_t count, unsigned int numThreads, const std::function<void(size_t)>& op)
+		{
+			std::unique_lock<std::mutex> runLock(runMutex, std::defer_lock);
+			if (numThreads <= 1 || count <= 1 || IsRunningTasks() || !runLock.try_lock())
+			{
+				for (size_t i = 0; i < count; ++i) op(i);
+				return;
+			}
+
+			size_t helpers = numThreads - 1 < count - 1 ? numThreads - 1 : count - 1;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				while (workers.size() < helpers) workers.push_back(std::thread(&ThreadPool::WorkerLoop, this, workers.size()));
+
+				task = &op;
+				taskCount = count;
+				nextTask = 0;
+				participants = helpers;
+				running = helpers;
+				error = std::exception_ptr();
+				++generation;
+			}
+			wake.notify_all();
+
+			IsRunningTasks() = true;
+			RunTasks();
+			IsRunningTasks() = false;
+
+			std::exception_ptr runError;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (running > 0) done.wait(lock);
+				task = NULL;
+				runError = error;
+				error = std::exception_ptr();
+			}
+
+			if (runError) std::rethrow_exception(runError);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,361 @@
+// Copyright 2014-2015 Isis Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <string.h>
+#include <vector>
+
+#include "ImageView.h"
+
+#ifndef __METALC__
+
+namespace ORUtils
+{
+	/** Order of the pixels of a TiledImage in memory. */
+	enum TiledLayout
+	{
+		/** 8x8 tiles stored one after another in row-major order, with the
+		pixels of each tile also in row-major order.
+		*/
+		TILEDLAYOUT_TILES,
+		/** Z-order: the bits of x and y are interleaved, so every aligned
+		power-of-two square, from 2x2 pixels up, is contiguous in memory.
+		*/
+		TILEDLAYOUT_MORTON
+	};
+
+	/** Spread the low 16 bits of @p v to the even bits of the result. */
+	_CPU_AND_GPU_CODE_ inline unsigned int MortonSpread(unsigned int v)
+	{
+		v &= 0x0000ffff;
+		v = (v | (v << 8)) & 0x00ff00ff;
+		v = (v | (v << 4)) & 0x0f0f0f0f;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	}
+
+	/** Morton code of (@p x, @p y), with x in the even bits and y in the odd bits. */
+	_CPU_AND_GPU_CODE_ inline unsigned int MortonEncode(unsigned int x, unsigned int y)
+	{
+		return MortonSpread(x) | (MortonSpread(y) << 1);
+	}
+
+	/** \brief
+	Maps pixel coordinates to element offsets in a TiledImage.
+
+	The image is split into 8x8 tiles of 64 consecutive elements, with
+	partial tiles at the right and bottom padded. For the Morton layout
+	the number of tiles in each direction is also padded to a power of two,
+	and the tiles of a non-square grid are laid out as a row or column of
+	Z-ordered squares. The layout is a plain value, so it can be passed to
+	GPU kernels along with the data pointer.
+	*/
+	struct TiledImageLayout
+	{
+		/** Width and height of a tile in pixels. */
+		static const int TILE_SIZE = 8;
+
+		/** log2 of TILE_SIZE, so that pixel coordinates split into tile and
+		in-tile coordinates with shifts and masks.
+		*/
+		static const int TILE_SHIFT = 3;
+
+		/** Size of the image in pixels. */
+		Vector2<int> noDims;
+
+		/** Number of tiles in each direction, including padding. */
+		Vector2<int> noTiles;
+
+		TiledLayout layout;
+
+		/** Number of low bits of the tile coordinates that are interleaved in the Morton layout. */
+		int mortonBits;
+
+		/** Offset within its tile of each pixel of a tile, indexed by
+		y * TILE_SIZE + x, so that the per-pixel part of an address is a
+		single lookup for either layout.
+		*/
+		unsigned char offsetsInTile[TILE_SIZE * TILE_SIZE];
+
+		_CPU_AND_GPU_CODE_ TiledImageLayout()
+			: noDims(0, 0), noTiles(0, 0), layout(TILEDLAYOUT_TILES), mortonBits(0)
+		{
+			for (int i = 0; i < TILE_SIZE * TILE_SIZE; ++i) offsetsInTile[i] = (unsigned char)i;
+		}
+
+		TiledImageLayout(Vector2<int> noDims, TiledLayout layout)
+			: noDims(noDims), layout(layout), mortonBits(0)
+		{
+			if (noDims.x < 0 || noDims.y < 0) DIEWITHEXCEPTION("Image dimensions must not be negative");
+
+			for (int y = 0; y < TILE_SIZE; ++y)
+				for (int x = 0; x < TILE_SIZE; ++x)
+					offsetsInTile[y * TILE_SIZE + x] = (unsigned char)(layout == TILEDLAYOUT_MORTON ? MortonEncode(x, y) : y * TILE_SIZE + x);
+
+			noTiles = Vector2<int>((noDims.x + TILE_SIZE - 1) / TILE_SIZE, (noDims.y + TILE_SIZE - 1) / TILE_SIZE);
+			if (layout == TILEDLAYOUT_MORTON && noTiles.x > 0 && noTiles.y > 0)
+			{
+				int bitsX = 0, bitsY = 0;
+				while ((1 << bitsX) < noTiles.x) ++bitsX;
+				while ((1 << bitsY) < noTiles.y) ++bitsY;
+				if (bitsX > 16 || bitsY > 16) DIEWITHEXCEPTION("Image is too large for the Morton layout");
+
+				noTiles = Vector2<int>(1 << bitsX, 1 << bitsY);
+				mortonBits = bitsX < bitsY ? bitsX : bitsY;
+			}
+		}
+
+		/** Number of elements needed to store the image, including padding. */
+		inline size_t GetElementCount() const
+		{
+			return (size_t)noTiles.x * noTiles.y * TILE_SIZE * TILE_SIZE;
+		}
+
+		/** Offset of the first element of tile (@p tx, @p ty). */
+		_CPU_AND_GPU_CODE_ inline size_t TileOffset(int tx, int ty) const
+		{
+			size_t index;
+			if (layout == TILEDLAYOUT_MORTON)
+			{
+				unsigned int mask = (1u << mortonBits) - 1;
+				unsigned int rest = (unsigned int)(noTiles.x > noTiles.y ? tx : ty) >> mortonBits;
+				index = MortonEncode(tx & mask, ty & mask) | ((size_t)rest << (2 * mortonBits));
+			}
+			else index = (size_t)ty * noTiles.x + tx;
+
+			return index << (2 * TILE_SHIFT);
+		}
+
+		/** Offset of pixel (@p x, @p y), with 0 <= x, y < TILE_SIZE, within its tile. */
+		_CPU_AND_GPU_CODE_ inline int OffsetInTile(int x, int y) const
+		{
+			return offsetsInTile[(y << TILE_SHIFT) | x];
+		}
+
+		/** Offset of pixel (@p x, @p y), which must be inside the image, in the image data. */
+		_CPU_AND_GPU_CODE_ inline size_t Address(int x, int y) const
+		{
+			return TileOffset(x >> TILE_SHIFT, y >> TILE_SHIFT) + OffsetInTile(x & (TILE_SIZE - 1), y & (TILE_SIZE - 1));
+		}
+	};
+
+	/** \brief
+	Pixels around one pixel of a TiledImage, read from a row-major copy of
+	its tile and a border around it, so each access is a single indexed
+	load with no clamping or layout arithmetic.
+	*/
+	template <typename T>
+	struct TiledNeighbourhood
+	{
+		/** Centre pixel in the copy of the tile and its border. */
+		const T *centre;
+
+		/** Number of elements per row of the copy. */
+		int stride;
+
+		/** Offset of the centre pixel in the image data, which is also its
+		offset in any other image with the same layout.
+		*/
+		size_t address;
+
+		_CPU_AND_GPU_CODE_ inline const T& Centre() const { return *centre; }
+
+		/** Get the pixel at offset (@p dx, @p dy) from the centre, with both
+		offsets at most the radius the neighbourhood was made for.
+		*/
+		_CPU_AND_GPU_CODE_ inline const T& operator()(int dx, int dy) const { return centre[dy * stride + dx]; }
+	};
+
+	/** \brief
+	Image whose pixels are stored in 8x8 tiles or in Z-order rather than
+	row by row, so that small 2D neighbourhoods touch few cache lines.
+
+	Single pixels are addressed through the layout with shifts, masks and
+	a table lookup; ForEachNeighbourhood reads each tile and its border
+	once, so filters pay for the layout per tile rather than per tap. Use
+	CopyFrom and CopyTo to convert from and to ordinary row-major images.
+	*/
+	template <typename T>
+	class TiledImage : public MemoryBlock < T >
+	{
+	private:
+		TiledImageLayout tiledLayout;
+
+		/** Call @p op(tile, x, y, width) for each run of @p width pixels
+		starting at (x, y) that lies in one row of one tile, where tile is
+		the offset of the first element of that tile.
+		*/
+		template <typename Op>
+		void ForEachTileRow(const Op& op) const
+		{
+			const int tileSize = TiledImageLayout::TILE_SIZE;
+
+			for (int ty = 0; ty * tileSize < noDims.y; ++ty)
+			{
+				int height = noDims.y - ty * tileSize < tileSize ? noDims.y - ty * tileSize : tileSize;
+				for (int tx = 0; tx * tileSize < noDims.x; ++tx)
+				{
+					int width = noDims.x - tx * tileSize < tileSize ? noDims.x - tx * tileSize : tileSize;
+					size_t tile = tiledLayout.TileOffset(tx, ty);
+					for (int y = 0; y < height; ++y) op(tile, tx * tileSize, ty * tileSize + y, width);
+				}
+			}
+		}
+
+	public:
+		/** Size of the image in pixels. */
+		Vector2<int> noDims;
+
+		/** Initialize an empty image of the given size and layout, either
+		on CPU only or on both CPU and GPU.
+		*/
+		TiledImage(Vector2<int> noDims, TiledLayout layout, bool allocate_CPU, bool allocate_CUDA, bool metalCompatible = true,
+			const MemoryAllocationPolicy& policy = MemoryAllocationPolicy())
+			: MemoryBlock<T>(TiledImageLayout(noDims, layout).GetElementCount(), allocate_CPU, allocate_CUDA, metalCompatible, policy),
+			  tiledLayout(noDims, layout)
+		{
+			this->noDims = noDims;
+		}
+
+		inline const TiledImageLayout& GetLayout() const { return tiledLayout; }
+
+		/** Resize an image, loosing all old image data. The memory is
+		reused if the padded size fits in the current capacity. The data is
+		undefined afterwards, unless the allocation policy is
+		INITIALISE_ZEROED.
+		*/
+		void ChangeDims(Vector2<int> newDims)
+		{
+			if (newDims != noDims)
+			{
+				tiledLayout = TiledImageLayout(newDims, tiledLayout.layout);
+				this->noDims = newDims;
+
+				this->Resize(tiledLayout.GetElementCount());
+				this->InitialiseResizedData();
+			}
+		}
+
+		inline T& operator()(int x, int y) { return this->GetData(MEMORYDEVICE_CPU)[tiledLayout.Address(x, y)]; }
+		inline const T& operator()(int x, int y) const { return this->GetData(MEMORYDEVICE_CPU)[tiledLayout.Address(x, y)]; }
+
+		/** Convert the row-major pixels of @p source, which must be on the
+		CPU and the same size as this image, into the CPU copy of the tiles.
+		Padding is left untouched.
+		*/
+		void CopyFrom(const ImageView<const T>& source)
+		{
+			if (source.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Tiled images can only be converted on the CPU");
+			if (source.noDims != noDims) DIEWITHEXCEPTION("Cannot convert between images of different sizes");
+
+			T *data = this->GetData(MEMORYDEVICE_CPU);
+			const TiledImageLayout& layout = tiledLayout;
+			const unsigned char *offsets = layout.offsetsInTile;
+
+			ForEachTileRow([&](size_t tile, int x, int y, int width)
+			{
+				const T *row = source.GetRow(y) + x;
+				int rowInTile = y & (TiledImageLayout::TILE_SIZE - 1);
+
+				// Tile rows are contiguous in the tiles layout, but not in Z-order.
+				if (layout.layout == TILEDLAYOUT_TILES) memcpy(data + tile + rowInTile * TiledImageLayout::TILE_SIZE, row, width * sizeof(T));
+				else for (int i = 0; i < width; ++i) data[tile + offsets[rowInTile * TiledImageLayout::TILE_SIZE + i]] = row[i];
+			});
+		}
+
+		void CopyFrom(const Image<T>& source)
+		{
+			CopyFrom(ImageView<const T>(source, MEMORYDEVICE_CPU));
+		}
+
+		/** Convert the CPU copy of the tiles into row-major pixels in
+		@p target, which must be on the CPU and the same size as this image.
+		*/
+		void CopyTo(const ImageView<T>& target) const
+		{
+			if (target.memoryType != MEMORYDEVICE_CPU) DIEWITHEXCEPTION("Tiled images can only be converted on the CPU");
+			if (target.noDims != noDims) DIEWITHEXCEPTION("Cannot convert between images of different sizes");
+
+			const T *data = this->GetData(MEMORYDEVICE_CPU);
+			const TiledImageLayout& layout = tiledLayout;
+			const unsigned char *offsets = layout.offsetsInTile;
+
+			ForEachTileRow([&](size_t tile, int x, int y, int width)
+			{
+				T *row = target.GetRow(y) + x;
+				int rowInTile = y & (TiledImageLayout::TILE_SIZE - 1);
+
+				if (layout.layout == TILEDLAYOUT_TILES) memcpy(row, data + tile + rowInTile * TiledImageLayout::TILE_SIZE, width * sizeof(T));
+				else for (int i = 0; i < width; ++i) row[i] = data[tile + offsets[rowInTile * TiledImageLayout::TILE_SIZE + i]];
+			});
+		}
+
+		void CopyTo(Image<T>& target) const
+		{
+			CopyTo(ImageView<T>(target, MEMORYDEVICE_CPU));
+		}
+
+		/** Run @p f(neighbourhood, x, y) for every pixel of the CPU copy of
+		the image, tile by tile, where neighbourhood is a TiledNeighbourhood<T>
+		around (x, y) that can be read up to @p radius pixels in each
+		direction. Pixels outside the image are clamped to the border.
+		*/
+		template <typename F>
+		void ForEachNeighbourhood(int radius, const F& f) const
+		{
+			if (radius < 0) DIEWITHEXCEPTION("The neighbourhood radius must not be negative");
+
+			const int tileSize = TiledImageLayout::TILE_SIZE, tileShift = TiledImageLayout::TILE_SHIFT;
+			const T *data = this->GetData(MEMORYDEVICE_CPU);
+			const TiledImageLayout& layout = tiledLayout;
+			const int stride = tileSize + 2 * radius;
+			std::vector<T> window((size_t)stride * stride);
+
+			for (int ty = 0; ty * tileSize < noDims.y; ++ty)
+				for (int tx = 0; tx * tileSize < noDims.x; ++tx)
+				{
+					int x0 = tx * tileSize, y0 = ty * tileSize;
+
+					// Gather the tile and its border row by row, looking up the
+					// tile offset only when a row crosses into the next tile.
+					for (int wy = 0; wy < stride; ++wy)
+					{
+						int sy = CLAMP(y0 - radius + wy, 0, noDims.y - 1);
+						const unsigned char *rowOffsets = layout.offsetsInTile + ((sy & (tileSize - 1)) << tileShift);
+						T *row = &window[(size_t)wy * stride];
+						int lastTile = -1;
+						const T *tile = NULL;
+						for (int wx = 0; wx < stride; ++wx)
+						{
+							int sx = CLAMP(x0 - radius + wx, 0, noDims.x - 1);
+							if (sx >> tileShift != lastTile)
+							{
+								lastTile = sx >> tileShift;
+								tile = data + layout.TileOffset(lastTile, sy >> tileShift);
+							}
+							row[wx] = tile[rowOffsets[sx & (tileSize - 1)]];
+						}
+					}
+
+					size_t tileOffset = layout.TileOffset(tx, ty);
+					int x1 = MIN(x0 + tileSize, noDims.x), y1 = MIN(y0 + tileSize, noDims.y);
+					TiledNeighbourhood<T> neighbourhood;
+					neighbourhood.stride = stride;
+					for (int y = y0; y < y1; ++y)
+						for (int x = x0; x < x1; ++x)
+						{
+							neighbourhood.centre = &window[(size_t)(y - y0 + radius) * stride + (x - x0 + radius)];
+							neighbourhood.address = tileOffset + layout.OffsetInTile(x - x0, y - y0);
+							f(neighbourhood, x, y);
+						}
+				}
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		TiledImage(const TiledImage&) = delete;
+		TiledImage& operator=(const TiledImage&) = delete;
+	};
+}
+
+#endif